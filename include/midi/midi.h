@@ -18,11 +18,14 @@
 
 #include <zephyr/device.h>
 
+#include "midi/midi_time.h"
+#include "midi/midi_trace.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define MIDI_TIME_13BIT(time) (uint16_t)((time)&8191)
+#define MIDI_TIME_13BIT(time) (uint16_t)((time)&MIDI_TIME_13BIT_MASK)
 
 #define MIDI_OP_NOTE_OFF 0x8
 #define MIDI_OP_NOTE_ON 0x9
@@ -117,7 +120,7 @@ typedef struct {
 } __packed midi_event_2_byte_t;
 
 /** @brief Struct holding a MIDI message. */
-typedef struct {
+typedef struct midi_msg {
     /** reserved for FIFO use. */
 	void *fifo_reserved;
 	/** format of midi message */
@@ -130,14 +133,18 @@ typedef struct {
 	uint8_t len;
 	/** reference count */
 	uint8_t ref;
-	/*uptime. NOTE: THIS VARIABLE IS A TEMPORARY WORKAROUND*/
-	int64_t uptime;
+	/** time in microseconds of the MIDI timebase, see midi_time.h.
+	 * Set when the message is received or queued for sending.
+	 */
+	int64_t time_us;
 	uint8_t num;
 	uint8_t ack_channel;
 	
 	void * context;
 
 	struct net_buf_t *buf;
+	/** message owning the data of a clone, NULL if the data is owned */
+	struct midi_msg *parent;
 } midi_msg_t;
 
 /**
@@ -155,6 +162,30 @@ typedef int (*midi_transfer)(const struct device *dev,
 				    midi_msg_t *msg,
 					void *user_data);
 
+/** @brief Counters of a MIDI port, see midi_stats_get(). */
+struct midi_stats {
+	uint32_t rx_msgs;
+	uint32_t rx_bytes;
+	uint32_t tx_msgs;
+	uint32_t tx_bytes;
+	/** Messages dropped because a buffer could not be allocated */
+	uint32_t drop_alloc;
+	/** Messages dropped because a queue was full */
+	uint32_t drop_queue_full;
+	/** Messages dropped because they were too late to be played */
+	uint32_t drop_late;
+	/** Messages or frames dropped because they could not be parsed */
+	uint32_t drop_parse;
+	/** Messages dropped because they do not fit in what the port sends */
+	uint32_t drop_too_long;
+	/** Highest number of messages queued for sending */
+	uint32_t queue_high_water;
+	/** Time from a message is queued until it is sent, over tx_msgs */
+	uint32_t latency_min_us;
+	uint32_t latency_max_us;
+	uint64_t latency_sum_us;
+};
+
 struct midi_api {
 	midi_transfer midi_transfer;
 
@@ -164,6 +195,9 @@ struct midi_api {
 						midi_transfer cb,
 						void *user_data);
 
+	int (*midi_stats_get)(const struct device *dev,
+						struct midi_stats *stats,
+						bool reset);
 };
 
 /**
@@ -215,12 +249,105 @@ static inline int midi_callback_set(const struct device *dev,
 	return -ENOTSUP;
 }
 
+/**
+ * @brief Get the counters of a port.
+ *
+ * @param dev   MIDI device structure.
+ * @param stats Counters of the port.
+ * @param reset Reset the counters after reading them.
+ *
+ * @retval -ENOTSUP If not supported, or CONFIG_MIDI_STATS is not set.
+ * @retval 0	    If successful, negative errno code otherwise.
+ */
+static inline int midi_stats_get(const struct device *dev,
+				 struct midi_stats *stats,
+				 bool reset)
+{
+	const struct midi_api *api =
+			(const struct midi_api *)dev->api;
+	if (!IS_ENABLED(CONFIG_MIDI_STATS) || (api == NULL) ||
+	    (api->midi_stats_get == NULL)) {
+		return -ENOTSUP;
+	}
+
+	return api->midi_stats_get(dev, stats, reset);
+}
+
+/**
+ * @brief Check if a message is a System Real-Time message.
+ *
+ * System Real-Time messages (clock, start, continue, stop, active sensing
+ * and reset) may be sent ahead of other queued messages.
+ *
+ * @param msg MIDI message.
+ *
+ * @retval true if the message is a System Real-Time message.
+ */
+static inline bool midi_msg_is_realtime(const midi_msg_t *msg)
+{
+	switch (msg->format) {
+	case MIDI_FORMAT_1_0_PARSED:
+	case MIDI_FORMAT_1_0_SERIAL:
+	case MIDI_FORMAT_1_0_PARSED_DELTA_US:
+		return (msg->len == 1) && (msg->data[0] >= 0xF8);
+	case MIDI_FORMAT_1_0_USB:
+		/** Code index number 0xF, single byte */
+		return (msg->len == 4) && ((msg->data[0] & 0x0F) == 0x0F) &&
+		       (msg->data[1] >= 0xF8);
+	case MIDI_FORMAT_2_0_UMP:
+		/** Message type 0x1, system messages */
+		return (msg->len >= 2) && ((msg->data[0] >> 4) == 0x1) &&
+		       (msg->data[1] >= 0xF8);
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Get the MIDI 1.0 statusbyte of a message.
+ *
+ * UMP channel voice messages give the statusbyte of their opcode and
+ * channel, UMP System Exclusive gives 0xF0.
+ *
+ * @param msg MIDI message.
+ *
+ * @return The statusbyte, 0 for databytes of a serial stream and
+ *	   messages without one.
+ */
+static inline uint8_t midi_msg_status(const midi_msg_t *msg)
+{
+	if (msg->len == 0) {
+		return 0;
+	}
+
+	switch (msg->format) {
+	case MIDI_FORMAT_1_0_PARSED:
+	case MIDI_FORMAT_1_0_SERIAL:
+	case MIDI_FORMAT_1_0_PARSED_DELTA_US:
+		return (msg->data[0] >= 0x80) ? msg->data[0] : 0;
+	case MIDI_FORMAT_1_0_USB:
+		return ((msg->len >= 2) && (msg->data[1] >= 0x80)) ? msg->data[1] : 0;
+	case MIDI_FORMAT_2_0_UMP:
+		switch (msg->data[0] >> 4) {
+		case 0x1:
+		case 0x2:
+		case 0x4:
+			return (msg->len >= 2) ? msg->data[1] : 0;
+		case 0x3:
+			return 0xF0;
+		default:
+			return 0;
+		}
+	default:
+		return 0;
+	}
+}
 
 midi_msg_t * __must_check midi_msg_alloc(midi_msg_t * msg, size_t size);
 
 midi_msg_t  * __must_check midi_msg_init(struct net_buf *buf,
 						uint8_t *data, uint8_t len, enum midi_format format,
-						void *context, uint16_t timestamp, int64_t uptime, 
+						void *context, uint16_t timestamp, int64_t time_us, 
 						uint8_t num, uint8_t ack_channel);
 
 midi_msg_t  * __must_check midi_msg_init_alloc(midi_msg_t * msg, uint8_t size, 
@@ -228,6 +355,19 @@ midi_msg_t  * __must_check midi_msg_init_alloc(midi_msg_t * msg, uint8_t size,
 
 midi_msg_t * __must_check midi_msg_ref(midi_msg_t *msg);
 
+/**
+ * @brief Clone a message without copying its data.
+ *
+ * The clone has its own header, so it can be queued on another port
+ * while the original is in use. The data is shared and must not be
+ * modified. It is released with the last of the original and its clones.
+ *
+ * @param msg MIDI message.
+ *
+ * @return The clone, NULL if out of memory.
+ */
+midi_msg_t * __must_check midi_msg_clone(midi_msg_t *msg);
+
 void midi_msg_unref(midi_msg_t *msg);
 void midi_msg_unref_alt(midi_msg_t *msg);
 
@@ -60,6 +60,101 @@ void midi_iso_set_function_block(midi_ump_function_block_t *function_block);
 
 void midi_iso_ack_msg(uint8_t muid, uint8_t msg_num);
 
+/**
+ * @brief Ack messages sent by the iso broadcaster to a receiver.
+ *
+ * @param muid          First byte of the MUID of the receiver.
+ * @param first_msg_num Message number acked by bit 0 of @p bitmap.
+ * @param bitmap        Bit n acks message number @p first_msg_num + n.
+ */
+void midi_iso_ack_bitmap(uint8_t muid, uint8_t first_msg_num, uint32_t bitmap);
+
+/**
+ * @brief Called for a UMP message the iso receiver received again and
+ * dropped, as the ACK of the first copy was lost.
+ *
+ * @param msg_num     Message number to ack.
+ * @param ack_channel ACK channel of the message.
+ */
+typedef void (*midi_iso_ack_needed)(uint8_t msg_num, uint8_t ack_channel);
+
+/**
+ * @brief Register the callback for messages to ack again.
+ *
+ * @param cb        Callback, called from the Bluetooth receive thread.
+ *
+ * @retval 0	    If successful.
+ */
+int midi_iso_register_ack_cb(midi_iso_ack_needed cb);
+
+/** @brief Sequence counters of the UMP messages of a broadcaster. */
+struct midi_iso_seq_stats {
+	/** Messages received again and dropped */
+	uint32_t duplicates;
+	/** Messages received after later ones, put back in order */
+	uint32_t reordered;
+	/** Sequence numbers never received, messages after them delivered */
+	uint32_t gaps;
+	/**
+	 * Messages past their playout time when received, see
+	 * CONFIG_MIDI_ISO_RECEIVER_PLAYOUT
+	 */
+	uint32_t late;
+};
+
+/**
+ * @brief Get the sequence counters of a BIG of the iso receiver.
+ *
+ * @param dev       MIDI device structure.
+ * @param big       Index of the BIG, from 0 up to max-bigs.
+ * @param stats     Counters of the BIG.
+ * @param reset     Reset the counters after reading them.
+ *
+ * @retval -ENOENT  If there is no such BIG.
+ * @retval 0	    If successful.
+ */
+int midi_iso_seq_stats_get(const struct device *dev, uint8_t big,
+			   struct midi_iso_seq_stats *stats, bool reset);
+
+/** @brief Sequence and loss counters of a BIS the receiver syncs to. */
+struct midi_iso_bis_stats {
+	/** SDUs received */
+	uint32_t sdus;
+	/** SDUs missed, from gaps in the sequence numbers */
+	uint32_t lost;
+	/** SDUs the controller received with errors or not at all */
+	uint32_t invalid;
+	/**
+	 * SDUs of the lost and invalid ones recovered from copies in later
+	 * SDUs, see fec-depth of the broadcaster
+	 */
+	uint32_t recovered;
+	/**
+	 * Snapshots of the channel state applied, see
+	 * CONFIG_MIDI_ISO_RECEIVER_SNAPSHOT
+	 */
+	uint32_t snapshots;
+	/** Sequence number of the last SDU */
+	uint16_t last_seq;
+	/** The BIS is synced to */
+	bool synced;
+};
+
+/**
+ * @brief Get the counters of a BIS of the iso receiver.
+ *
+ * @param dev       MIDI device structure.
+ * @param big       Index of the BIG, from 0 up to max-bigs.
+ * @param bis       BIS number, one of bises in the devicetree.
+ * @param stats     Counters of the BIS.
+ * @param reset     Reset the counters after reading them.
+ *
+ * @retval -ENOENT  If the receiver does not sync to the BIS.
+ * @retval 0	    If successful.
+ */
+int midi_iso_bis_stats_get(const struct device *dev, uint8_t big, uint8_t bis,
+			   struct midi_iso_bis_stats *stats, bool reset);
+
 #ifdef __cplusplus
 }
 #endif
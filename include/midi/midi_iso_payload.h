@@ -0,0 +1,251 @@
+/**
+ * @file midi_iso_payload.h
+ *
+ * @defgroup midi_iso_payload MIDI ISO payloads
+ * @{
+ * @brief Building and parsing the payloads of ISO MIDI BISes.
+ *
+ * A payload holds chunks of MIDI 1.0 and UMP messages, copies of the
+ * chunks of the payloads before it and pieces of a snapshot of the
+ * channel state. A payload is built in one of two buffers while the
+ * radio sends the other one. The builder is not locked: a thread adds to
+ * it while the radio event swaps its buffers.
+ */
+#ifndef MIDI_ISO_PAYLOAD_H__
+#define MIDI_ISO_PAYLOAD_H__
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/types.h>
+#include <midi/midi.h>
+#if defined(CONFIG_MIDI_ISO_SNAPSHOT)
+#include <midi/midi_iso_snapshot.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Payloads kept for copying, a power of two above the depth of copies */
+#define MIDI_ISO_PAYLOAD_FEC_SLOTS 4
+
+/** @brief Chunks of a built payload, copied into the payloads after it. */
+struct midi_iso_payload_fec {
+	/** A copy carries at most UINT8_MAX bytes */
+	uint8_t data[UINT8_MAX];
+	/** Above UINT8_MAX if the chunks do not fit in a copy */
+	uint16_t len;
+	/** Offset of the length byte of the open chunk, 0 if none */
+	uint16_t chunk;
+	/** Start of the payload, tells the payloads apart */
+	int64_t ref_time;
+};
+
+/**
+ * @brief What the next message is encoded against, as last committed to
+ * a payload.
+ */
+struct midi_iso_payload_ctx {
+	/** Start of the payload the context is of */
+	int64_t ref_time;
+	/** Type and MUID byte of the open chunk, if the state has one open */
+	uint8_t type;
+	uint8_t muid;
+	/** Running status of an open MIDI 1.0 chunk */
+	uint8_t running_status;
+	/** The payload has a UMP message, the last one is described below */
+	bool ump;
+	uint8_t fraction;
+	uint8_t seq;
+	uint8_t status[2];
+};
+
+/**
+ * @brief Give the receiver of a MUID byte an ACK channel, for its first
+ * UMP chunk in a payload.
+ *
+ * @return The ACK channel, 0xFF if none.
+ */
+typedef uint8_t (*midi_iso_payload_ack_channel_t)(uint8_t muid);
+
+/**
+ * @brief Double-buffered payload builder.
+ *
+ * Messages are written past the committed length of the back buffer and
+ * committed with a compare and swap of the state. The radio event only
+ * swaps the buffer index with midi_iso_payload_swap().
+ */
+struct midi_iso_payload_builder {
+	atomic_t state;
+	uint8_t *base[2];
+	/** Start of each payload, timestamps are relative to it */
+	int64_t ref_time[2];
+	/** Bytes of a payload */
+	size_t size;
+	/** ISO interval, timestamps are fractions of it */
+	uint32_t interval_us;
+	/** Gives ACK channels to receivers, NULL if there are none */
+	midi_iso_payload_ack_channel_t ack_channel;
+	struct midi_iso_payload_ctx ctx;
+	/** MIDI_ISO_PAYLOAD_FEC_SLOTS last payloads, NULL if none are copied */
+	struct midi_iso_payload_fec *fec;
+	/** Payloads back whose chunks are copied into each payload */
+	uint8_t fec_depth;
+	/** Bytes of copies in a payload */
+	uint16_t fec_max_bytes;
+	/** Start of the last payload copies were added to */
+	int64_t fec_written;
+};
+
+/**
+ * @brief Add a message to the payload being built.
+ *
+ * If the radio event swapped the buffers while the message was written,
+ * it is written again to the new back buffer. A message is added to the
+ * open chunk if it is of the same kind, UMP messages only if they go to
+ * the same MUID, whose byte is in the context of the message. The
+ * timestamp of the message is set to the fraction of the interval it is
+ * sent at.
+ *
+ * @param builder Builder.
+ * @param msg     MIDI 1.0 or UMP message, other formats are skipped. A
+ *		  UMP message must have its MUID byte in its context.
+ *
+ * @retval -ENOMEM If the payload is full until the next radio event.
+ * @retval 0	   If the message is added.
+ */
+int midi_iso_payload_add_msg(struct midi_iso_payload_builder *builder, midi_msg_t *msg);
+
+/**
+ * @brief Add copies of the chunks of the last payloads to the payload
+ * being built, once per payload.
+ *
+ * Copies of older payloads are left out first when they do not fit.
+ *
+ * @param builder Builder.
+ */
+void midi_iso_payload_add_fec(struct midi_iso_payload_builder *builder);
+
+/**
+ * @brief Finish the payload being built and start one in the other buffer.
+ *
+ * Called from the radio event. The length byte of an open chunk is
+ * written here as well, in case the thread adding messages was preempted
+ * before writing it. Both write the same value.
+ *
+ * @param builder   Builder.
+ * @param next_base Buffer of the next payload.
+ * @param ref_time  Start of the next payload.
+ * @param finished  The finished payload, NULL if there was none.
+ *
+ * @return Length of the finished payload.
+ */
+uint16_t midi_iso_payload_swap(struct midi_iso_payload_builder *builder, uint8_t *next_base,
+			       int64_t ref_time, uint8_t **finished);
+
+#if defined(CONFIG_MIDI_ISO_SNAPSHOT)
+/**
+ * @brief Select the snapshot entries added to a payload.
+ *
+ * @return true if the entry is added.
+ */
+typedef bool (*midi_iso_payload_entry_filter_t)(const struct midi_iso_snapshot_entry *entry,
+						void *user_data);
+
+/**
+ * @brief Add a piece of a snapshot of the channel state to the payload
+ * being built.
+ *
+ * The piece holds the entries of a walk over the snapshot that fit in
+ * @p max_bytes, at least one.
+ *
+ * @param builder   Builder.
+ * @param snapshot  Snapshot.
+ * @param cursor    Walk over the snapshot, moved past the entries added.
+ * @param piece     Number of the piece, from 0.
+ * @param max_bytes Bytes of entries in a piece.
+ * @param filter    Entries of the snapshot sent with the builder.
+ * @param user_data Passed to @p filter.
+ *
+ * @retval -ENOMEM If there is no room for an entry until the next radio
+ *		   event.
+ * @retval 0	   If the piece is added and entries are left.
+ * @retval 1	   If the last piece of the snapshot is added.
+ */
+int midi_iso_payload_add_snapshot(struct midi_iso_payload_builder *builder,
+				  struct midi_iso_snapshot *snapshot,
+				  struct midi_iso_snapshot_cursor *cursor, uint8_t piece,
+				  size_t max_bytes, midi_iso_payload_entry_filter_t filter,
+				  void *user_data);
+#endif
+
+/** @brief A UMP message of a payload, before its message is created. */
+struct midi_iso_payload_ump {
+	/** MUID byte of its chunk */
+	uint8_t muid;
+	/** Sequence number, PAYLOAD_MSG_NUM_NONE if sent without retransmission */
+	uint8_t num;
+	/** ACK channel, 0xFF if none */
+	uint8_t ack_channel;
+	/** First byte, the message type is its high nibble */
+	uint8_t type;
+};
+
+/**
+ * @brief Callbacks of a parsed payload.
+ *
+ * Messages are views of the buffer of the payload, except UMP messages
+ * in running status which are copies. The reference of a message is
+ * handed to @ref msg_cb.
+ */
+struct midi_iso_payload_parser {
+	/** ISO interval, timestamps are fractions of it */
+	uint32_t interval_us;
+	/**
+	 * A message, its timestamp the microseconds since the message
+	 * delivered before it in the payload, at @p time_us.
+	 */
+	void (*msg_cb)(midi_msg_t *msg, int64_t time_us, void *user_data);
+	/** A UMP message is created and delivered if it returns true */
+	bool (*ump_filter)(const struct midi_iso_payload_ump *ump, void *user_data);
+	/**
+	 * A copy of the payload @p age payloads before, parsed if it returns
+	 * true. Copies are skipped if NULL.
+	 */
+	bool (*fec_cb)(uint8_t age, void *user_data);
+	/**
+	 * A snapshot piece, parsed if it returns true. @p flags is the
+	 * second argument of its chunk. Snapshots are skipped if NULL.
+	 */
+	bool (*snapshot_cb)(uint8_t piece, uint8_t flags, void *user_data);
+	/** A malformed payload or message, the rest of its chunk is skipped */
+	void (*malformed_cb)(void *user_data);
+	void *user_data;
+};
+
+/**
+ * @brief Parse the chunks of a payload.
+ *
+ * Copies and snapshot pieces are parsed like the payload, without their
+ * own copies and pieces. The MIDI 1.0 messages of a payload are changed
+ * in place in @p buf.
+ *
+ * @param parser    Callbacks.
+ * @param buf       Buffer holding the payload.
+ * @param pos       Start of the payload, at its version.
+ * @param end       End of the payload.
+ * @param recv_time Time the payload was received at.
+ */
+void midi_iso_payload_parse(const struct midi_iso_payload_parser *parser, struct net_buf *buf,
+			    uint8_t *pos, uint8_t *end, int64_t recv_time);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MIDI_ISO_PAYLOAD_H__ */
@@ -0,0 +1,101 @@
+/**
+ * @file midi_iso_snapshot.h
+ *
+ * @defgroup midi_iso_snapshot MIDI ISO state snapshot
+ * @{
+ * @brief Channel state of a broadcast, for receivers joining it late.
+ *
+ * The table follows the channel messages sent, per UMP group and MUID:
+ * programs, controllers, pitch bend, channel pressure and held notes.
+ * Each entry is the last message that set a piece of the state, so the
+ * state is restored by sending the entries again. Nothing is allocated
+ * per message.
+ */
+#ifndef MIDI_ISO_SNAPSHOT_H__
+#define MIDI_ISO_SNAPSHOT_H__
+
+#include <stdbool.h>
+#include <zephyr/types.h>
+#include <midi/midi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct midi_iso_snapshot_entry {
+	/** The message, MIDI 1.0 or UMP, data[0] is 0 if the entry is free */
+	uint8_t data[4];
+	/** First byte of the MUID a UMP message is sent to */
+	uint8_t muid;
+	bool ump;
+};
+
+struct midi_iso_snapshot {
+	struct midi_iso_snapshot_entry entries[CONFIG_MIDI_ISO_SNAPSHOT_ENTRIES];
+	/** Messages whose state did not fit in the table */
+	uint32_t dropped;
+};
+
+/**
+ * @brief Position in a walk over the entries of a table.
+ *
+ * Entries are walked controllers first, then programs, pitch bend,
+ * channel pressure and notes, so bank selects come before programs and
+ * notes are played with their controllers set.
+ */
+struct midi_iso_snapshot_cursor {
+	uint8_t pass;
+	uint16_t index;
+};
+
+/**
+ * @brief Initialize a table.
+ *
+ * @param snapshot Table.
+ */
+void midi_iso_snapshot_init(struct midi_iso_snapshot *snapshot);
+
+/**
+ * @brief Update the table with a sent message.
+ *
+ * MIDI 1.0 messages and UMP MIDI 1.0 channel voice messages are
+ * followed, other messages are ignored.
+ *
+ * @param snapshot Table.
+ * @param msg      Message. A UMP message must have its MUID byte in its
+ *		   context.
+ */
+void midi_iso_snapshot_update(struct midi_iso_snapshot *snapshot, const midi_msg_t *msg);
+
+/**
+ * @brief Get the next entry of a walk over a table.
+ *
+ * Entries changed during a walk are given as they are when the walk gets
+ * to them. Entries added behind the walk are left out.
+ *
+ * @param snapshot Table.
+ * @param cursor   Position, zeroed to start a walk.
+ *
+ * @return The entry, NULL at the end of the walk. The cursor is moved
+ *	   past it with midi_iso_snapshot_next().
+ */
+const struct midi_iso_snapshot_entry *
+midi_iso_snapshot_peek(struct midi_iso_snapshot *snapshot,
+		       struct midi_iso_snapshot_cursor *cursor);
+
+/**
+ * @brief Move a walk past the entry given by midi_iso_snapshot_peek().
+ *
+ * @param cursor Position.
+ */
+void midi_iso_snapshot_next(struct midi_iso_snapshot_cursor *cursor);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MIDI_ISO_SNAPSHOT_H__ */
@@ -0,0 +1,147 @@
+/**
+ * @file midi_iso_window.h
+ *
+ * @defgroup midi_iso_window MIDI ISO retransmit window
+ * @{
+ * @brief Retransmit window of reliably sent ISO MIDI messages.
+ *
+ * Messages are given 8-bit sequence numbers and held in a fixed window
+ * indexed by them until every receiver they are sent to has acked them.
+ * A receiver acks many sequence numbers at once with a bitmap. Messages
+ * that have waited long enough for their ACKs are handed out again for
+ * resending. Nothing is allocated per message.
+ */
+#ifndef MIDI_ISO_WINDOW_H__
+#define MIDI_ISO_WINDOW_H__
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/types.h>
+#include <midi/midi.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Called when a message leaves the window.
+ *
+ * @param msg   The message, its reference is handed to the callback.
+ * @param acked True if every receiver acked it, false if it was pushed
+ *              out of a full window.
+ */
+typedef void (*midi_iso_window_done_t)(midi_msg_t *msg, bool acked);
+
+struct midi_iso_window_entry {
+	midi_msg_t *msg;
+	/** Receivers that have not acked, one bit per receiver */
+	uint32_t pending;
+	/** Interval the message was last sent in */
+	uint8_t sent_in;
+};
+
+struct midi_iso_window {
+	struct k_spinlock lock;
+	struct midi_iso_window_entry entries[CONFIG_MIDI_ISO_WINDOW_SIZE];
+	/** Sequence number of the oldest message in the window */
+	uint8_t tail;
+	/** Sequence number of the next message */
+	uint8_t head;
+	/** Count of ISO intervals, see midi_iso_window_tick() */
+	uint8_t interval;
+	/** Receivers in use, one bit per receiver */
+	uint32_t receivers;
+	/** Receiver of each MUID byte plus one, 0 if none */
+	uint8_t receiver_of[256];
+	midi_iso_window_done_t done;
+};
+
+/**
+ * @brief Initialize a window.
+ *
+ * @param window Window.
+ * @param done   Called with each message leaving the window.
+ */
+void midi_iso_window_init(struct midi_iso_window *window, midi_iso_window_done_t done);
+
+/**
+ * @brief Add a message sent to a receiver.
+ *
+ * The message is given the next sequence number in msg->num and is held
+ * until the receiver acks it. If the window is full, the oldest message
+ * is pushed out of it.
+ *
+ * @param window Window.
+ * @param msg    Message, its reference is held by the window.
+ * @param muid   First byte of the MUID of the receiver.
+ *
+ * @retval -ENOMEM  If there is no room for another receiver. The message
+ *                  is not added and keeps PAYLOAD_MSG_NUM_NONE.
+ * @retval receiver Index of the receiver otherwise.
+ */
+int midi_iso_window_add(struct midi_iso_window *window, midi_msg_t *msg, uint8_t muid);
+
+/**
+ * @brief Ack messages for a receiver.
+ *
+ * Bit n of @p bitmap acks sequence number @p seq + n. Sequence numbers
+ * outside the window are ignored.
+ *
+ * @param window Window.
+ * @param muid   First byte of the MUID of the receiver.
+ * @param seq    Sequence number of bit 0.
+ * @param bitmap Acked sequence numbers.
+ *
+ * @return Number of messages acked by all their receivers.
+ */
+int midi_iso_window_ack(struct midi_iso_window *window, uint8_t muid, uint8_t seq,
+			uint32_t bitmap);
+
+/**
+ * @brief Count an ISO interval.
+ *
+ * Messages are resent once they have waited
+ * CONFIG_MIDI_ISO_WINDOW_RESEND_INTERVALS intervals for their ACKs.
+ */
+void midi_iso_window_tick(struct midi_iso_window *window);
+
+/**
+ * @brief Get messages to resend.
+ *
+ * The messages are counted as sent in the current interval. Each is
+ * given with a new reference, to be released after sending it.
+ *
+ * @param window Window.
+ * @param msgs   Messages to resend.
+ * @param max    Size of @p msgs.
+ *
+ * @return Number of messages, @p max if there may be more.
+ */
+size_t midi_iso_window_resend(struct midi_iso_window *window, midi_msg_t **msgs, size_t max);
+
+/**
+ * @brief Get the receiver of a MUID byte.
+ *
+ * @retval -ENOENT  If no message was added for the receiver.
+ * @retval receiver Index of the receiver otherwise.
+ */
+int midi_iso_window_receiver(struct midi_iso_window *window, uint8_t muid);
+
+/**
+ * @brief Forget a receiver, its pending ACKs count as received.
+ *
+ * @param window Window.
+ * @param muid   First byte of the MUID of the receiver.
+ */
+void midi_iso_window_receiver_remove(struct midi_iso_window *window, uint8_t muid);
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MIDI_ISO_WINDOW_H__ */
@@ -0,0 +1,180 @@
+
+
+/**
+ * @file
+ * @brief MIDI message ring
+ *
+ * Lock-free single-producer/single-consumer ring of message pointers.
+ * One context may put and one context may get, for example a UART
+ * callback and a driver thread. Queues with several producers must use
+ * k_fifo instead.
+ */
+
+#ifndef ZEPHYR_INCLUDE_MIDI_RING_H_
+#define ZEPHYR_INCLUDE_MIDI_RING_H_
+
+#include <errno.h>
+#include <stddef.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(CONFIG_DCACHE_LINE_SIZE) && (CONFIG_DCACHE_LINE_SIZE > 0)
+#define MIDI_RING_CACHE_LINE CONFIG_DCACHE_LINE_SIZE
+#else
+#define MIDI_RING_CACHE_LINE 32
+#endif
+
+struct midi_ring {
+	/** Next slot to put, written by the producer only */
+	atomic_t head __aligned(MIDI_RING_CACHE_LINE);
+
+	/** Next slot to get, written by the consumer only */
+	atomic_t tail __aligned(MIDI_RING_CACHE_LINE);
+
+	void **slots __aligned(MIDI_RING_CACHE_LINE);
+
+	uint32_t mask;
+
+	/** Raised when a put makes the ring non-empty */
+	struct k_poll_signal signal;
+};
+
+/**
+ * @brief Statically define and initialize a ring.
+ *
+ * @param name Name of the ring.
+ * @param size Number of slots, a power of two.
+ */
+#define MIDI_RING_DEFINE(name, size)						\
+	BUILD_ASSERT(IS_POWER_OF_TWO(size), "ring size must be a power of two");	\
+	static void *name##_slots[size];						\
+	static struct midi_ring name = {						\
+		.slots = name##_slots,							\
+		.mask = (size) - 1,							\
+		.signal = K_POLL_SIGNAL_INITIALIZER(name.signal),			\
+	}
+
+/**
+ * @brief Initialize a ring.
+ *
+ * @param ring  Ring.
+ * @param slots Storage of @p size pointers.
+ * @param size  Number of slots, a power of two.
+ */
+static inline void midi_ring_init(struct midi_ring *ring, void **slots, size_t size)
+{
+	__ASSERT(IS_POWER_OF_TWO(size), "ring size must be a power of two");
+
+	atomic_set(&ring->head, 0);
+	atomic_set(&ring->tail, 0);
+	ring->slots = slots;
+	ring->mask = size - 1;
+	k_poll_signal_init(&ring->signal);
+}
+
+static inline bool midi_ring_is_empty(struct midi_ring *ring)
+{
+	return atomic_get(&ring->head) == atomic_get(&ring->tail);
+}
+
+/**
+ * @brief Put an item in the ring. Producer side only, callable from ISRs.
+ *
+ * @retval 0       If successful.
+ * @retval -ENOMEM If the ring is full.
+ */
+static inline int midi_ring_put(struct midi_ring *ring, void *item)
+{
+	atomic_val_t head = atomic_get(&ring->head);
+	atomic_val_t tail = atomic_get(&ring->tail);
+
+	if ((uint32_t)(head - tail) > ring->mask) {
+		return -ENOMEM;
+	}
+
+	ring->slots[head & ring->mask] = item;
+	/** Publish the slot before the new head */
+	atomic_set(&ring->head, head + 1);
+
+	/** Wake the consumer only if it had emptied the ring, read the tail
+	 * again since the consumer may have emptied it after the check above.
+	 */
+	if (atomic_get(&ring->tail) == head) {
+		k_poll_signal_raise(&ring->signal, 0);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get an item from the ring. Consumer side only.
+ *
+ * @return The oldest item, NULL if the ring is empty.
+ */
+static inline void *midi_ring_get(struct midi_ring *ring)
+{
+	atomic_val_t tail = atomic_get(&ring->tail);
+	void *item;
+
+	if (tail == atomic_get(&ring->head)) {
+		return NULL;
+	}
+
+	item = ring->slots[tail & ring->mask];
+	atomic_set(&ring->tail, tail + 1);
+
+	return item;
+}
+
+/**
+ * @brief Initialize a poll event that is ready when the ring may have items.
+ *
+ * Call midi_ring_poll_reset() and check the ring before each k_poll(),
+ * since the signal is only raised when the ring becomes non-empty.
+ */
+static inline void midi_ring_poll_event_init(struct k_poll_event *event,
+					     struct midi_ring *ring)
+{
+	k_poll_event_init(event, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+			  &ring->signal);
+}
+
+static inline void midi_ring_poll_reset(struct midi_ring *ring)
+{
+	k_poll_signal_reset(&ring->signal);
+}
+
+/**
+ * @brief Wait for an item. Consumer side only.
+ *
+ * @return The oldest item, NULL if none arrived before @p timeout.
+ */
+static inline void *midi_ring_get_wait(struct midi_ring *ring, k_timeout_t timeout)
+{
+	struct k_poll_event event;
+	void *item;
+
+	midi_ring_poll_reset(ring);
+	item = midi_ring_get(ring);
+	if (item) {
+		return item;
+	}
+
+	midi_ring_poll_event_init(&event, ring);
+	if (k_poll(&event, 1, timeout)) {
+		return NULL;
+	}
+
+	return midi_ring_get(ring);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZEPHYR_INCLUDE_MIDI_RING_H_ */
@@ -0,0 +1,66 @@
+
+
+/**
+ * @file
+ * @brief MIDI router
+ *
+ * Routes messages from input ports to output ports. Routes are set up
+ * from midi-router nodes in the devicetree at boot, and can be added and
+ * removed at runtime while messages are flowing.
+ */
+
+#ifndef ZEPHYR_INCLUDE_MIDI_ROUTER_H_
+#define ZEPHYR_INCLUDE_MIDI_ROUTER_H_
+
+#include <zephyr/device.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** All MIDI channels */
+#define MIDI_ROUTE_ALL_CHANNELS 0xFFFF
+
+struct midi_route_config {
+	/** Input port messages are received from */
+	const struct device *source;
+	/** Output ports every passed message is sent to */
+	const struct device *destinations[CONFIG_MIDI_ROUTER_MAX_DESTINATIONS];
+
+	uint8_t num_destinations;
+	/** Channels passed by the route, bit 0 is channel 1 */
+	uint16_t channel_mask;
+	/** Message types not passed by the route, see midi-router.yaml */
+	uint16_t type_filter;
+};
+
+/**
+ * @brief Add a route.
+ *
+ * The router takes over the callbacks of the source port and of the
+ * destination ports. Messages sent to several ports are clones sharing
+ * the data of the received message.
+ *
+ * @param config Route to add.
+ *
+ * @return Id of the route if successful, negative errno code otherwise.
+ * @retval -ENOMEM If the route table is full.
+ */
+int midi_router_add_route(const struct midi_route_config *config);
+
+/**
+ * @brief Remove a route.
+ *
+ * Messages already sent by the route are not affected.
+ *
+ * @param route Id returned by midi_router_add_route().
+ *
+ * @retval 0 If successful, negative errno code otherwise.
+ */
+int midi_router_remove_route(int route);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZEPHYR_INCLUDE_MIDI_ROUTER_H_ */
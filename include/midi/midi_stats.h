@@ -0,0 +1,156 @@
+/**
+ * @file
+ * @brief MIDI port counters
+ *
+ * Helpers for drivers to count messages, drops, queue depth and send
+ * latency of a port, read with midi_stats_get(). Without
+ * CONFIG_MIDI_STATS the helpers do nothing.
+ */
+
+#ifndef ZEPHYR_INCLUDE_MIDI_STATS_H_
+#define ZEPHYR_INCLUDE_MIDI_STATS_H_
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+#include "midi/midi.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum midi_stats_drop {
+	MIDI_STATS_DROP_ALLOC,
+	MIDI_STATS_DROP_QUEUE_FULL,
+	MIDI_STATS_DROP_LATE,
+	MIDI_STATS_DROP_PARSE,
+	MIDI_STATS_DROP_TOO_LONG,
+};
+
+/** @brief Counters of a port, kept by the driver. */
+struct midi_stats_data {
+	struct k_spinlock lock;
+
+	struct midi_stats stats;
+
+	/** Messages queued and not yet sent */
+	uint32_t queued;
+};
+
+/** @brief Count a received message. */
+static inline void midi_stats_rx(struct midi_stats_data *data, const midi_msg_t *msg)
+{
+#if defined(CONFIG_MIDI_STATS)
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	data->stats.rx_msgs++;
+	data->stats.rx_bytes += msg->len;
+	k_spin_unlock(&data->lock, key);
+#endif
+}
+
+/** @brief Count a message queued for sending. */
+static inline void midi_stats_enqueue(struct midi_stats_data *data, const midi_msg_t *msg)
+{
+#if defined(CONFIG_MIDI_STATS)
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	data->queued++;
+	data->stats.queue_high_water = MAX(data->stats.queue_high_water, data->queued);
+	k_spin_unlock(&data->lock, key);
+#endif
+}
+
+/** @brief Count a sent message, its latency is from msg->time_us until now. */
+static inline void midi_stats_tx(struct midi_stats_data *data, const midi_msg_t *msg)
+{
+#if defined(CONFIG_MIDI_STATS)
+	int64_t latency_us = MAX(midi_time_now_us() - msg->time_us, 0);
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	if (data->queued) {
+		data->queued--;
+	}
+	if (data->stats.tx_msgs == 0 || latency_us < data->stats.latency_min_us) {
+		data->stats.latency_min_us = (uint32_t)latency_us;
+	}
+	data->stats.latency_max_us = MAX(data->stats.latency_max_us, (uint32_t)latency_us);
+	data->stats.latency_sum_us += latency_us;
+	data->stats.tx_msgs++;
+	data->stats.tx_bytes += msg->len;
+	k_spin_unlock(&data->lock, key);
+#endif
+}
+
+/**
+ * @brief Count a dropped message.
+ *
+ * A message dropped from the send queue should be counted with
+ * midi_stats_dequeue() as well.
+ */
+static inline void midi_stats_drop(struct midi_stats_data *data, enum midi_stats_drop reason)
+{
+#if defined(CONFIG_MIDI_STATS)
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	switch (reason) {
+	case MIDI_STATS_DROP_ALLOC:
+		data->stats.drop_alloc++;
+		break;
+	case MIDI_STATS_DROP_QUEUE_FULL:
+		data->stats.drop_queue_full++;
+		break;
+	case MIDI_STATS_DROP_LATE:
+		data->stats.drop_late++;
+		break;
+	case MIDI_STATS_DROP_PARSE:
+		data->stats.drop_parse++;
+		break;
+	case MIDI_STATS_DROP_TOO_LONG:
+		data->stats.drop_too_long++;
+		break;
+	}
+	k_spin_unlock(&data->lock, key);
+#endif
+}
+
+/** @brief Count a message leaving the send queue without being sent. */
+static inline void midi_stats_dequeue(struct midi_stats_data *data)
+{
+#if defined(CONFIG_MIDI_STATS)
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	if (data->queued) {
+		data->queued--;
+	}
+	k_spin_unlock(&data->lock, key);
+#endif
+}
+
+/** @brief Copy the counters, for the midi_stats_get() of a driver. */
+static inline int midi_stats_read(struct midi_stats_data *data, struct midi_stats *stats,
+				  bool reset)
+{
+#if defined(CONFIG_MIDI_STATS)
+	k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+	*stats = data->stats;
+	if (reset) {
+		memset(&data->stats, 0, sizeof(data->stats));
+		/** Messages still queued are the new high water mark */
+		data->stats.queue_high_water = data->queued;
+	}
+	k_spin_unlock(&data->lock, key);
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZEPHYR_INCLUDE_MIDI_STATS_H_ */
@@ -1,16 +1,22 @@
 /**
- * @file midi_parser.h
+ * @file midi_sync.h
  *
- * @defgroup midi_parser MIDI parser
+ * @defgroup midi_sync MIDI sync
  * @{
- * @brief Basic parser for MIDI streams.
+ * @brief MIDI clock generator and follower.
+ *
+ * Sends MIDI clock, start, stop, continue and song position pointer to
+ * a set of output ports. The clock is either generated from a tempo on
+ * the MIDI timebase, or follows a clock received from another device.
+ * Each output port can be given a latency offset, its clock is sent that
+ * much earlier.
  */
 #ifndef MIDI_SYNC_H__
 #define MIDI_SYNC_H__
 
 
-// #include <stdbool.h>
-#include <zephyr.h>
+#include <stdbool.h>
+#include <zephyr/kernel.h>
 #include <zephyr/types.h>
 #include <midi/midi.h>
 
@@ -19,40 +25,130 @@
 extern "C" {
 #endif
 
-enum midi_sync_enable {
-	SYNC_ON,
-	SYNC_OFF
-};
+/** MIDI clocks per quarter note */
+#define MIDI_SYNC_PPQN 24
 
-enum midi_sync_running_status {
-	SYNC_ENFORCE_RUNNING_STATUS_ON,
-	SYNC_ENFORCE_RUNNING_STATUS_OFF,
+/** MIDI clocks per song position pointer step, a sixteenth note */
+#define MIDI_SYNC_CLOCKS_PER_SPP 6
+
+enum midi_sync_source {
+	/** Clock is generated from the configured tempo */
+	SYNC_INTERNAL,
+	/** Clock follows the messages given to midi_sync_input() */
+	SYNC_EXTERNAL,
 };
 
-enum midi_sync_resolution {
-	SYNC_MICROSECOND,
-	SYNC_MILLISECOND
+struct midi_sync_port {
+	const struct device *dev;
+	/** Clock is sent this many microseconds early on the port */
+	uint32_t offset_us;
 };
 
 struct midi_sync_cfg {
-	enum midi_sync_enable enable;
-	enum midi_sync_running_statu running_status;
-	enum midi_sync_resolution resolution;
-	uint8_t timestamp_width;
+	enum midi_sync_source source;
+	/** Tempo of the internal clock, in microseconds per quarter note */
+	uint32_t tempo_us;
+	struct midi_sync_port ports[CONFIG_MIDI_SYNC_MAX_PORTS];
+	uint8_t num_ports;
 };
 
-/** @brief Struct holding the state of the MIDI parser instance. */
+/** @brief Timing of the sent clocks, against when they were due. */
+struct midi_sync_stats {
+	uint32_t clocks;
+	int32_t jitter_min_us;
+	int32_t jitter_max_us;
+	/** Sum of the jitter, for the mean */
+	int64_t jitter_sum_us;
+	/** Sum of the squared jitter, for the standard deviation */
+	uint64_t jitter_sq_sum_us;
+};
+
+/** @brief Struct holding the state of the MIDI sync instance. */
 struct midi_sync {
 	struct k_thread thread;
-	midi_transfer_t in;
-	midi_transfer_t out;
+	K_KERNEL_STACK_MEMBER(stack, CONFIG_MIDI_SYNC_THREAD_STACK_SIZE);
+	struct k_sem sem;
+	struct k_spinlock lock;
 	struct midi_sync_cfg cfg;
+
+	bool running;
+	/** Incremented on every change of the clock, to restart waiting */
+	uint32_t gen;
+	/** Song position in clocks, used by continue */
+	uint32_t position;
+	/** Clock period in 1/65536 microseconds */
+	uint64_t period_q16;
+	/** Time of clock base_clock in 1/65536 microseconds */
+	int64_t base_time_q16;
+	uint32_t base_clock;
+	/** Next clock to send on each port, counted from song position 0 */
+	uint32_t port_clock[CONFIG_MIDI_SYNC_MAX_PORTS];
+	/** Bitmask of ports yet to be sent start_status before their next clock */
+	uint32_t port_start;
+	uint8_t start_status;
+
+	/** Tempo estimator following the external clock */
+	struct {
+		/** Estimated time of the last received clock */
+		int64_t time_q16;
+		int64_t last_us;
+		uint32_t clocks;
+		/** Next received clock since start or continue */
+		uint32_t in_clock;
+		/** A clock has been received since start or continue */
+		bool synced;
+	} pll;
+
+	struct midi_sync_stats stats;
 };
 
 /**
  * @brief Init midi synchronizer instance
+ *
+ * Starts the thread sending the clock. The clock is stopped until
+ * midi_sync_start() is called, or start is received from the external
+ * clock.
+ */
+int midi_sync_init(struct midi_sync *sync, const struct midi_sync_cfg *cfg);
+
+/** @brief Start the clock from the beginning of the song. */
+void midi_sync_start(struct midi_sync *sync);
+
+/** @brief Continue the clock from the song position. */
+void midi_sync_continue(struct midi_sync *sync);
+
+/** @brief Stop the clock. */
+void midi_sync_stop(struct midi_sync *sync);
+
+/**
+ * @brief Set the song position while stopped. Sent to the ports.
+ *
+ * @param spp Song position in sixteenth notes.
  */
-int midi_sync_init(struct midi_sync *sync, struct midi_sync_cfg cfg);
+int midi_sync_set_position(struct midi_sync *sync, uint16_t spp);
+
+/** @brief Set the tempo of the internal clock, in microseconds per quarter note. */
+int midi_sync_set_tempo(struct midi_sync *sync, uint32_t tempo_us);
+
+/**
+ * @brief Get the current tempo, estimated from the external clock when
+ *	  following one.
+ *
+ * @return Tempo in microseconds per quarter note.
+ */
+uint32_t midi_sync_get_tempo(struct midi_sync *sync);
+
+/**
+ * @brief Pass a received message to the synchronizer.
+ *
+ * Call this from the receive callback of the port the external clock
+ * is received on. Messages other than System Real-Time and song position
+ * pointer are ignored. The message is not consumed.
+ */
+void midi_sync_input(struct midi_sync *sync, const midi_msg_t *msg);
+
+/** @brief Get and reset the jitter statistics of the sent clocks. */
+void midi_sync_stats_get(struct midi_sync *sync, struct midi_sync_stats *stats);
 
 
 /** @} */
@@ -0,0 +1,133 @@
+
+
+/**
+ * @file
+ * @brief MIDI timebase
+ *
+ * Monotonic 64-bit microsecond time shared by all MIDI transports, and
+ * conversions between it and the timestamps used on the wire. The time
+ * starts at kernel uptime, use midi_time_abs_timeout() for kernel timeouts
+ * at a MIDI time.
+ */
+
+#ifndef ZEPHYR_INCLUDE_MIDI_TIME_H_
+#define ZEPHYR_INCLUDE_MIDI_TIME_H_
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** 13-bit millisecond timestamps, used by BLE MIDI and serial ports */
+#define MIDI_TIME_13BIT_MASK 8191
+
+/**
+ * @brief Get the current MIDI time.
+ *
+ * Backed by a counter device with CONFIG_MIDI_TIME_COUNTER, for a
+ * resolution finer than the kernel tick.
+ *
+ * @return Microseconds since boot.
+ */
+#if defined(CONFIG_MIDI_TIME_COUNTER)
+int64_t midi_time_now_us(void);
+#else
+static inline int64_t midi_time_now_us(void)
+{
+	return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+#endif
+
+/**
+ * @brief Kernel timeout expiring at a MIDI time.
+ *
+ * With CONFIG_MIDI_TIME_COUNTER the counter drifts from the kernel clock,
+ * so the timeout is relative to the current MIDI time, rounded up to a
+ * kernel tick.
+ */
+static inline k_timeout_t midi_time_abs_timeout(int64_t time_us)
+{
+#if defined(CONFIG_MIDI_TIME_COUNTER)
+	int64_t now_us = midi_time_now_us();
+
+	return (time_us > now_us) ? K_USEC(time_us - now_us) : K_NO_WAIT;
+#else
+	return K_TIMEOUT_ABS_US(time_us);
+#endif
+}
+
+/** @brief Convert a MIDI time to a 13-bit millisecond timestamp. */
+static inline uint16_t midi_time_to_13bit_ms(int64_t time_us)
+{
+	return (uint16_t)((time_us / USEC_PER_MSEC) & MIDI_TIME_13BIT_MASK);
+}
+
+/**
+ * @brief Convert a 13-bit millisecond timestamp to a MIDI time.
+ *
+ * The timestamp wraps every 8192 ms. It is taken as the time closest to
+ * @p ref_us, at most 4096 ms before or after it.
+ */
+static inline int64_t midi_time_from_13bit_ms(uint16_t timestamp, int64_t ref_us)
+{
+	int64_t ref_ms = ref_us / USEC_PER_MSEC;
+	int32_t delta = (timestamp - ref_ms) & MIDI_TIME_13BIT_MASK;
+
+	if (delta > (MIDI_TIME_13BIT_MASK / 2)) {
+		delta -= MIDI_TIME_13BIT_MASK + 1;
+	}
+
+	return (ref_ms + delta) * USEC_PER_MSEC;
+}
+
+/**
+ * @brief Convert a MIDI time to a delta microsecond timestamp, as used by
+ *	  MIDI_FORMAT_1_0_PARSED_DELTA_US.
+ *
+ * @param time_us Time of the message.
+ * @param prev_us Time of the previous message.
+ */
+static inline uint16_t midi_time_to_delta_us(int64_t time_us, int64_t prev_us)
+{
+	return (uint16_t)CLAMP(time_us - prev_us, 0, UINT16_MAX);
+}
+
+/** @brief Convert a delta microsecond timestamp to a MIDI time. */
+static inline int64_t midi_time_from_delta_us(uint16_t delta, int64_t prev_us)
+{
+	return prev_us + delta;
+}
+
+/**
+ * @brief Convert a MIDI time to a 7-bit fraction of an interval, as used
+ *	  by the ISO payload.
+ *
+ * @param time_us     Time of the message.
+ * @param ref_us      Start of the interval.
+ * @param interval_us Length of the interval.
+ */
+static inline uint8_t midi_time_to_interval_fraction(int64_t time_us, int64_t ref_us,
+						     uint32_t interval_us)
+{
+	if (time_us <= ref_us) {
+		return 0;
+	}
+
+	return (uint8_t)MIN(((time_us - ref_us) * 127) / interval_us, 127);
+}
+
+/** @brief Convert a 7-bit fraction of an interval to a MIDI time. */
+static inline int64_t midi_time_from_interval_fraction(uint8_t fraction, int64_t ref_us,
+						       uint32_t interval_us)
+{
+	return ref_us + (((int64_t)(fraction & 127) * interval_us) / 127);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZEPHYR_INCLUDE_MIDI_TIME_H_ */
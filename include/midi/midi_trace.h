@@ -0,0 +1,73 @@
+
+
+/**
+ * @file
+ * @brief MIDI trace
+ *
+ * Tracepoints on the path of a message through the MIDI library. Events
+ * are recorded with a cycle timestamp into a binary ring buffer in RAM,
+ * without formatting or logging, and decoded on the host with
+ * scripts/midi_trace_decode.py. Without CONFIG_MIDI_TRACE the tracepoints
+ * are compiled out.
+ */
+
+#ifndef ZEPHYR_INCLUDE_MIDI_TRACE_H_
+#define ZEPHYR_INCLUDE_MIDI_TRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zephyr/toolchain.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum midi_trace_event {
+	/** Message is allocated */
+	MIDI_TRACE_ALLOC,
+	/** Message is queued on an output port */
+	MIDI_TRACE_ENQUEUE,
+	/** Message is handed to the transport */
+	MIDI_TRACE_SEND,
+	/** Message is completed on an output port */
+	MIDI_TRACE_COMPLETE,
+	/** Message is freed */
+	MIDI_TRACE_FREE,
+	/** Message is passed to the callback of an input port */
+	MIDI_TRACE_RECEIVE,
+};
+
+/** @brief Trace record, 12 bytes, little endian on the supported targets. */
+struct midi_trace_record {
+	/** Cycle counter when the event happened */
+	uint32_t cycles;
+	/** Message the event is about, its address */
+	uint32_t id;
+	uint8_t event;
+	uint8_t reserved;
+	/** Event argument, the message length */
+	uint16_t arg;
+} __packed;
+
+#if defined(CONFIG_MIDI_TRACE)
+void midi_trace_record(enum midi_trace_event event, const void *msg, uint16_t arg);
+
+/**
+ * @brief Print the trace buffer to the console for the host decoder.
+ *
+ * Recording is paused while the buffer is printed, after the tracepoints
+ * in progress have finished their record. The buffer is empty afterwards.
+ * Must be called from a thread.
+ */
+void midi_trace_dump(void);
+
+#define MIDI_TRACE(event, msg, arg) midi_trace_record(MIDI_TRACE_##event, (msg), (arg))
+#else
+#define MIDI_TRACE(event, msg, arg) do { ARG_UNUSED(msg); } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ZEPHYR_INCLUDE_MIDI_TRACE_H_ */
@@ -170,12 +170,23 @@ midi_msg_t * midi_ump_to_1_0(midi_msg_t *ump_msg)
 	return msg;
 }
 
+static void send_ack(uint8_t msg_num, uint8_t ack_channel)
+{
+	uint8_t spi_ack_msg[4];
+
+	spi_ack_msg[0] = 0xFF;
+	spi_ack_msg[1] = function_block.muid & 0xFF;
+	spi_ack_msg[2] = msg_num;
+	spi_ack_msg[3] = ack_channel;
+	LOG_DBG("Sending ack message. muid %x, num: %x, channel: %x", spi_ack_msg[1], spi_ack_msg[2], spi_ack_msg[3]);
+	spi_send(spi_dev, spi_ack_msg, 4);
+}
+
 static int midi_iso_received(const struct device *dev,
 			  midi_msg_t *msg,
 			  void *user_data)
 {
 	int err;
-	uint8_t spi_ack_msg[4];
 	midi_msg_t *midi_1_0_msg;
 
 	LOG_DBG("MIDI iso received!");
@@ -198,26 +209,14 @@ static int midi_iso_received(const struct device *dev,
 
 		if (msg->format == MIDI_FORMAT_2_0_UMP)
 		{
-			if (msg->timestamp != 0xFF)
-			{
-				midi_msg_ref(msg);
-				k_fifo_put(&fifo_event_execution, msg);
-				midi_1_0_msg = midi_ump_to_1_0(msg);
-				midi_send(serial_midi_out_dev, midi_1_0_msg);
-
-				
-			} else {
-				LOG_INF("Received duplicate message. Discarding.");
-			}
-			
+			midi_msg_ref(msg);
+			k_fifo_put(&fifo_event_execution, msg);
+			midi_1_0_msg = midi_ump_to_1_0(msg);
+			midi_send(serial_midi_out_dev, midi_1_0_msg);
+
 			if(msg->ack_channel != 0xFF)
 			{
-				spi_ack_msg[0] = 0xFF;
-				spi_ack_msg[1] = function_block.muid & 0xFF;
-				spi_ack_msg[2] = msg->num;
-				spi_ack_msg[3] = msg->ack_channel;
-				LOG_DBG("Sending ack message. muid %x, num: %x, channel: %x", spi_ack_msg[1], spi_ack_msg[2], spi_ack_msg[3]);
-				spi_send(spi_dev, spi_ack_msg, 4);
+				send_ack(msg->num, msg->ack_channel);
 			}
 		}
 	}
@@ -277,6 +276,7 @@ void main(void)
 
 	midi_ump_add_function_block(&ump_endpoint, &function_block);
 	midi_iso_set_function_block(&function_block);
+	midi_iso_register_ack_cb(send_ack);
 
 	/*SERIAL PORTS*/
 	serial_midi_in_dev = get_port("SERIAL_MIDI_IN", 
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2020 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Decode a MIDI trace capture into per-stage latency histograms.
+
+The capture is either a console log containing the output of
+midi_trace_dump(), or the raw midi_trace_buf memory read with a debugger.
+A raw buffer carries no header, so the cycle frequency must be given with
+--freq. Records of a raw buffer are in buffer order, not time order, when
+the buffer has wrapped.
+
+Usage:
+    midi_trace_decode.py console.log
+    midi_trace_decode.py --raw --freq 64000000 midi_trace_buf.bin
+"""
+
+import argparse
+import collections
+import struct
+import sys
+
+RECORD = struct.Struct("<IIBxH")
+
+EVENTS = ["alloc", "enqueue", "send", "complete", "free", "receive"]
+
+# Stages reported, from event to the next event of the same message
+STAGES = [
+    ("alloc", "enqueue"),
+    ("enqueue", "send"),
+    ("send", "complete"),
+    ("complete", "free"),
+    ("alloc", "receive"),
+    ("receive", "free"),
+    ("alloc", "free"),
+]
+
+
+def read_console(path):
+    freq = None
+    records = []
+    with open(path, errors="replace") as f:
+        for line in f:
+            pos = line.find("MIDI_TRACE ")
+            if pos < 0:
+                continue
+            fields = line[pos:].split()
+            if fields[1] == "HDR":
+                freq = int(fields[2])
+                records = []
+            elif fields[1] != "END":
+                records.append(RECORD.unpack(bytes.fromhex(fields[1])))
+    return freq, records
+
+
+def read_raw(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    usable = len(data) - len(data) % RECORD.size
+    return [r for r in RECORD.iter_unpack(data[:usable]) if r != (0, 0, 0, 0)]
+
+
+def stage_latencies(records, freq):
+    """Pair the events of every message and return latencies in us."""
+    latencies = collections.defaultdict(list)
+    # Events of the message currently at an address, addresses are reused
+    pending = {}
+    prev_cycles = None
+    wraps = 0
+
+    for cycles, msg_id, event, _ in records:
+        # Extend the 32-bit cycle counter, records are in time order
+        if prev_cycles is not None and cycles < prev_cycles:
+            wraps += 1
+        prev_cycles = cycles
+        time = ((wraps << 32) + cycles) * 1e6 / freq
+
+        if event >= len(EVENTS):
+            continue
+        name = EVENTS[event]
+        if name == "alloc":
+            pending[msg_id] = {}
+        events = pending.setdefault(msg_id, {})
+        events.setdefault(name, time)
+
+        if name == "free":
+            for start, end in STAGES:
+                if start in events and end in events:
+                    latencies[(start, end)].append(events[end] - events[start])
+            del pending[msg_id]
+
+    return latencies
+
+
+def histogram(values):
+    """Power of two buckets in microseconds."""
+    buckets = collections.Counter()
+    for value in values:
+        bucket = 1
+        while value >= bucket:
+            bucket <<= 1
+        buckets[bucket] += 1
+    return sorted(buckets.items())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", help="console log or raw trace buffer")
+    parser.add_argument("--raw", action="store_true",
+                        help="capture is the raw midi_trace_buf memory")
+    parser.add_argument("--freq", type=int,
+                        help="cycle counter frequency in Hz, required with --raw")
+    args = parser.parse_args()
+
+    if args.raw:
+        if not args.freq:
+            parser.error("--freq is required with --raw")
+        freq, records = args.freq, read_raw(args.capture)
+    else:
+        freq, records = read_console(args.capture)
+        freq = args.freq or freq
+        if not freq:
+            sys.exit("no MIDI_TRACE HDR line found in capture")
+
+    print(f"{len(records)} records, {freq} Hz")
+
+    latencies = stage_latencies(records, freq)
+    for start, end in STAGES:
+        values = latencies.get((start, end))
+        if not values:
+            continue
+        values.sort()
+        print(f"\n{start} -> {end}: {len(values)} messages, "
+              f"min {values[0]:.1f} us, "
+              f"avg {sum(values) / len(values):.1f} us, "
+              f"p99 {values[int(len(values) * 0.99)]:.1f} us, "
+              f"max {values[-1]:.1f} us")
+        peak = max(count for _, count in histogram(values))
+        for bucket, count in histogram(values):
+            bar = "#" * max(1, count * 40 // peak)
+            print(f"  < {bucket:>8} us {count:>7} {bar}")
+
+
+if __name__ == "__main__":
+    main()
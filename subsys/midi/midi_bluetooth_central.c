@@ -33,6 +33,7 @@
 #include "midi/midi.h"
 #include "midi/midi_types.h"
 #include "midi/midi_bluetooth.h"
+#include "midi/midi_stats.h"
 
 #include <mpsl_radio_notification.h>
 
@@ -50,6 +51,8 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 #define INTERVAL_LLPM_US 1000
 
 static K_FIFO_DEFINE(fifo_tx_data);
+/** System Real-Time messages, encoded ahead of fifo_tx_data */
+static K_FIFO_DEFINE(fifo_rt_tx_data);
 
 static K_THREAD_STACK_DEFINE(ble_tx_work_q_stack_area, 512);
 
@@ -94,6 +97,8 @@ struct midi_bluetooth_in_dev_data {
 
 	const struct device *dev;
 
+	struct midi_stats_data stats;
+
 	void *user_data;
 
 };
@@ -104,6 +109,8 @@ struct midi_bluetooth_out_dev_data {
 
 	const struct device *dev;
 
+	struct midi_stats_data stats;
+
 	void *user_data;
 };
 
@@ -178,7 +185,14 @@ static int  send_to_bluetooth_port(const struct device *dev,
 	
 	if (current_conn) {
 
-		k_fifo_put(&fifo_tx_data, msg);
+		msg->time_us = midi_time_now_us();
+		MIDI_TRACE(ENQUEUE, msg, msg->len);
+		midi_stats_enqueue(&out->stats, msg);
+		if (midi_msg_is_realtime(msg)) {
+			k_fifo_put(&fifo_rt_tx_data, msg);
+		} else {
+			k_fifo_put(&fifo_tx_data, msg);
+		}
 		err = k_work_submit_to_queue(&ble_tx_work_q, &ble_midi_encode_work);
 	} else {
 		if(out->api->midi_transfer_done) {
@@ -192,6 +206,22 @@ static int  send_to_bluetooth_port(const struct device *dev,
 	return err;
 }
 
+static int midi_bluetooth_in_stats_get(const struct device *dev,
+				       struct midi_stats *stats, bool reset)
+{
+	struct midi_bluetooth_dev_data *bluetooth_dev_data = dev->data;
+
+	return midi_stats_read(&bluetooth_dev_data->in->stats, stats, reset);
+}
+
+static int midi_bluetooth_out_stats_get(const struct device *dev,
+					struct midi_stats *stats, bool reset)
+{
+	struct midi_bluetooth_dev_data *bluetooth_dev_data = dev->data;
+
+	return midi_stats_read(&bluetooth_dev_data->out->stats, stats, reset);
+}
+
 static void ble_tx_work_handler(struct k_work *item)
 {
 	if (ble_midi_pck_len != 0) {
@@ -208,7 +238,10 @@ static void ble_midi_encode_work_handler(struct k_work *item)
 	struct midi_bluetooth_out_dev_data *out;
 	out = midi_bluetooth_device_data->out;
 
-	msg = k_fifo_get(&fifo_tx_data, K_NO_WAIT);
+	msg = k_fifo_get(&fifo_rt_tx_data, K_NO_WAIT);
+	if (!msg) {
+		msg = k_fifo_get(&fifo_tx_data, K_NO_WAIT);
+	}
 	/** Process received MIDI message and prepare BLE packet */
 	if (msg) {
 		if ((msg->len + 1) > (mtu_size - 3) - ble_midi_pck_len) {
@@ -249,6 +282,8 @@ static void ble_midi_encode_work_handler(struct k_work *item)
 		/** Add MIDI message to packet and free memory */
 		memcpy((ble_midi_pck + ble_midi_pck_len), msg->data, msg->len);
 		ble_midi_pck_len += msg->len;
+		MIDI_TRACE(SEND, msg, msg->len);
+		midi_stats_tx(&out->stats, msg);
 		if(out->api->midi_transfer_done) {
 			out->api->midi_transfer_done(out->dev, msg, out->user_data);
 		} else {
@@ -505,7 +540,7 @@ uint8_t bt_receive_cb(struct bt_conn *conn, const uint8_t *const data,
 
 	if (radio_notif_flag) {
 		radio_notif_flag = false;
-		conn_time = TIMESTAMP(k_ticks_to_ms_near64(k_uptime_ticks()));
+		conn_time = midi_time_to_13bit_ms(midi_time_now_us());
 	};
 
 	char addr[BT_ADDR_LE_STR_LEN] = { 0 };
@@ -540,18 +575,27 @@ uint8_t bt_receive_cb(struct bt_conn *conn, const uint8_t *const data,
 			if (!rx_msg) {
 				/** Previous message was not complete */
 				LOG_ERR("Incomplete message: pos %d.", pos);
+				midi_stats_drop(&in->stats, MIDI_STATS_DROP_PARSE);
 			}
 		} else {
 			/** Statusbytes and databytes */
 			next_is_new_timestamp = true;
 			
 			rx_msg = midi_msg_alloc(NULL, 1);
-			memcpy(rx_msg->data, &current_byte, 1);
-			rx_msg->format = MIDI_FORMAT_1_0_SERIAL;
-			rx_msg->len = 1;
-			rx_msg->timestamp = timestamp;
-			
-			if (rx_msg) {
+			if (!rx_msg || !rx_msg->data) {
+				LOG_WRN("could not allocate midi buffer!");
+				midi_stats_drop(&in->stats, MIDI_STATS_DROP_ALLOC);
+				midi_msg_unref(rx_msg);
+				rx_msg = NULL;
+			} else {
+				memcpy(rx_msg->data, &current_byte, 1);
+				rx_msg->format = MIDI_FORMAT_1_0_SERIAL;
+				rx_msg->len = 1;
+				rx_msg->timestamp = timestamp;
+				rx_msg->time_us = midi_time_from_13bit_ms(timestamp, midi_time_now_us());
+
+				MIDI_TRACE(RECEIVE, rx_msg, rx_msg->len);
+				midi_stats_rx(&in->stats, rx_msg);
 				if(in->api->midi_transfer_done) {
 					in->api->midi_transfer_done(in->dev, rx_msg, in->user_data);
 				} else {
@@ -741,6 +785,7 @@ static int midi_bluetooth_out_device_init(const struct device *dev)
 #define DEFINE_MIDI_BLUETOOTH_IN_DEVICE(dev)					  			\
 	static struct midi_api midi_bluetooth_in_api_##dev = {			\
 		.midi_callback_set = midi_bluetooth_in_port_callback_set,	\
+		.midi_stats_get = midi_bluetooth_in_stats_get,				\
 	};															\
 	DEVICE_DT_DEFINE(MIDI_BLUETOOTH_IN_DEV_N_ID(dev),			  			\
 			    &midi_bluetooth_in_device_init,			  			\
@@ -754,6 +799,7 @@ static int midi_bluetooth_out_device_init(const struct device *dev)
 	static struct midi_api midi_bluetooth_out_api_##dev = {			\
 		.midi_transfer = send_to_bluetooth_port,					\
 		.midi_callback_set = midi_bluetooth_out_port_callback_set,	\
+		.midi_stats_get = midi_bluetooth_out_stats_get,				\
 	};															\
 	DEVICE_DT_DEFINE(MIDI_BLUETOOTH_OUT_DEV_N_ID(dev),			  			\
 			    &midi_bluetooth_out_device_init,			  			\
@@ -14,6 +14,10 @@
 
 #include "midi/midi.h"
 #include "midi/midi_iso.h"
+#include "midi/midi_iso_window.h"
+#include "midi/midi_iso_snapshot.h"
+#include "midi/midi_iso_payload.h"
+#include "midi/midi_stats.h"
 
 #include <zephyr/sys/util.h>
 #include <zephyr/device.h>
@@ -26,61 +30,120 @@
 #define LOG_MODULE_NAME midi_iso_broadcaster
 LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
-#define BUF_ALLOC_TIMEOUT (5) /* milliseconds */
 #define BIG_SDU_INTERVAL_US (5000)
 
+#define BROADCASTER_NODE DT_INST(0, COMPAT_MIDI_ISO_BROADCASTER_DEVICE)
+
+/** Number of BISes in the BIG, messages are striped across them */
+#define NUM_BIS DT_PROP(BROADCASTER_NODE, num_bis)
+
+/** Stripe messages by destination MUID instead of UMP group */
+#define STRIPE_BY_MUID (DT_ENUM_IDX(BROADCASTER_NODE, stripe) == 1)
+
+/** Bytes of a payload of the first BIS, written into the controller PDU */
+#define BIS0_PAYLOAD_SIZE (CONFIG_BT_CTLR_ADV_ISO_PDU_LEN_MAX - 3)
+
+/** Payloads back whose chunks are copied into each payload */
+#define FEC_DEPTH DT_PROP(BROADCASTER_NODE, fec_depth)
+
+/** Bytes of copies in a payload */
+#define FEC_MAX_BYTES DT_PROP(BROADCASTER_NODE, fec_max_bytes)
+
+/** Bytes a message takes at most besides its data, in a new payload */
+#define MSG_OVERHEAD_MAX (1 + PAYLOAD_CHUNK_HEADER_SIZE + 3)
+
+BUILD_ASSERT(NUM_BIS <= CONFIG_BT_ISO_MAX_CHAN, "num-bis above CONFIG_BT_ISO_MAX_CHAN");
+BUILD_ASSERT(FEC_DEPTH < MIDI_ISO_PAYLOAD_FEC_SLOTS,
+	     "fec-depth above MIDI_ISO_PAYLOAD_FEC_SLOTS - 1");
+
 static nrfx_timer_t timer = NRFX_TIMER_INSTANCE(3);
 
 static K_FIFO_DEFINE(fifo_tx_data);
-NET_BUF_POOL_FIXED_DEFINE(bis_tx_pool, 2,
+/** System Real-Time messages, added to the payload ahead of fifo_tx_data */
+static K_FIFO_DEFINE(fifo_rt_tx_data);
+NET_BUF_POOL_FIXED_DEFINE(bis_tx_pool, 2 * NUM_BIS,
 			  BT_ISO_SDU_BUF_SIZE(CONFIG_BT_ISO_TX_MTU),
 			  CONFIG_BT_CONN_TX_USER_DATA_SIZE, NULL);
 
-static K_THREAD_STACK_DEFINE(iso_work_q_stack_area, 1024);
-
 static void packet_thread_fn(void *p1, void *p2, void *p3);
 
-K_THREAD_DEFINE(packet_thread, 512,                                
+K_THREAD_DEFINE(packet_thread, CONFIG_MIDI_ISO_BROADCASTER_THREAD_STACK_SIZE,
 		packet_thread_fn, NULL, NULL, NULL,
 		K_PRIO_PREEMPT(1), 0, 0);
 
 
 static K_SEM_DEFINE(sem_big_cmplt, 0, 1);
-static K_SEM_DEFINE(sem_overflow_ctrl, 0, 1);
 
-static struct k_work_delayable iso_resend_work;
-static struct k_work_q iso_work_q;
+/** Raised each ISO interval to add copies and resend messages not acked */
+static struct k_poll_signal resend_signal = K_POLL_SIGNAL_INITIALIZER(resend_signal);
+
+/** Messages taken from the window per pass of the packet thread */
+#define RESEND_BATCH 8
+
+static struct midi_iso_window tx_window;
+
+#if defined(CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT)
+/** Channel state of the messages sent, for receivers joining late */
+static struct midi_iso_snapshot snapshot;
+#endif
 
 struct midi_iso_broadcaster_dev_data *iso_dev_data;
 
 midi_ump_function_block_t *midi_ump_func_block;
 
 static uint16_t seq_num;
-static uint8_t msg_num = 0;
 
-uint8_t ack_channels[5] = {0, 0, 0, 0, 0};
+/** Receivers given an ACK channel in the payload being built, and the count */
+static atomic_t ack_assigned;
+static atomic_t ack_next;
 
-struct payload_construction {
-	uint8_t *ptr;
-	uint8_t *start_ptr;
-	uint8_t *next_ptr;
-	uint8_t *len_field;
-	uint64_t ref_time;
-	enum midi_format previous_format;
-	uint8_t len;
+BUILD_ASSERT(MAX(BIS0_PAYLOAD_SIZE, CONFIG_BT_ISO_TX_MTU) <= 0x3FF,
+	     "payload too long for the builder state");
+
+/**
+ * @brief A BIS of the BIG and the payload built for it.
+ *
+ * The payload of the first BIS is written in place into the controller
+ * PDUs. Payloads of the other BISes are built in one of two buffers while
+ * the other is sent as an SDU.
+ */
+struct midi_iso_bis {
+	struct midi_iso_payload_builder builder;
+	/** Given when a new payload is started */
+	struct k_sem overflow_sem;
+	/** Buffer of the next payload, set by next_pdu_handler() for BIS 0 */
+	uint8_t *next_base;
+	uint8_t sdu[2][CONFIG_BT_ISO_TX_MTU];
+	/** Finished payload, sent by the timer */
+	uint8_t *ready;
+	uint16_t ready_len;
+#if defined(CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT)
+	/** Walk of the snapshot being sent and its next piece */
+	struct midi_iso_snapshot_cursor snapshot_cursor;
+	uint8_t snapshot_piece;
+	bool snapshot_sending;
+	/** Time the last snapshot was started */
+	int64_t snapshot_start;
+#endif
+#if FEC_DEPTH > 0
+	/** Chunks of the last payloads, by swap count */
+	struct midi_iso_payload_fec fec[MIDI_ISO_PAYLOAD_FEC_SLOTS];
+#endif
 };
 
-struct payload_construction payload_constructor;
+static struct midi_iso_bis bises[NUM_BIS];
+
+#if DT_NODE_HAS_PROP(BROADCASTER_NODE, bis_map)
+static const uint8_t bis_map[] = DT_PROP(BROADCASTER_NODE, bis_map);
+#endif
 
 struct midi_iso_broadcaster_dev_data {
 	struct midi_api *api;
 	const struct device *dev;
+	struct midi_stats_data stats;
 	void *user_data;
 };
 
-uint8_t * iso_tx_msg_list_resend(uint8_t *payload_ptr);
-void add_msg_to_payload(midi_msg_t *msg);
-
 void midi_iso_set_function_block(midi_ump_function_block_t *function_block)
 {
 	midi_ump_func_block = function_block;
@@ -115,16 +178,12 @@ static struct bt_iso_chan_qos bis_iso_qos = {
 	.tx = &iso_tx_qos,
 };
 
-static struct bt_iso_chan bis_iso_chan[] = {
-	{ .ops = &iso_ops, .qos = &bis_iso_qos, }
-};
+static struct bt_iso_chan bis_iso_chan[NUM_BIS];
 
-static struct bt_iso_chan *bis[] = {
-	&bis_iso_chan[0]
-};
+static struct bt_iso_chan *bis[NUM_BIS];
 
 static struct bt_iso_big_create_param big_create_param = {
-	.num_bis = 1,
+	.num_bis = NUM_BIS,
 	.bis_channels = bis,
 	.interval = BIG_SDU_INTERVAL_US, /* in microseconds */
 	.latency = 5, /* in milliseconds */
@@ -147,230 +206,309 @@ int midi_iso_broadcaster_port_callback_set(const struct device *dev,
 	return -ENOTSUP;
 }
 
-static inline uint8_t calculate_timestamp(int64_t uptime, int64_t reftime)
-{
-	int64_t delta;
-	uint8_t timestamp;
-
-	if(uptime <= reftime) {
-		timestamp = 0;
-	} else {
-		delta = uptime - reftime;
-		timestamp = (uint8_t)((delta*127)/BIG_SDU_INTERVAL_US);
-	}
-	
-	return timestamp;
-}
-
 static int  send_to_iso_broadcaster_port(const struct device *dev,
 							midi_msg_t *msg,
 							void *user_data)
 {
-	msg->uptime = k_ticks_to_us_floor64(k_uptime_ticks());
-	msg->num = 0xFF;
-	
-    k_fifo_put(&fifo_tx_data, msg);
+	/** UMP messages are sent to, and acked by, the MUID in their context */
+	if ((msg->format == MIDI_FORMAT_2_0_UMP) && !msg->context) {
+		LOG_WRN("Tried to send UMP without a MUID on iso port");
+		return -EINVAL;
+	}
+
+	msg->time_us = midi_time_now_us();
+	msg->num = PAYLOAD_MSG_NUM_NONE;
+	MIDI_TRACE(ENQUEUE, msg, msg->len);
+	midi_stats_enqueue(&iso_dev_data->stats, msg);
+
+	if (midi_msg_is_realtime(msg)) {
+		k_fifo_put(&fifo_rt_tx_data, msg);
+	} else {
+		k_fifo_put(&fifo_tx_data, msg);
+	}
 
 	return 0;
 }
 
-static void iso_resend_work_handler(struct k_work *item)
+static int midi_iso_broadcaster_stats_get(const struct device *dev,
+					   struct midi_stats *stats, bool reset)
 {
-	iso_tx_msg_list_resend(NULL);
+	struct midi_iso_broadcaster_dev_data *iso_dev_data = dev->data;
+
+	return midi_stats_read(&iso_dev_data->stats, stats, reset);
 }
 
-static int assign_ack_channel(uint8_t *ack_channels, uint8_t num_channels, void *muid)
+/**
+ * @brief Give a receiver an ACK channel, the first time it is sent a
+ * message in the payload being built.
+ */
+static uint8_t assign_ack_channel(uint8_t muid)
 {
-	for (int i = 0; i < num_channels; i++)
-	{
-		if (ack_channels[i] == 0 ) {
-			ack_channels[i] = *(uint8_t *)muid;
-			return i;
-		}
+	int receiver = midi_iso_window_receiver(&tx_window, muid);
+	atomic_val_t channel;
 
-		if (ack_channels[i] == *(uint8_t *)muid){
-			return 0xFF;
-		}
+	if ((receiver < 0) || atomic_test_and_set_bit(&ack_assigned, receiver)) {
+		return 0xFF;
 	}
 
-	return 0xFF;
+	channel = atomic_inc(&ack_next);
+
+	return (channel < CONFIG_MIDI_ISO_BROADCASTER_ACK_CHANNELS) ? channel : 0xFF;
 }
 
-static void iso_tx_msg_add(midi_msg_t *msg)
+/** @brief Hand a message that is sent or dropped back to the application. */
+static void iso_tx_done(midi_msg_t *msg)
 {
-	midi_ump_tx_msg_t *tx_msg = k_malloc(sizeof(midi_ump_tx_msg_t));
-
-	if (tx_msg) {
-		msg->num = msg_num;
-		tx_msg->msg = msg;
-		sys_slist_append(&midi_ump_func_block->tx_msg_list, &tx_msg->node);
+	MIDI_TRACE(COMPLETE, msg, msg->len);
+	if (iso_dev_data->api->midi_transfer_done) {
+		iso_dev_data->api->midi_transfer_done(iso_dev_data->dev, msg, iso_dev_data->user_data);
+	} else {
+		midi_msg_unref(msg);
 	}
 }
 
-void iso_tx_msg_list_print(void)
+/** @brief A message left the window, dropped if a receiver never acked it. */
+static void window_done(midi_msg_t *msg, bool acked)
 {
-	midi_ump_tx_msg_t *tx_msg;
-	sys_slist_t *msg_list = &midi_ump_func_block->tx_msg_list;
-    SYS_SLIST_FOR_EACH_CONTAINER(msg_list, tx_msg, node) {
-		LOG_INF("num: %x", tx_msg->msg->num);
-    }
-    return;
+	if (!acked) {
+		midi_stats_drop(&iso_dev_data->stats, MIDI_STATS_DROP_QUEUE_FULL);
+	}
+
+	iso_tx_done(msg);
 }
 
-bool iso_tx_msg_remove(uint8_t muid, uint8_t num)
+void midi_iso_ack_msg(uint8_t muid, uint8_t msg_num)
 {
-	midi_ump_tx_msg_t *tx_msg;
-	sys_snode_t *prev_node = NULL;
-	sys_slist_t *msg_list = &midi_ump_func_block->tx_msg_list;
-    SYS_SLIST_FOR_EACH_CONTAINER(msg_list, tx_msg, node) {
-        if (tx_msg->msg->num == num) {
-			if (*(uint8_t *)tx_msg->msg->context == muid)
-			{
-				sys_slist_remove(msg_list, prev_node, &tx_msg->node);
-				if(iso_dev_data->api->midi_transfer_done) {
-					iso_dev_data->api->midi_transfer_done(iso_dev_data->dev, tx_msg->msg, iso_dev_data->user_data);
-				} else {
-					midi_msg_unref(tx_msg->msg);
-				}
-				k_free(tx_msg);
-				return true;
-			}
-        }
-		prev_node = &tx_msg->node;
-    }
+	midi_iso_window_ack(&tx_window, muid, msg_num, BIT(0));
+}
 
-    return false;
+void midi_iso_ack_bitmap(uint8_t muid, uint8_t first_msg_num, uint32_t bitmap)
+{
+	midi_iso_window_ack(&tx_window, muid, first_msg_num, bitmap);
 }
 
-uint8_t * iso_tx_msg_list_resend(uint8_t *payload_ptr)
+/** @brief Get the BIS of a UMP group or MUID byte. */
+static uint8_t bis_for_key(uint8_t key)
 {
-	midi_ump_tx_msg_t *tx_msg;
-	sys_slist_t *msg_list = &midi_ump_func_block->tx_msg_list;
-	uint8_t count = 0;
+#if DT_NODE_HAS_PROP(BROADCASTER_NODE, bis_map)
+	return bis_map[key % ARRAY_SIZE(bis_map)];
+#else
+	return key % NUM_BIS;
+#endif
+}
 
-	if (!sys_slist_is_empty(msg_list))
-	{
-		SYS_SLIST_FOR_EACH_CONTAINER(msg_list, tx_msg, node) {
-			if (tx_msg->msg->num < msg_num)
-			{
-				k_fifo_put(&fifo_tx_data, tx_msg->msg);
-				count++;
-			}
-		}
+/**
+ * @brief Get the BIS a message is sent on.
+ *
+ * UMP messages are striped by group or by destination MUID, through
+ * bis-map if it is set. MIDI 1.0 messages are sent on the first BIS.
+ */
+static uint8_t bis_for_msg(const midi_msg_t *msg)
+{
+	if ((NUM_BIS == 1) || (msg->format != MIDI_FORMAT_2_0_UMP)) {
+		return 0;
 	}
 
-	if(count > 0)
-	{
-		LOG_DBG("Resending %d", count);
+	if (STRIPE_BY_MUID) {
+		return bis_for_key(*(uint8_t *)msg->context);
 	}
-	
-    return 0;
+
+	return bis_for_key(msg->data[0] & 0x0F);
 }
 
-void midi_iso_ack_msg(uint8_t muid, uint8_t msg_num)
+#if defined(CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT)
+/** @brief Get the BIS the messages of a snapshot entry are sent on. */
+static uint8_t bis_for_entry(const struct midi_iso_snapshot_entry *entry)
 {
-	while(iso_tx_msg_remove(muid, msg_num)) {}
+	if ((NUM_BIS == 1) || !entry->ump) {
+		return 0;
+	}
+
+	return bis_for_key(STRIPE_BY_MUID ? entry->muid : (entry->data[0] & 0x0F));
 }
 
-void add_msg_to_payload(midi_msg_t *msg)
+/** @brief Check if a snapshot entry is sent on a BIS. */
+static bool entry_on_bis(const struct midi_iso_snapshot_entry *entry, void *user_data)
 {
-	uint8_t *payload_ptr;
-	uint8_t *len_field;
-	enum midi_format previous_format;
-	uint64_t ref_time;
-	uint8_t len;
-
-	int lock = irq_lock();
+	return bis_for_entry(entry) == POINTER_TO_UINT(user_data);
+}
 
-	payload_ptr = payload_constructor.ptr;
-	len_field = payload_constructor.len_field;
-	previous_format = payload_constructor.previous_format;
-	ref_time = payload_constructor.ref_time;
+/**
+ * @brief Add the next piece of the snapshot of the channel state to the
+ * payload being built for a BIS.
+ *
+ * A snapshot is started every CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT_PERIOD_MS
+ * and sent in pieces of at most CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT_MAX_BYTES,
+ * one per payload. A piece that does not fit waits for the next payload.
+ */
+static void add_snapshot_to_payload(struct midi_iso_bis *bis, uint8_t bis_index)
+{
+	int64_t now = midi_time_now_us();
+	int err;
 
-	if (msg->format == MIDI_FORMAT_1_0_PARSED) {
-		if (previous_format != MIDI_FORMAT_1_0_PARSED) {
-			memset(payload_ptr, 0xFF, 1);
-			payload_ptr++;
-			len_field = payload_ptr;
-			memset(payload_ptr, 0, 3);
-			payload_ptr += 3;
+	if (!bis->snapshot_sending) {
+		if ((bis->snapshot_start != 0) &&
+		    ((now - bis->snapshot_start) <
+		     (CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT_PERIOD_MS * 1000LL))) {
+			return;
 		}
-		payload_constructor.previous_format = MIDI_FORMAT_1_0_PARSED;
-		msg->timestamp = (0x80 | calculate_timestamp(msg->uptime, ref_time));
-		memcpy(payload_ptr, &msg->timestamp, 1);
-		payload_ptr ++;
-		memcpy(payload_ptr, msg->data, msg->len);
-		payload_ptr += msg->len;
-		len = *len_field;
-		len += (msg->len + 1);
-		memset(len_field, len, 1);
+		memset(&bis->snapshot_cursor, 0, sizeof(bis->snapshot_cursor));
+		bis->snapshot_piece = 0;
+		bis->snapshot_sending = true;
+		bis->snapshot_start = now;
 	}
 
-	else if (msg->format == MIDI_FORMAT_2_0_UMP)
-	{
-		payload_constructor.previous_format = MIDI_FORMAT_2_0_UMP;
-		memcpy(payload_ptr, msg->context, 1);
-		payload_ptr ++;
-		msg->timestamp = (0x80 | calculate_timestamp(msg->uptime, ref_time));
-		memcpy(payload_ptr, &msg->timestamp, 1);
-		payload_ptr ++;
-		if(msg->num == 0xFF)
-		{
-			memset(payload_ptr, msg_num, 1);
-			iso_tx_msg_add(msg);
-		} else {
-			memset(payload_ptr, msg->num, 1);
-		}
-		
-		payload_ptr ++;
-		memset(payload_ptr, assign_ack_channel(ack_channels, 5, msg->context), 1);
-		uint8_t ack_channel = *payload_ptr;
-
-		payload_ptr ++;
-		memcpy(payload_ptr, msg->data, msg->len);
-		payload_ptr += msg->len;
+	err = midi_iso_payload_add_snapshot(&bis->builder, &snapshot, &bis->snapshot_cursor,
+					    bis->snapshot_piece,
+					    CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT_MAX_BYTES,
+					    entry_on_bis, UINT_TO_POINTER(bis_index));
+	if (err < 0) {
+		return;
 	}
 
-	payload_constructor.ptr = payload_ptr;
-	payload_constructor.len_field = len_field;
+	bis->snapshot_piece++;
+	bis->snapshot_sending = (err == 0);
+}
+#endif
+
+static void send_msg(midi_msg_t *msg)
+{
+	struct midi_iso_bis *bis = &bises[bis_for_msg(msg)];
+
+	while (midi_iso_payload_add_msg(&bis->builder, msg) == -ENOMEM)
+	{
+		k_sem_take(&bis->overflow_sem, K_FOREVER);
+	}
+}
 
-	irq_unlock(lock);
+/** @brief Send the messages of the window that were not acked in time. */
+static void resend_msgs(void)
+{
+	midi_msg_t *msgs[RESEND_BATCH];
+	size_t count;
+
+	do {
+		count = midi_iso_window_resend(&tx_window, msgs, ARRAY_SIZE(msgs));
+		for (size_t i = 0; i < count; i++) {
+			send_msg(msgs[i]);
+			midi_msg_unref(msgs[i]);
+		}
+		if (count) {
+			LOG_DBG("Resending %d", count);
+		}
+	} while (count == ARRAY_SIZE(msgs));
 }
 
 static void packet_thread_fn(void *p1, void *p2, void *p3)
 {
 	midi_msg_t *msg;
-	uint8_t len;
+	bool windowed;
+	unsigned int signaled;
+	int result;
+	struct k_poll_event events[] = {
+		K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+						K_POLL_MODE_NOTIFY_ONLY, &fifo_rt_tx_data, 0),
+		K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_SIGNAL,
+						K_POLL_MODE_NOTIFY_ONLY, &resend_signal, 0),
+		K_POLL_EVENT_STATIC_INITIALIZER(K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+						K_POLL_MODE_NOTIFY_ONLY, &fifo_tx_data, 0),
+	};
 
 	while(1)
 	{
-		len = payload_constructor.ptr - payload_constructor.start_ptr;
-
-		msg = k_fifo_get(&fifo_tx_data, K_FOREVER);
+		k_poll(events, ARRAY_SIZE(events), K_FOREVER);
+		events[0].state = K_POLL_STATE_NOT_READY;
+		events[1].state = K_POLL_STATE_NOT_READY;
+		events[2].state = K_POLL_STATE_NOT_READY;
+
+		msg = k_fifo_get(&fifo_rt_tx_data, K_NO_WAIT);
+		if (!msg) {
+			k_poll_signal_check(&resend_signal, &signaled, &result);
+			if (signaled) {
+				k_poll_signal_reset(&resend_signal);
+				for (size_t i = 0; i < NUM_BIS; i++) {
+					midi_iso_payload_add_fec(&bises[i].builder);
+				}
+				resend_msgs();
+#if defined(CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT)
+				/** Snapshots only take room left while messages are not waiting */
+				if (k_fifo_is_empty(&fifo_tx_data)) {
+					for (size_t i = 0; i < NUM_BIS; i++) {
+						add_snapshot_to_payload(&bises[i], i);
+					}
+				}
+#endif
+				continue;
+			}
+			msg = k_fifo_get(&fifo_tx_data, K_NO_WAIT);
+		}
 		if(msg) {
-			if ((len + msg->len + 5) > (CONFIG_BT_CTLR_ADV_ISO_PDU_LEN_MAX - 3))
-			{
-				k_sem_take(&sem_overflow_ctrl, K_FOREVER);
+			if ((msg->len + MSG_OVERHEAD_MAX) > bises[bis_for_msg(msg)].builder.size) {
+				LOG_WRN("Can not send midi message of length %d", msg->len);
+				midi_stats_dequeue(&iso_dev_data->stats);
+				midi_stats_drop(&iso_dev_data->stats, MIDI_STATS_DROP_TOO_LONG);
+				iso_tx_done(msg);
+				continue;
+			}
+
+			MIDI_TRACE(SEND, msg, msg->len);
+			midi_stats_tx(&iso_dev_data->stats, msg);
+
+#if defined(CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT)
+			midi_iso_snapshot_update(&snapshot, msg);
+#endif
+
+			/** UMP messages are held by the window until acked */
+			windowed = (msg->format == MIDI_FORMAT_2_0_UMP) &&
+				   (midi_iso_window_add(&tx_window, msg,
+							*(uint8_t *)msg->context) >= 0);
+			if ((msg->format == MIDI_FORMAT_2_0_UMP) && !windowed) {
+				LOG_WRN("No room for another receiver, sending once");
+			}
+
+			send_msg(msg);
+
+			/** A windowed message may be acked and freed by now */
+			if (!windowed) {
+				iso_tx_done(msg);
 			}
-			add_msg_to_payload(msg);
 		}
 	}
 }
 
+/**
+ * @brief Hand the payload of a BIS after the first to the timer, which
+ * sends it, and start a new one in the other buffer.
+ */
+static uint16_t bis_seal(struct midi_iso_bis *bis, int64_t ref_time)
+{
+	/** The buffer sent last time is built next, the second one the first time */
+	uint8_t *next_base = bis->ready ? bis->ready : bis->sdu[1];
+
+	bis->ready_len = midi_iso_payload_swap(&bis->builder, next_base, ref_time, &bis->ready);
+
+	k_sem_give(&bis->overflow_sem);
+
+	return bis->ready_len;
+}
+
 static int next_pdu_handler(uint8_t *payload)
 {
-	payload_constructor.next_ptr = payload + 3;	
+	bises[0].next_base = payload + 3;	
 
 	return 0;
 }
 
 static int radio_pdu_handler(uint8_t *payload)
 {	
+	struct midi_iso_bis *bis0 = &bises[0];
+	uint16_t striped_len = 0;
+	int64_t ref_time;
+	uint8_t *finished;
 	uint8_t len;
 	
-	memset(ack_channels, 0, 5);
-	k_work_schedule_for_queue(&iso_work_q, &iso_resend_work, 
-        K_USEC(big_create_param.interval-1500));
+	atomic_clear(&ack_assigned);
+	atomic_clear(&ack_next);
 
 	nrfx_timer_clear(&timer);
 	nrfx_timer_compare(&timer, NRF_TIMER_CC_CHANNEL1, nrfx_timer_us_to_ticks(&timer, 3500), true);
@@ -379,28 +517,27 @@ static int radio_pdu_handler(uint8_t *payload)
 		return 0;
 	}
 
-	payload_constructor.ref_time = k_ticks_to_us_floor64(k_uptime_ticks());
-	payload_constructor.previous_format = MIDI_FORMAT_2_0_UMP;
-	
-	len = payload_constructor.ptr - payload;
+	ref_time = midi_time_now_us();
 
-	payload_constructor.ptr = payload_constructor.next_ptr;
-	payload_constructor.start_ptr = payload_constructor.ptr;
+	len = midi_iso_payload_swap(&bis0->builder, bis0->next_base, ref_time, &finished);
+	/** The payload written in place starts 3 bytes into the PDU */
+	len = finished ? ((finished + len) - payload) : 0;
 
-	k_sem_give(&sem_overflow_ctrl);
+	k_sem_give(&bis0->overflow_sem);
 
-	if (len > 0)
-	{
-		msg_num++;
-		if (msg_num == 0xFF)
-		{
-			msg_num = 0;
-		}
+	for (size_t i = 1; i < NUM_BIS; i++) {
+		striped_len += bis_seal(&bises[i], ref_time);
+	}
+
+	midi_iso_window_tick(&tx_window);
+	k_poll_signal_raise(&resend_signal, 0);
 
+	if ((len > 0) || (striped_len > 0))
+	{
 		if (len > 88) {
 			LOG_WRN("Packet length is excessive  %d", len);
 		} else {
-			LOG_HEXDUMP_INF(payload, len, "TX:");
+			LOG_HEXDUMP_DBG(payload, len, "TX:");
 		}
 	}
 
@@ -414,22 +551,35 @@ static void timer_handler(nrf_timer_event_t event_type, void *context)
 		nrf_timer_event_clear(timer.p_reg, NRF_TIMER_EVENT_COMPARE1);
 		
 		int err;
-		struct net_buf *dummy_buf;
-		
-		dummy_buf = net_buf_alloc(&bis_tx_pool, K_MSEC(BUF_ALLOC_TIMEOUT));
-		if (!dummy_buf) {
-			LOG_ERR("Data buffer allocate timeout on channel isr");
-		}
+		struct net_buf *buf;
+		struct midi_iso_bis *bis;
+
+		/** The SDU of the first BIS is a dummy, its payload is written
+		 * into the PDU by radio_pdu_handler().
+		 */
+		for (size_t i = 0; i < NUM_BIS; i++) {
+			buf = net_buf_alloc(&bis_tx_pool, K_NO_WAIT);
+			if (!buf) {
+				LOG_ERR("Data buffer allocate timeout on channel isr");
+				continue;
+			}
 
-		net_buf_reserve(dummy_buf, BT_ISO_CHAN_SEND_RESERVE);
+			net_buf_reserve(buf, BT_ISO_CHAN_SEND_RESERVE);
 
-		err = bt_iso_chan_send(&bis_iso_chan[0], dummy_buf,
-							seq_num, BT_ISO_TIMESTAMP_NONE);
-		if (err < 0) {
-			LOG_ERR("Unable to broadcast data on"
-					" : %d", err);
-			net_buf_unref(dummy_buf);
-			return;
+			if (i > 0) {
+				bis = &bises[i];
+				if (bis->ready) {
+					net_buf_add_mem(buf, bis->ready, bis->ready_len);
+				}
+			}
+
+			err = bt_iso_chan_send(&bis_iso_chan[i], buf,
+								seq_num, BT_ISO_TIMESTAMP_NONE);
+			if (err < 0) {
+				LOG_ERR("Unable to broadcast data on BIS %d"
+						" : %d", i + 1, err);
+				net_buf_unref(buf);
+			}
 		}
 		seq_num++;
 	}
@@ -470,14 +620,43 @@ static int midi_iso_broadcaster_device_init(const struct device *dev)
 	iso_dev_data->dev = dev;
 	iso_dev_data->api = (struct midi_api*)dev->api;
 
+#if DT_NODE_HAS_PROP(BROADCASTER_NODE, bis_map)
+	for (size_t i = 0; i < ARRAY_SIZE(bis_map); i++) {
+		if (bis_map[i] >= NUM_BIS) {
+			LOG_ERR("bis-map entry %d above num-bis", i);
+			return -EINVAL;
+		}
+	}
+#endif
+
+	for (size_t i = 0; i < NUM_BIS; i++) {
+		bis_iso_chan[i].ops = &iso_ops;
+		bis_iso_chan[i].qos = &bis_iso_qos;
+		bis[i] = &bis_iso_chan[i];
+
+		k_sem_init(&bises[i].overflow_sem, 0, 1);
+		bises[i].builder.interval_us = BIG_SDU_INTERVAL_US;
+		bises[i].builder.ack_channel = assign_ack_channel;
+#if FEC_DEPTH > 0
+		bises[i].builder.fec = bises[i].fec;
+		bises[i].builder.fec_depth = FEC_DEPTH;
+		bises[i].builder.fec_max_bytes = FEC_MAX_BYTES;
+#endif
+		if (i == 0) {
+			bises[i].builder.size = BIS0_PAYLOAD_SIZE;
+		} else {
+			bises[i].builder.size = CONFIG_BT_ISO_TX_MTU;
+			bises[i].builder.base[0] = bises[i].sdu[0];
+		}
+	}
+
 	ull_adv_iso_radio_pdu_cb_set(radio_pdu_handler);
 	ull_adv_iso_radio_next_pdu_cb_set(next_pdu_handler);
 
-    k_work_queue_start(&iso_work_q, iso_work_q_stack_area,
-            K_THREAD_STACK_SIZEOF(iso_work_q_stack_area), -2,
-            NULL);
-
-    k_work_init_delayable(&iso_resend_work, iso_resend_work_handler);
+	midi_iso_window_init(&tx_window, window_done);
+#if defined(CONFIG_MIDI_ISO_BROADCASTER_SNAPSHOT)
+	midi_iso_snapshot_init(&snapshot);
+#endif
 
 	err = bt_enable(NULL);
 	if (err) {
@@ -539,6 +718,7 @@ static int midi_iso_broadcaster_device_init(const struct device *dev)
 	static struct midi_api midi_iso_broadcaster_api_##dev = {			\
         .midi_transfer = send_to_iso_broadcaster_port,					\
 		.midi_callback_set = midi_iso_broadcaster_port_callback_set,	\
+		.midi_stats_get = midi_iso_broadcaster_stats_get,				\
 	};															\
 	DEVICE_DT_DEFINE(MIDI_ISO_BROADCASTER_DEV_N_ID(dev),			  			\
 			    &midi_iso_broadcaster_device_init,			  			\
@@ -8,6 +8,7 @@
 
 #include "sys/util_macro_expansion.h"
 #include <zephyr/sys/util_internal.h>
+#include <zephyr/sys/util.h>
 
 #ifndef ZEPHYR_INCLUDE_MIDI_ISO_INTERNAL_H_
 #define ZEPHYR_INCLUDE_MIDI_ISO_INTERNAL_H_
@@ -44,4 +45,69 @@
 #define MIDI_ISO_RECEIVER_DEV_N_ID(dev)	    DT_INST(dev, COMPAT_MIDI_ISO_RECEIVER_DEVICE)
 #define MIDI_ISO_BROADCASTER_DEV_N_ID(dev)	    DT_INST(dev, COMPAT_MIDI_ISO_BROADCASTER_DEVICE)
 
+/*
+ * A payload starts with PAYLOAD_VERSION, followed by chunks. A chunk
+ * starts with its type, the length of the chunk after its header and an
+ * argument. The high nibble of the type byte is a second argument.
+ */
+#define PAYLOAD_VERSION			0x01
+#define PAYLOAD_CHUNK_HEADER_SIZE	3
+#define PAYLOAD_CHUNK_TYPE(byte)	((byte) & 0x0F)
+#define PAYLOAD_CHUNK_TYPE_ARG(byte)	((byte) >> 4)
+
+/*
+ * MIDI 1.0 messages, each after its timestamp. A channel message may
+ * leave out its status byte if it is the status of the channel message
+ * before it in the chunk.
+ */
+#define PAYLOAD_CHUNK_MIDI_1_0		0x00
+/* Copy of the chunks of the payload sent argument payloads earlier */
+#define PAYLOAD_CHUNK_FEC		0x01
+/*
+ * UMP messages to the MUID byte in the argument, each after a header
+ * byte. The second argument is the ACK channel of the first message,
+ * PAYLOAD_UMP_NO_ACK if none.
+ */
+#define PAYLOAD_CHUNK_UMP		0x02
+#define PAYLOAD_UMP_NO_ACK		0x0F
+/*
+ * Piece argument of a snapshot of the channel state, holding MIDI 1.0 and
+ * UMP chunks. Its UMP messages carry PAYLOAD_MSG_NUM_NONE. The second
+ * argument is PAYLOAD_SNAPSHOT_LAST on the last piece of a snapshot.
+ */
+#define PAYLOAD_CHUNK_SNAPSHOT		0x03
+#define PAYLOAD_SNAPSHOT_LAST		BIT(0)
+
+/*
+ * The header byte of a UMP message holds the fraction of the interval
+ * since the UMP message before it in the payload, or since the start of
+ * the interval for the first one. PAYLOAD_UMP_FRACTION_ABS in its place
+ * is followed by the fraction since the start of the interval.
+ */
+#define PAYLOAD_UMP_FRACTION_MASK	0x3F
+#define PAYLOAD_UMP_FRACTION_ABS	0x3F
+/*
+ * The sequence number follows. Without it the message has the sequence
+ * number after the one of the UMP message before it in the payload,
+ * PAYLOAD_MSG_NUM_NONE skipped. The first one in a payload has it.
+ */
+#define PAYLOAD_UMP_SEQ			BIT(7)
+/* The first two bytes are left out, they are those of the message before */
+#define PAYLOAD_UMP_RUNNING		BIT(6)
+
+/* Bytes of a UMP message, by its message type */
+#define PAYLOAD_UMP_LEN(type) \
+	((uint8_t)((type) < 0x3 ? 4 : (type) < 0x5 ? 8 : (type) == 0x5 ? 16 : \
+		   (type) < 0x8 ? 4 : (type) < 0xB ? 8 : (type) < 0xD ? 12 : 16))
+
+/* Message number of UMP messages sent without retransmission */
+#define PAYLOAD_MSG_NUM_NONE		0xFF
+
+/** @brief Sequence number of the UMP message after one in a payload. */
+static inline uint8_t payload_seq_next(uint8_t seq)
+{
+	seq++;
+	return (seq == PAYLOAD_MSG_NUM_NONE) ? (uint8_t)(seq + 1) : seq;
+}
+
 #endif /* ZEPHYR_INCLUDE_MIDI_ISO_INTERNAL_H_ */
\ No newline at end of file
@@ -0,0 +1,791 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI ISO payloads
+ *
+ * The payload format is described in midi_iso_internal.h.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+
+#include "midi_iso_internal.h"
+#include "midi/midi.h"
+#include "midi/midi_sysex.h"
+#include "midi/midi_iso_payload.h"
+
+/**
+ * Builder state, swapped atomically: a count of buffer swaps, whose
+ * lowest bit is the index of the buffer being built, its committed
+ * length, and the open chunk. The chunk is the offset of its
+ * length byte, 0 if no chunk is open, and the length written to that
+ * byte when the payload is finished. The count keeps a writer preempted
+ * over two swaps from committing to a reused buffer.
+ */
+#define STATE_SWAPS(state)	(((uint32_t)(state) >> 28) & 0xF)
+#define STATE_INDEX(state)	(STATE_SWAPS(state) & 1)
+#define STATE_LEN(state)	((state) & 0x3FF)
+#define STATE_CHUNK(state)	(((state) >> 10) & 0x3FF)
+#define STATE_CHUNK_LEN(state)	(((state) >> 20) & 0xFF)
+#define STATE(swaps, len, chunk, chunk_len) \
+	((atomic_val_t)((((uint32_t)(swaps) & 0xF) << 28) | (len) | ((chunk) << 10) | \
+			((chunk_len) << 20)))
+
+/** Data bytes of a MIDI 1.0 channel message, by the high nibble of its status */
+static const uint8_t channel_data_len[8] = {
+	2, 2, 2, 2, 1, 1, 2, 0,
+};
+
+/** Data bytes of a MIDI 1.0 system message, by the low nibble of its status */
+static const uint8_t system_data_len[16] = {
+	0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/**
+ * @brief Keep the chunks committed to the payload being built for
+ * copying into the payloads after it.
+ */
+static void fec_record(struct midi_iso_payload_builder *builder, atomic_val_t state,
+		       atomic_val_t new_state)
+{
+	struct midi_iso_payload_fec *hist =
+		&builder->fec[STATE_SWAPS(state) & (MIDI_ISO_PAYLOAD_FEC_SLOTS - 1)];
+	/** The version of the payload is not copied */
+	size_t start = MAX(STATE_LEN(state), 1);
+	const uint8_t *from = builder->base[STATE_INDEX(state)] + start;
+	int64_t ref_time = builder->ref_time[STATE_INDEX(state)];
+	size_t len = STATE_LEN(new_state) - start;
+
+	if (hist->ref_time != ref_time) {
+		hist->ref_time = ref_time;
+		hist->len = 0;
+		hist->chunk = 0;
+	}
+
+	if ((hist->len + len) > sizeof(hist->data)) {
+		/** Too long for a copy, the payload is not copied */
+		hist->len = sizeof(hist->data) + 1;
+		return;
+	}
+
+	if (STATE_CHUNK(new_state) == 0) {
+		hist->chunk = 0;
+	} else if (STATE_CHUNK(new_state) != STATE_CHUNK(state)) {
+		hist->chunk = hist->len + (STATE_CHUNK(new_state) - start);
+	}
+
+	memcpy(&hist->data[hist->len], from, len);
+	hist->len += len;
+
+	if (hist->chunk) {
+		hist->data[hist->chunk] = STATE_CHUNK_LEN(new_state);
+	}
+}
+
+int midi_iso_payload_add_msg(struct midi_iso_payload_builder *builder, midi_msg_t *msg)
+{
+	atomic_val_t state;
+	atomic_val_t new_state;
+	uint32_t idx, chunk, chunk_len;
+	struct midi_iso_payload_ctx ctx;
+	const uint8_t *data;
+	uint8_t *base;
+	uint8_t *payload_ptr;
+	uint8_t fraction;
+	uint8_t header = 0;
+	uint8_t ack_channel;
+	uint8_t muid = 0;
+	uint8_t data_len;
+	size_t msg_bytes;
+	size_t need;
+	bool new_chunk;
+
+	if (msg->len == 0) {
+		return 0;
+	}
+
+	do {
+		state = atomic_get(&builder->state);
+		idx = STATE_INDEX(state);
+		base = builder->base[idx];
+		chunk = STATE_CHUNK(state);
+		chunk_len = STATE_CHUNK_LEN(state);
+
+		if (!base) {
+			return -ENOMEM;
+		}
+
+		ctx = builder->ctx;
+		if (ctx.ref_time != builder->ref_time[idx]) {
+			memset(&ctx, 0, sizeof(ctx));
+			ctx.ref_time = builder->ref_time[idx];
+			chunk = 0;
+		}
+
+		fraction = midi_time_to_interval_fraction(msg->time_us, builder->ref_time[idx],
+							  builder->interval_us);
+		msg->timestamp = (0x80 | fraction);
+		data = msg->data;
+		data_len = msg->len;
+
+		if (msg->format == MIDI_FORMAT_1_0_PARSED) {
+			new_chunk = !chunk || (ctx.type != PAYLOAD_CHUNK_MIDI_1_0) ||
+				    ((chunk_len + 1 + msg->len) > UINT8_MAX);
+			if (new_chunk) {
+				ctx.type = PAYLOAD_CHUNK_MIDI_1_0;
+				ctx.running_status = 0;
+				chunk_len = 0;
+			}
+			if ((data[0] < 0xF0) && (data[0] == ctx.running_status)) {
+				data++;
+				data_len--;
+			}
+			msg_bytes = 1 + data_len;
+		} else if (msg->format == MIDI_FORMAT_2_0_UMP) {
+			muid = *(uint8_t *)msg->context;
+			new_chunk = !chunk || (ctx.type != PAYLOAD_CHUNK_UMP) || (ctx.muid != muid) ||
+				    ((chunk_len + 3 + msg->len) > UINT8_MAX);
+			if (new_chunk) {
+				ctx.type = PAYLOAD_CHUNK_UMP;
+				ctx.muid = muid;
+				chunk_len = 0;
+			}
+			if (!ctx.ump) {
+				ctx.fraction = 0;
+			}
+
+			msg_bytes = 1;
+			if ((fraction >= ctx.fraction) &&
+			    ((fraction - ctx.fraction) < PAYLOAD_UMP_FRACTION_ABS)) {
+				header = fraction - ctx.fraction;
+			} else {
+				header = PAYLOAD_UMP_FRACTION_ABS;
+				msg_bytes++;
+			}
+			if (!ctx.ump || (msg->num != payload_seq_next(ctx.seq))) {
+				header |= PAYLOAD_UMP_SEQ;
+				msg_bytes++;
+			}
+			if (ctx.ump && (msg->len >= 2) && !memcmp(data, ctx.status, 2)) {
+				header |= PAYLOAD_UMP_RUNNING;
+				data += 2;
+				data_len -= 2;
+			}
+			msg_bytes += data_len;
+		} else {
+			return 0;
+		}
+
+		need = msg_bytes;
+		if (new_chunk) {
+			need += PAYLOAD_CHUNK_HEADER_SIZE;
+		}
+		if (STATE_LEN(state) == 0) {
+			need++;
+		}
+		if ((STATE_LEN(state) + need) > builder->size) {
+			return -ENOMEM;
+		}
+
+		payload_ptr = base + STATE_LEN(state);
+		if (STATE_LEN(state) == 0) {
+			*payload_ptr++ = PAYLOAD_VERSION;
+		}
+
+		if (new_chunk && (ctx.type == PAYLOAD_CHUNK_UMP)) {
+			ack_channel = builder->ack_channel ? builder->ack_channel(muid) : 0xFF;
+			*payload_ptr++ = PAYLOAD_CHUNK_UMP |
+					 (MIN(ack_channel, PAYLOAD_UMP_NO_ACK) << 4);
+			chunk = payload_ptr - base;
+			*payload_ptr++ = 0;
+			*payload_ptr++ = muid;
+		} else if (new_chunk) {
+			*payload_ptr++ = PAYLOAD_CHUNK_MIDI_1_0;
+			chunk = payload_ptr - base;
+			*payload_ptr++ = 0;
+			*payload_ptr++ = 0;
+		}
+
+		if (ctx.type == PAYLOAD_CHUNK_MIDI_1_0) {
+			*payload_ptr++ = msg->timestamp;
+			/** Real-time messages keep the running status */
+			if (msg->data[0] < 0xF0) {
+				ctx.running_status = msg->data[0];
+			} else if (msg->data[0] < 0xF8) {
+				ctx.running_status = 0;
+			}
+		} else {
+			*payload_ptr++ = header;
+			if ((header & PAYLOAD_UMP_FRACTION_MASK) == PAYLOAD_UMP_FRACTION_ABS) {
+				*payload_ptr++ = fraction;
+			}
+			if (header & PAYLOAD_UMP_SEQ) {
+				*payload_ptr++ = msg->num;
+			}
+			ctx.ump = true;
+			ctx.fraction = fraction;
+			ctx.seq = msg->num;
+			memcpy(ctx.status, msg->data, MIN(msg->len, 2));
+		}
+
+		memcpy(payload_ptr, data, data_len);
+		payload_ptr += data_len;
+		chunk_len += msg_bytes;
+
+		new_state = STATE(STATE_SWAPS(state), payload_ptr - base, chunk, chunk_len);
+	} while (!atomic_cas(&builder->state, state, new_state));
+
+	builder->ctx = ctx;
+
+	/** A chunk closed by a later one keeps the length written here */
+	base[chunk] = chunk_len;
+
+	if (builder->fec) {
+		fec_record(builder, state, new_state);
+	}
+
+	return 0;
+}
+
+void midi_iso_payload_add_fec(struct midi_iso_payload_builder *builder)
+{
+	struct midi_iso_payload_fec *hist;
+	atomic_val_t state;
+	atomic_val_t new_state;
+	uint32_t swaps, copied;
+	uint8_t *base;
+	uint8_t *payload_ptr;
+	int64_t ref_time;
+	int64_t age_us;
+
+	if (!builder->fec) {
+		return;
+	}
+
+	do {
+		state = atomic_get(&builder->state);
+		swaps = STATE_SWAPS(state);
+		base = builder->base[STATE_INDEX(state)];
+		ref_time = builder->ref_time[STATE_INDEX(state)];
+		if (!base || (builder->fec_written == ref_time)) {
+			return;
+		}
+
+		payload_ptr = base + STATE_LEN(state);
+		copied = 0;
+		for (uint32_t age = 1; age <= builder->fec_depth; age++) {
+			hist = &builder->fec[(swaps - age) & (MIDI_ISO_PAYLOAD_FEC_SLOTS - 1)];
+			age_us = ref_time - hist->ref_time;
+			/** The slot may hold a payload older than age */
+			if (!hist->len || (hist->len > UINT8_MAX) ||
+			    (age_us < ((2 * age - 1) * builder->interval_us / 2)) ||
+			    (age_us > ((2 * age + 1) * builder->interval_us / 2))) {
+				continue;
+			}
+			if (((copied + PAYLOAD_CHUNK_HEADER_SIZE + hist->len) >
+			     builder->fec_max_bytes) ||
+			    ((payload_ptr - base) + (payload_ptr == base) +
+			     PAYLOAD_CHUNK_HEADER_SIZE + hist->len > builder->size)) {
+				break;
+			}
+			if (payload_ptr == base) {
+				*payload_ptr++ = PAYLOAD_VERSION;
+			}
+			*payload_ptr++ = PAYLOAD_CHUNK_FEC;
+			*payload_ptr++ = hist->len;
+			*payload_ptr++ = age;
+			memcpy(payload_ptr, hist->data, hist->len);
+			payload_ptr += hist->len;
+			copied += PAYLOAD_CHUNK_HEADER_SIZE + hist->len;
+		}
+
+		new_state = STATE(swaps, payload_ptr - base, 0, 0);
+	} while (!atomic_cas(&builder->state, state, new_state));
+
+	builder->fec_written = ref_time;
+}
+
+uint16_t midi_iso_payload_swap(struct midi_iso_payload_builder *builder, uint8_t *next_base,
+			       int64_t ref_time, uint8_t **finished)
+{
+	uint32_t swaps = STATE_SWAPS(atomic_get(&builder->state)) + 1;
+	uint32_t idx = swaps & 1;
+	atomic_val_t state;
+
+	builder->base[idx] = next_base;
+	builder->ref_time[idx] = ref_time;
+	state = atomic_set(&builder->state, STATE(swaps, 0, 0, 0));
+
+	*finished = builder->base[idx ^ 1];
+	if (*finished && STATE_CHUNK(state)) {
+		(*finished)[STATE_CHUNK(state)] = STATE_CHUNK_LEN(state);
+	}
+
+	return STATE_LEN(state);
+}
+
+#if defined(CONFIG_MIDI_ISO_SNAPSHOT)
+/**
+ * @brief Write a snapshot entry into a snapshot piece.
+ *
+ * @param pos   Where to write, moved past the entry.
+ * @param end   End of the room for the piece.
+ * @param chunk Length byte of the open chunk of the piece, NULL if none.
+ * @param last  The entry written before, in the open chunk.
+ *
+ * @return false if the entry does not fit.
+ */
+static bool snapshot_write_entry(const struct midi_iso_snapshot_entry *entry, uint8_t **pos,
+				 uint8_t *end, uint8_t **chunk,
+				 const struct midi_iso_snapshot_entry *last)
+{
+	uint8_t status = entry->data[entry->ump ? 1 : 0];
+	uint8_t op = status >> 4;
+	uint8_t data_len = entry->ump ? 4 :
+			   ((op == MIDI_OP_PROGRAM_CHANGE) || (op == MIDI_OP_CHANNEL_PRESSURE)) ? 2 : 3;
+	const uint8_t *data = entry->data;
+	bool new_chunk = !*chunk || !last || (last->ump != entry->ump) ||
+			 (entry->ump && (last->muid != entry->muid));
+	uint8_t header = PAYLOAD_UMP_SEQ;
+	size_t need;
+
+	if (!new_chunk && !memcmp(last->data, entry->data, entry->ump ? 2 : 1)) {
+		header |= PAYLOAD_UMP_RUNNING;
+		data += entry->ump ? 2 : 1;
+		data_len -= entry->ump ? 2 : 1;
+	}
+
+	need = (new_chunk ? PAYLOAD_CHUNK_HEADER_SIZE : 0) + (entry->ump ? 2 : 1) + data_len;
+	if ((end - *pos) < need) {
+		return false;
+	}
+
+	if (new_chunk) {
+		*(*pos)++ = entry->ump ? (PAYLOAD_CHUNK_UMP | (PAYLOAD_UMP_NO_ACK << 4)) :
+					 PAYLOAD_CHUNK_MIDI_1_0;
+		*chunk = *pos;
+		*(*pos)++ = 0;
+		*(*pos)++ = entry->ump ? entry->muid : 0;
+	}
+
+	if (entry->ump) {
+		*(*pos)++ = header;
+		*(*pos)++ = PAYLOAD_MSG_NUM_NONE;
+	} else {
+		/** At the start of the interval */
+		*(*pos)++ = 0x80;
+	}
+	memcpy(*pos, data, data_len);
+	*pos += data_len;
+	**chunk += need - (new_chunk ? PAYLOAD_CHUNK_HEADER_SIZE : 0);
+
+	return true;
+}
+
+int midi_iso_payload_add_snapshot(struct midi_iso_payload_builder *builder,
+				  struct midi_iso_snapshot *snapshot,
+				  struct midi_iso_snapshot_cursor *cursor, uint8_t piece,
+				  size_t max_bytes, midi_iso_payload_entry_filter_t filter,
+				  void *user_data)
+{
+	const struct midi_iso_snapshot_entry *entry;
+	const struct midi_iso_snapshot_entry *last;
+	struct midi_iso_snapshot_cursor walk;
+	atomic_val_t state;
+	atomic_val_t new_state;
+	uint8_t *base;
+	uint8_t *payload_ptr;
+	uint8_t *header;
+	uint8_t *chunk;
+	uint8_t *end;
+
+	do {
+		state = atomic_get(&builder->state);
+		base = builder->base[STATE_INDEX(state)];
+		if (!base) {
+			return -ENOMEM;
+		}
+
+		payload_ptr = base + STATE_LEN(state);
+		end = base + MIN(builder->size,
+				 STATE_LEN(state) + (STATE_LEN(state) == 0) +
+				 PAYLOAD_CHUNK_HEADER_SIZE + max_bytes);
+		if ((end - payload_ptr) < (1 + PAYLOAD_CHUNK_HEADER_SIZE)) {
+			return -ENOMEM;
+		}
+
+		if (STATE_LEN(state) == 0) {
+			*payload_ptr++ = PAYLOAD_VERSION;
+		}
+		header = payload_ptr;
+		payload_ptr += PAYLOAD_CHUNK_HEADER_SIZE;
+
+		walk = *cursor;
+		chunk = NULL;
+		last = NULL;
+		while ((entry = midi_iso_snapshot_peek(snapshot, &walk))) {
+			if (!filter || filter(entry, user_data)) {
+				if (!snapshot_write_entry(entry, &payload_ptr, end, &chunk, last)) {
+					break;
+				}
+				last = entry;
+			}
+			midi_iso_snapshot_next(&walk);
+		}
+
+		/** Wait for room for at least one entry */
+		if (entry && !last) {
+			return -ENOMEM;
+		}
+
+		header[0] = PAYLOAD_CHUNK_SNAPSHOT | (entry ? 0 : (PAYLOAD_SNAPSHOT_LAST << 4));
+		header[1] = payload_ptr - (header + PAYLOAD_CHUNK_HEADER_SIZE);
+		header[2] = piece;
+
+		new_state = STATE(STATE_SWAPS(state), payload_ptr - base, 0, 0);
+	} while (!atomic_cas(&builder->state, state, new_state));
+
+	*cursor = walk;
+
+	return entry ? 0 : 1;
+}
+#endif
+
+static uint8_t read_next_byte(uint8_t **pos)
+{
+	return *(*pos)++;
+}
+
+/** @brief Microseconds from a time since the start of the interval. */
+static inline uint16_t calculate_timestamp(uint32_t interval_us, uint16_t waited_time_sum,
+					   uint8_t timestamp)
+{
+	uint16_t delta;
+	delta = midi_time_from_interval_fraction(timestamp, 0, interval_us);
+
+	return (uint16_t)delta - waited_time_sum;
+}
+
+/** @brief Count a malformed message and skip the rest of its chunk. */
+static midi_msg_t *parse_malformed(const struct midi_iso_payload_parser *parser, uint8_t **pos,
+				   uint8_t *end)
+{
+	if (parser->malformed_cb) {
+		parser->malformed_cb(parser->user_data);
+	}
+	*pos = end;
+	return NULL;
+}
+
+/**
+ * @brief Find the end of a MIDI 1.0 message in a chunk.
+ *
+ * @param status         Status of the message.
+ * @param data           First data byte of the message.
+ * @param end            End of the chunk.
+ * @param running_status Status of the last channel message in the chunk.
+ *
+ * @return NULL if the message is malformed.
+ */
+static uint8_t *chunk_msg_end(uint8_t status, uint8_t *data, uint8_t *end,
+			      uint8_t *running_status)
+{
+	uint8_t data_len;
+
+	if (status == MIDI_SYSEX_START) {
+		*running_status = 0;
+		while (data < end) {
+			if (*data++ == MIDI_SYSEX_END) {
+				return data;
+			}
+		}
+		return NULL;
+	}
+
+	if (status < 0xF0) {
+		data_len = channel_data_len[(status >> 4) & 0x7];
+		*running_status = status;
+	} else {
+		data_len = system_data_len[status & 0xF];
+		/** Real-time messages leave the running status */
+		if (status < 0xF8) {
+			*running_status = 0;
+		}
+	}
+
+	if ((end - data) < data_len) {
+		return NULL;
+	}
+	for (uint8_t i = 0; i < data_len; i++) {
+		if (data[i] >= 0x80) {
+			return NULL;
+		}
+	}
+
+	return data + data_len;
+}
+
+/**
+ * @brief Parse the next message of a MIDI 1.0 chunk.
+ *
+ * The message is a view of @p buf. A message in running status is given
+ * its status byte in place of its timestamp, which is read already.
+ *
+ * @param end            End of the chunk.
+ * @param running_status Status of the last channel message in the chunk.
+ *
+ * @return NULL if the message is malformed, the rest of the chunk is
+ * skipped.
+ */
+static midi_msg_t *parse_chunk(const struct midi_iso_payload_parser *parser,
+			       struct net_buf *buf, uint8_t **pos, uint16_t waited_time_sum,
+			       uint8_t *end, uint8_t *running_status)
+{
+	uint8_t *msg_start;
+	uint8_t *msg_end = NULL;
+	uint8_t timestamp;
+	uint8_t statusbyte;
+
+	timestamp = read_next_byte(pos);
+	msg_start = *pos;
+
+	if (msg_start < end) {
+		statusbyte = *msg_start;
+		if (statusbyte >= 0x80) {
+			msg_end = chunk_msg_end(statusbyte, msg_start + 1, end, running_status);
+		} else if (*running_status) {
+			statusbyte = *running_status;
+			msg_end = chunk_msg_end(statusbyte, msg_start, end, running_status);
+			*(--msg_start) = statusbyte;
+		}
+	}
+
+	if (!msg_end) {
+		return parse_malformed(parser, pos, end);
+	}
+	*pos = msg_end;
+
+	return midi_msg_init(buf, msg_start, msg_end - msg_start, MIDI_FORMAT_1_0_PARSED_DELTA_US,
+			     NULL, calculate_timestamp(parser->interval_us, waited_time_sum,
+						       (127 & timestamp)),
+			     midi_time_now_us(), 0, 0);
+}
+
+/** @brief UMP messages of a payload, as parsed so far. */
+struct ump_ctx {
+	/** MUID byte of the chunk being parsed */
+	uint8_t muid;
+	/** ACK channel of the next message, only the first of a chunk has one */
+	uint8_t ack_channel;
+	/** Fraction of the interval, sequence number and first two bytes of the last message */
+	uint8_t fraction;
+	uint8_t seq;
+	uint8_t status[2];
+	bool started;
+};
+
+/**
+ * @brief Parse the next message of a UMP chunk.
+ *
+ * A message in running status is copied, the others are views of
+ * @p buf.
+ *
+ * @param end End of the chunk.
+ * @param ctx The UMP messages of the payload so far.
+ *
+ * @return NULL if the message is not delivered. The rest of the chunk is
+ * skipped if the message is malformed.
+ */
+static midi_msg_t *parse_ump(const struct midi_iso_payload_parser *parser, struct net_buf *buf,
+			     uint8_t **pos, uint8_t *end, uint16_t waited_time_sum,
+			     struct ump_ctx *ctx)
+{
+	struct midi_iso_payload_ump ump;
+	midi_msg_t *msg;
+	uint8_t *msg_start;
+	uint8_t header;
+	uint8_t fraction;
+	uint8_t msg_num;
+	uint8_t status[2];
+	uint8_t msg_len;
+	uint8_t data_len;
+	uint16_t timestamp;
+
+	header = read_next_byte(pos);
+
+	if ((header & PAYLOAD_UMP_FRACTION_MASK) == PAYLOAD_UMP_FRACTION_ABS) {
+		if (*pos >= end) {
+			return parse_malformed(parser, pos, end);
+		}
+		fraction = read_next_byte(pos) & 127;
+	} else {
+		fraction = MIN(ctx->fraction + (header & PAYLOAD_UMP_FRACTION_MASK), 127);
+	}
+
+	if (header & PAYLOAD_UMP_SEQ) {
+		if (*pos >= end) {
+			return parse_malformed(parser, pos, end);
+		}
+		msg_num = read_next_byte(pos);
+	} else if (ctx->started) {
+		msg_num = payload_seq_next(ctx->seq);
+	} else {
+		return parse_malformed(parser, pos, end);
+	}
+
+	if (header & PAYLOAD_UMP_RUNNING) {
+		if (!ctx->started) {
+			return parse_malformed(parser, pos, end);
+		}
+		memcpy(status, ctx->status, 2);
+		msg_len = PAYLOAD_UMP_LEN(status[0] >> 4);
+		data_len = msg_len - 2;
+	} else {
+		if ((end - *pos) < 2) {
+			return parse_malformed(parser, pos, end);
+		}
+		memcpy(status, *pos, 2);
+		msg_len = PAYLOAD_UMP_LEN(status[0] >> 4);
+		data_len = msg_len;
+	}
+
+	if ((end - *pos) < data_len) {
+		return parse_malformed(parser, pos, end);
+	}
+	msg_start = *pos;
+	*pos += data_len;
+
+	ump.muid = ctx->muid;
+	ump.num = msg_num;
+	ump.ack_channel = ctx->ack_channel;
+	ump.type = status[0];
+	ctx->ack_channel = 0xFF;
+	ctx->started = true;
+	ctx->fraction = fraction;
+	ctx->seq = msg_num;
+	memcpy(ctx->status, status, 2);
+
+	if (parser->ump_filter && !parser->ump_filter(&ump, parser->user_data)) {
+		return NULL;
+	}
+
+	timestamp = calculate_timestamp(parser->interval_us, waited_time_sum, fraction);
+
+	if (!(header & PAYLOAD_UMP_RUNNING)) {
+		return midi_msg_init(buf, msg_start, msg_len, MIDI_FORMAT_2_0_UMP, NULL,
+				     timestamp, midi_time_now_us(), msg_num, ump.ack_channel);
+	}
+
+	/** The first two bytes are not in the buffer */
+	msg = midi_msg_init_alloc(NULL, msg_len, MIDI_FORMAT_2_0_UMP, NULL);
+	if (!msg || !msg->data) {
+		midi_msg_unref_alt(msg);
+		return NULL;
+	}
+	memcpy(msg->data, status, 2);
+	memcpy(msg->data + 2, msg_start, data_len);
+	msg->timestamp = timestamp;
+	msg->time_us = midi_time_now_us();
+	msg->num = msg_num;
+	msg->ack_channel = ump.ack_channel;
+
+	return msg;
+}
+
+/**
+ * @brief Parse the chunks of a payload, or of a copy or snapshot piece
+ * carried in it.
+ *
+ * @param nested The chunks are of a copy or snapshot piece.
+ */
+static void parse_chunks(const struct midi_iso_payload_parser *parser, struct net_buf *buf,
+			 uint8_t *pos, uint8_t *end, int64_t recv_time, bool nested)
+{
+	uint8_t *chunk_tail;
+	uint8_t chunk_len;
+	uint8_t chunk_type;
+	uint8_t chunk_arg;
+	uint16_t waited_time_sum = 0;
+	midi_msg_t *parsed_msg;
+	uint8_t running_status;
+	struct ump_ctx ump = {0};
+
+	while ((end - pos) >= PAYLOAD_CHUNK_HEADER_SIZE) {
+		chunk_type = read_next_byte(&pos);
+		chunk_len = read_next_byte(&pos);
+		chunk_arg = read_next_byte(&pos);
+		chunk_tail = MIN(pos + chunk_len, end);
+
+		switch (PAYLOAD_CHUNK_TYPE(chunk_type)) {
+		case PAYLOAD_CHUNK_FEC:
+			/** Copies are only parsed for payloads that were lost */
+			if (!nested && parser->fec_cb && parser->fec_cb(chunk_arg, parser->user_data)) {
+				parse_chunks(parser, buf, pos, chunk_tail,
+					     recv_time - (chunk_arg * parser->interval_us), true);
+			}
+			break;
+
+		case PAYLOAD_CHUNK_SNAPSHOT:
+			/** The state of a BIS joined late, messages since then are received */
+			if (!nested && parser->snapshot_cb &&
+			    parser->snapshot_cb(chunk_arg, PAYLOAD_CHUNK_TYPE_ARG(chunk_type),
+						parser->user_data)) {
+				parse_chunks(parser, buf, pos, chunk_tail, recv_time, true);
+			}
+			break;
+
+		case PAYLOAD_CHUNK_MIDI_1_0:
+			running_status = 0;
+			while (pos < chunk_tail)
+			{
+				parsed_msg = parse_chunk(parser, buf, &pos, waited_time_sum, chunk_tail,
+							 &running_status);
+				if (parsed_msg) {
+					waited_time_sum += parsed_msg->timestamp;
+					parser->msg_cb(parsed_msg, recv_time + waited_time_sum,
+						       parser->user_data);
+				}
+			}
+			break;
+
+		case PAYLOAD_CHUNK_UMP:
+			ump.muid = chunk_arg;
+			ump.ack_channel = PAYLOAD_CHUNK_TYPE_ARG(chunk_type);
+			if (ump.ack_channel == PAYLOAD_UMP_NO_ACK) {
+				ump.ack_channel = 0xFF;
+			}
+			while (pos < chunk_tail)
+			{
+				parsed_msg = parse_ump(parser, buf, &pos, chunk_tail, waited_time_sum,
+						       &ump);
+				if (parsed_msg) {
+					waited_time_sum += parsed_msg->timestamp;
+					parser->msg_cb(parsed_msg, recv_time + waited_time_sum,
+						       parser->user_data);
+				}
+			}
+			break;
+
+		default:
+			/** Chunks of types added later are skipped */
+			break;
+		}
+
+		pos = chunk_tail;
+	}
+}
+
+void midi_iso_payload_parse(const struct midi_iso_payload_parser *parser, struct net_buf *buf,
+			    uint8_t *pos, uint8_t *end, int64_t recv_time)
+{
+	if ((pos >= end) || (read_next_byte(&pos) != PAYLOAD_VERSION)) {
+		parse_malformed(parser, &pos, end);
+		return;
+	}
+
+	parse_chunks(parser, buf, pos, end, recv_time, false);
+}
@@ -16,6 +16,8 @@
 #include "midi/midi_types.h"
 #include <midi/midi_parser.h>
 #include <midi/midi_sysex.h>
+#include <midi/midi_stats.h>
+#include <midi/midi_iso_payload.h>
 
 #include <zephyr/sys/util.h>
 
@@ -35,35 +37,135 @@ LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
 #define PA_RETRY_COUNT 6
 
-static bool         per_adv_found;
-static bool         per_adv_lost;
-static bool         big_synced;
-static bt_addr_le_t per_addr;
-static uint8_t      per_sid;
-static uint32_t     per_interval_us;
-static uint32_t     iso_recv_count;
+#define RECEIVER_NODE DT_INST(0, COMPAT_MIDI_ISO_RECEIVER_DEVICE)
 
-uint8_t previous_msg_num = 0xFF;
+/** Number of BIGs synced to at once, from different broadcasters */
+#define MAX_BIGS DT_PROP(RECEIVER_NODE, max_bigs)
 
-struct bt_le_per_adv_sync *sync;
-struct bt_iso_big *big;
-static struct bt_iso_big_sync_param big_sync_param;
+/** Number of BISes synced to in each BIG */
+#define NUM_SYNC_BIS DT_PROP_LEN(RECEIVER_NODE, bises)
+
+/** Messages of more than one BIS are merged in order of their time */
+#define MERGE_BISES ((MAX_BIGS * NUM_SYNC_BIS) > 1)
+
+/** Messages are queued in order of their time, to merge or to play them out */
+#define MERGE_QUEUE (MERGE_BISES || IS_ENABLED(CONFIG_MIDI_ISO_RECEIVER_PLAYOUT))
+
+/** Weight of a later SDU reference in the clock offset, as a shift */
+#define TS_OFFSET_SHIFT 8
+
+#define REORDER_MASK (CONFIG_MIDI_ISO_RECEIVER_REORDER_SIZE - 1)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_MIDI_ISO_RECEIVER_REORDER_SIZE),
+	     "reorder size must be a power of two");
+BUILD_ASSERT(MAX_BIGS <= CONFIG_BT_PER_ADV_SYNC_MAX, "max-bigs above CONFIG_BT_PER_ADV_SYNC_MAX");
+BUILD_ASSERT(MAX_BIGS * NUM_SYNC_BIS <= CONFIG_BT_ISO_MAX_CHAN,
+	     "max-bigs times BISes above CONFIG_BT_ISO_MAX_CHAN");
+
+/** BIS numbers synced to, from 1 */
+static const uint8_t sync_bises[] = DT_PROP(RECEIVER_NODE, bises);
+
+struct midi_iso_rx_big;
+
+/** Snapshot of the channel state a BIS applies after it is synced */
+enum snapshot_state {
+	/** Waiting for the first piece of a snapshot */
+	SNAPSHOT_WAIT,
+	/** Applying the pieces of a snapshot */
+	SNAPSHOT_APPLY,
+	/** A snapshot was applied, the state follows the messages */
+	SNAPSHOT_DONE,
+};
+
+struct midi_iso_rx_bis {
+	struct bt_iso_chan chan;
+	struct bt_iso_chan_qos qos;
+	struct bt_iso_chan_io_qos rx_qos;
+	struct midi_iso_rx_big *big;
+	/** BIS number in the BIG, from 1 */
+	uint8_t number;
+	/** Newest SDU, and the SDUs before it received or recovered */
+	uint16_t fec_seq;
+	uint32_t fec_seen;
+#if defined(CONFIG_MIDI_ISO_RECEIVER_SNAPSHOT)
+	enum snapshot_state snapshot_state;
+	/** Next snapshot piece to apply */
+	uint8_t snapshot_next;
+#endif
+	struct midi_iso_bis_stats stats;
+};
+
+/**
+ * @brief Sequence numbers of the UMP messages of a broadcaster.
+ *
+ * The sequence numbers are shared by the messages to all receivers on all
+ * BISes of the BIG, so every message counts, whoever it is sent to.
+ */
+struct midi_iso_rx_seq {
+	/** A sequence number has been received */
+	bool synced;
+	/**
+	 * Some BISes of the BIG are not synced to, so the sequence numbers
+	 * of their messages are never received. Messages are delivered as
+	 * they are received, and seen only finds duplicates.
+	 */
+	bool partial;
+	/** Sequence number of the next message to deliver */
+	uint8_t next;
+	/**
+	 * Sequence numbers from next on received, bit 0 is next. If partial,
+	 * those before next, bit 0 is the one before next.
+	 */
+	uint32_t seen;
+	/** Messages received after a missing sequence number */
+	midi_msg_t *held[CONFIG_MIDI_ISO_RECEIVER_REORDER_SIZE];
+	int64_t held_time[CONFIG_MIDI_ISO_RECEIVER_REORDER_SIZE];
+	/** Time next has been missing since */
+	int64_t gap_since;
+	struct midi_iso_seq_stats stats;
+};
+
+/** @brief A periodic advertiser and the BIG synced to through it. */
+struct midi_iso_rx_big {
+	struct bt_le_per_adv_sync *sync;
+	struct bt_iso_big *big;
+	bool big_synced;
+	/** ISO interval of the BIG */
+	uint32_t interval_us;
+	/** Controller time of the last SDU reference, extended to 64 bits */
+	int64_t ts;
+	/** MIDI time minus controller time, see big_anchor() */
+	int64_t ts_offset;
+	bool ts_valid;
+	struct midi_iso_rx_bis bis[NUM_SYNC_BIS];
+	struct midi_iso_rx_seq seq;
+	/** BISes of bis[] present in the BIG */
+	struct bt_iso_chan *chans[NUM_SYNC_BIS];
+	struct bt_iso_big_sync_param sync_param;
+};
+
+static struct midi_iso_rx_big bigs[MAX_BIGS];
+
+static bool scanning;
+
+/** A periodic advertising sync is being created, one at a time */
+static bool sync_pending;
 
 struct midi_iso_receiver_dev_data *iso_dev_data;
 
 DEFINE_MIDI_PARSER_SERIAL(iso_serial_parser);
 
-uint16_t previous_seq_num;
-uint64_t big_interval;
-
 struct midi_iso_receiver_dev_data {
 	struct midi_api *api;
 	const struct device *dev;
+	struct midi_stats_data stats;
 	void *user_data;
 };
 
 uint32_t muid_subscribe;
 
+static midi_iso_ack_needed ack_cb;
+
 int midi_iso_set_function_block(midi_ump_function_block_t *function_block)
 {
 	muid_subscribe = function_block->muid;
@@ -72,9 +174,93 @@ int midi_iso_set_function_block(midi_ump_function_block_t *function_block)
 
 int midi_iso_scan(const struct device *dev) 
 {
+	scanning = true;
     return bt_le_scan_start(BT_LE_SCAN_CUSTOM, NULL);
 }
 
+int midi_iso_bis_stats_get(const struct device *dev, uint8_t big, uint8_t bis,
+			   struct midi_iso_bis_stats *stats, bool reset)
+{
+	struct midi_iso_rx_bis *rx_bis;
+
+	if (big >= MAX_BIGS) {
+		return -ENOENT;
+	}
+
+	for (size_t i = 0; i < NUM_SYNC_BIS; i++) {
+		rx_bis = &bigs[big].bis[i];
+		if (rx_bis->number != bis) {
+			continue;
+		}
+
+		int lock = irq_lock();
+
+		*stats = rx_bis->stats;
+		if (reset) {
+			rx_bis->stats.sdus = 0;
+			rx_bis->stats.lost = 0;
+			rx_bis->stats.invalid = 0;
+			rx_bis->stats.recovered = 0;
+			rx_bis->stats.snapshots = 0;
+		}
+		irq_unlock(lock);
+
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+int midi_iso_seq_stats_get(const struct device *dev, uint8_t big,
+			   struct midi_iso_seq_stats *stats, bool reset)
+{
+	if (big >= MAX_BIGS) {
+		return -ENOENT;
+	}
+
+	int lock = irq_lock();
+
+	*stats = bigs[big].seq.stats;
+	if (reset) {
+		memset(&bigs[big].seq.stats, 0, sizeof(bigs[big].seq.stats));
+	}
+	irq_unlock(lock);
+
+	return 0;
+}
+
+int midi_iso_register_ack_cb(midi_iso_ack_needed cb)
+{
+	ack_cb = cb;
+	return 0;
+}
+
+static struct midi_iso_rx_big *big_find_by_sync(struct bt_le_per_adv_sync *sync)
+{
+	for (size_t i = 0; i < MAX_BIGS; i++) {
+		if (bigs[i].sync == sync) {
+			return &bigs[i];
+		}
+	}
+
+	return NULL;
+}
+
+/** @brief Scan for broadcasters while BIGs are left to sync to. */
+static void scan_resume(void)
+{
+	int err;
+
+	if (!scanning || sync_pending || !big_find_by_sync(NULL)) {
+		return;
+	}
+
+	err = bt_le_scan_start(BT_LE_SCAN_CUSTOM, NULL);
+	if (err && (err != -EALREADY)) {
+		LOG_ERR("scan start failed (err %d)", err);
+	}
+}
+
 int midi_iso_receiver_port_callback_set(const struct device *dev,
 				 midi_transfer cb,
 				 void *user_data)
@@ -124,6 +310,7 @@ static void scan_recv(const struct bt_le_scan_recv_info *info,
 	char le_addr[BT_ADDR_LE_STR_LEN];
 	char name[NAME_LEN];
     struct bt_le_per_adv_sync_param sync_create_param;
+	struct midi_iso_rx_big *big;
     int err;
 
 	(void)memset(name, 0, sizeof(name));
@@ -143,32 +330,34 @@ static void scan_recv(const struct bt_le_scan_recv_info *info,
 	       phy2str(info->primary_phy), phy2str(info->secondary_phy),
 	       info->interval, BT_CONN_INTERVAL_TO_US(info->interval), info->sid);
 
-	if (!per_adv_found && info->interval) {
-		
+	if (!sync_pending && info->interval &&
+	    !bt_le_per_adv_sync_lookup_addr(info->addr, info->sid)) {
+		big = big_find_by_sync(NULL);
+		if (!big) {
+			return;
+		}
+
         err = bt_le_scan_stop();
         if (err) {
             LOG_ERR("stop failed (err %d)\n", err);
             return;
         }
 
-        per_adv_found = true;
-
-		per_sid = info->sid;
-		per_interval_us = BT_CONN_INTERVAL_TO_US(info->interval);
-		bt_addr_le_copy(&per_addr, info->addr);
-
-		bt_addr_le_copy(&sync_create_param.addr, &per_addr);
+		bt_addr_le_copy(&sync_create_param.addr, info->addr);
         sync_create_param.options = 0;
-        sync_create_param.sid = per_sid;
+        sync_create_param.sid = info->sid;
         sync_create_param.skip = 0;
         /* Multiple PA interval with retry count and convert to unit of 10 ms */
-        sync_create_param.timeout = (per_interval_us * PA_RETRY_COUNT) /
-                        (10 * USEC_PER_MSEC);
-        err = bt_le_per_adv_sync_create(&sync_create_param, &sync);
+        sync_create_param.timeout = (BT_CONN_INTERVAL_TO_US(info->interval) *
+					     PA_RETRY_COUNT) / (10 * USEC_PER_MSEC);
+        err = bt_le_per_adv_sync_create(&sync_create_param, &big->sync);
         if (err) {
             LOG_ERR("adv sync create failed (err %d)\n", err);
+            big->sync = NULL;
+            scan_resume();
             return;
         }
+        sync_pending = true;
 	}
 }
 
@@ -187,20 +376,29 @@ static void sync_cb(struct bt_le_per_adv_sync *sync,
 	       "Interval 0x%04x (%u ms), PHY %s\n",
 	       bt_le_per_adv_sync_get_index(sync), le_addr,
 	       info->interval, info->interval * 5 / 4, phy2str(info->phy));
-    
+
+	sync_pending = false;
+	scan_resume();
 }
 
 static void term_cb(struct bt_le_per_adv_sync *sync,
 		    const struct bt_le_per_adv_sync_term_info *info)
 {
 	char le_addr[BT_ADDR_LE_STR_LEN];
+	struct midi_iso_rx_big *big;
 
 	bt_addr_le_to_str(info->addr, le_addr, sizeof(le_addr));
 
 	LOG_DBG("PER_ADV_SYNC[%u]: [DEVICE]: %s sync terminated\n",
 	       bt_le_per_adv_sync_get_index(sync), le_addr);
 
-	per_adv_lost = true;
+	big = big_find_by_sync(sync);
+	if (big && !big->big_synced) {
+		/** Sync failed or was lost before the BIG was synced */
+		big->sync = NULL;
+	}
+	sync_pending = false;
+	scan_resume();
 }
 
 static void recv_cb(struct bt_le_per_adv_sync *sync,
@@ -223,10 +421,11 @@ static void biginfo_cb(struct bt_le_per_adv_sync *sync,
 		       const struct bt_iso_biginfo *biginfo)
 {
 	char le_addr[BT_ADDR_LE_STR_LEN];
+	struct midi_iso_rx_big *big = big_find_by_sync(sync);
+	uint8_t num_bis = 0;
     int err;
 
 	bt_addr_le_to_str(biginfo->addr, le_addr, sizeof(le_addr));
-    big_interval = (biginfo->iso_interval * 5 / 4);
 	LOG_DBG("BIG INFO[%u]: [DEVICE]: %s, sid 0x%02x, "
 	       "num_bis %u, nse %u, interval 0x%04x (%u ms), "
 	       "bn %u, pto %u, irc %u, max_pdu %u, "
@@ -242,14 +441,38 @@ static void biginfo_cb(struct bt_le_per_adv_sync *sync,
 	       biginfo->framing ? "with" : "without",
 	       biginfo->encryption ? "" : "not ");
 
-	if (!big_synced) {
-		big_synced = true;
-		err = bt_iso_big_sync(sync, &big_sync_param, &big);
-		if (err) {
-			LOG_ERR("big sync failed (err %d)\n", err);
-			return;
+	if (!big || big->big_synced) {
+		return;
+	}
+
+	/** Sync to the BISes of bises that the BIG has */
+	big->sync_param.bis_bitfield = 0;
+	for (size_t i = 0; i < NUM_SYNC_BIS; i++) {
+		if (big->bis[i].number <= biginfo->num_bis) {
+			big->chans[num_bis++] = &big->bis[i].chan;
+			big->sync_param.bis_bitfield |= BIT(big->bis[i].number);
 		}
 	}
+
+	if (num_bis == 0) {
+		LOG_WRN("BIG of %s has none of the BISes to sync to", le_addr);
+		return;
+	}
+
+	big->interval_us = biginfo->iso_interval * 1250;
+	big->seq.partial = (num_bis < biginfo->num_bis);
+	if (big->seq.partial) {
+		LOG_INF("Syncing to %u of %u BISes, messages are not reordered",
+			num_bis, biginfo->num_bis);
+	}
+	big->sync_param.num_bis = num_bis;
+	big->big_synced = true;
+	err = bt_iso_big_sync(sync, &big->sync_param, &big->big);
+	if (err) {
+		LOG_ERR("big sync failed (err %d)\n", err);
+		big->big_synced = false;
+		return;
+	}
 }
 
 static struct bt_le_per_adv_sync_cb sync_callbacks = {
@@ -259,176 +482,662 @@ static struct bt_le_per_adv_sync_cb sync_callbacks = {
 	.biginfo = biginfo_cb,
 };
 
-static uint8_t read_next_byte(struct net_buf *buf, uint8_t **pos)
+static void seq_pop(struct midi_iso_rx_big *big);
+
+/**
+ * @brief Mark a sequence number as received, when some BISes are not
+ * synced to.
+ *
+ * next is one past the highest sequence number received. Sequence numbers
+ * 32 or more behind it are taken as received before.
+ *
+ * @return false if the message was received before.
+ */
+static bool seq_mark_partial(struct midi_iso_rx_seq *seq, uint8_t num)
+{
+	uint8_t behind = (uint8_t)(seq->next - 1 - num);
+	uint8_t ahead;
+
+	if (!seq->synced || (behind >= 128)) {
+		ahead = seq->synced ? (uint8_t)(num - (seq->next - 1)) : 32;
+		seq->seen = (ahead >= 32) ? 0 : (seq->seen << ahead);
+		seq->seen |= BIT(0);
+		seq->next = num + 1;
+		seq->synced = true;
+		return true;
+	}
+
+	if ((behind >= 32) || (seq->seen & BIT(behind))) {
+		seq->stats.duplicates++;
+		return false;
+	}
+
+	seq->seen |= BIT(behind);
+
+	return true;
+}
+
+/**
+ * @brief Mark the sequence number of a UMP message of a broadcaster as
+ * received.
+ *
+ * Sequence numbers up to half of the sequence space behind the next one
+ * to deliver are taken as received before.
+ *
+ * @return false if the message was received before.
+ */
+static bool seq_mark(struct midi_iso_rx_big *big, uint8_t num)
+{
+	struct midi_iso_rx_seq *seq = &big->seq;
+	uint8_t offset;
+
+	if (seq->partial) {
+		return seq_mark_partial(seq, num);
+	}
+
+	if (!seq->synced) {
+		seq->synced = true;
+		seq->next = num;
+		seq->seen = 0;
+		seq->gap_since = 0;
+	}
+
+	offset = num - seq->next;
+	if (offset >= 128) {
+		seq->stats.duplicates++;
+		return false;
+	}
+
+	/** Give up on the oldest missing sequence numbers to make room */
+	while (offset >= CONFIG_MIDI_ISO_RECEIVER_REORDER_SIZE) {
+		seq_pop(big);
+		offset = num - seq->next;
+	}
+
+	if (seq->seen & BIT(offset)) {
+		seq->stats.duplicates++;
+		return false;
+	}
+
+	if ((offset < 31) && (seq->seen >> (offset + 1))) {
+		seq->stats.reordered++;
+	}
+	seq->seen |= BIT(offset);
+
+	return true;
+}
+
+static int midi_iso_receiver_stats_get(const struct device *dev,
+				       struct midi_stats *stats, bool reset)
+{
+	struct midi_iso_receiver_dev_data *iso_dev_data = dev->data;
+
+	return midi_stats_read(&iso_dev_data->stats, stats, reset);
+}
+
+static void deliver_msg(midi_msg_t *msg)
+{
+	MIDI_TRACE(RECEIVE, msg, msg->len);
+	midi_stats_rx(&iso_dev_data->stats, msg);
+
+	if(iso_dev_data->api->midi_transfer_done)  {
+		iso_dev_data->api->midi_transfer_done(
+				iso_dev_data->dev, msg, iso_dev_data->user_data);
+	} else if (msg->buf) {
+		midi_msg_unref_alt(msg);
+	} else {
+		midi_msg_unref(msg);
+	}
+}
+
+#if MERGE_QUEUE
+struct merge_entry {
+	/** Time of the message, receive time of the SDU plus its offset */
+	int64_t time_us;
+	/** Time the message is delivered at, after the merge window */
+	int64_t due;
+	/** Insertion order, keeps messages with equal time in order */
+	uint32_t seq;
+	midi_msg_t *msg;
+};
+
+static struct merge_entry merge_heap[CONFIG_MIDI_ISO_RECEIVER_MERGE_QUEUE_SIZE];
+
+static size_t merge_len;
+
+static uint32_t merge_seq;
+
+static struct k_spinlock merge_lock;
+
+static K_SEM_DEFINE(merge_sem, 0, 1);
+
+static inline bool merge_entry_before(const struct merge_entry *a,
+				      const struct merge_entry *b)
 {
-	uint8_t byte;
-	uint8_t * byte_ptr = *pos;
-	byte = *(byte_ptr);
-	*pos = byte_ptr + 1;
-	return byte;
+	return (a->time_us < b->time_us) ||
+	       ((a->time_us == b->time_us) && ((int32_t)(a->seq - b->seq) < 0));
 }
 
-static inline uint16_t calculate_timestamp(uint16_t waited_time_sum, uint8_t timestamp)
+/** @return false if the merge queue is full. */
+static bool merge_push(midi_msg_t *msg, int64_t time_us, uint32_t window_us)
 {
-	uint16_t delta;
-	delta = (timestamp * (big_interval*1000)) / 127;
+	k_spinlock_key_t key = k_spin_lock(&merge_lock);
+	struct merge_entry entry = {
+		.time_us = time_us,
+		.due = time_us + window_us,
+		.seq = merge_seq++,
+		.msg = msg,
+	};
+	size_t i = merge_len;
+
+	if (merge_len == ARRAY_SIZE(merge_heap)) {
+		k_spin_unlock(&merge_lock, key);
+		return false;
+	}
+	merge_len++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
 
-	return (uint16_t)delta - waited_time_sum;
+		if (!merge_entry_before(&entry, &merge_heap[parent])) {
+			break;
+		}
+		merge_heap[i] = merge_heap[parent];
+		i = parent;
+	}
+	merge_heap[i] = entry;
+
+	k_spin_unlock(&merge_lock, key);
+
+	if (i == 0) {
+		/** New earliest message, the thread must wake up earlier */
+		k_sem_give(&merge_sem);
+	}
+
+	return true;
 }
 
-static midi_msg_t * parse_chunk(struct net_buf *buf, uint8_t **pos, uint16_t waited_time_sum, uint8_t *end)
-{	
-	uint8_t *msg_start;
-	uint8_t timestamp;
-	uint8_t statusbyte;
-	uint8_t databyte;
-	uint8_t msg_len = 0;
+static struct merge_entry merge_pop(void)
+{
+	struct merge_entry top = merge_heap[0];
+	struct merge_entry last = merge_heap[--merge_len];
+	size_t i = 0;
+
+	for (;;) {
+		size_t child = 2 * i + 1;
 
-	timestamp = read_next_byte(buf, pos);
-	msg_start = *pos;
-	statusbyte = read_next_byte(buf, pos);
-	switch (statusbyte)
-	{
-	case MIDI_SYSEX_START:
-		if (end == NULL)
-		{
-			end = net_buf_tail(buf);
+		if (child >= merge_len) {
+			break;
 		}
-		while (*pos < end)
-		{
-			databyte = read_next_byte(buf, pos);
-			if (databyte == MIDI_SYSEX_END)
-			{
-				break;
-			}
+		if ((child + 1 < merge_len) &&
+		    merge_entry_before(&merge_heap[child + 1], &merge_heap[child])) {
+			child++;
 		}
-		msg_len = *pos - msg_start;
-		
-		break;
-	
-	default:
-		break;
-	}
-	
-	return midi_msg_init(buf, msg_start, msg_len, MIDI_FORMAT_1_0_PARSED_DELTA_US,
-						NULL, calculate_timestamp(waited_time_sum, (127 & timestamp)), 
-						0, 0, 0);
-}
-
-static midi_msg_t * parse_ump(struct net_buf *buf, uint8_t **pos, uint16_t waited_time_sum, uint8_t muid)
-{
-	uint8_t *msg_start;
-	uint8_t timestamp;
-	uint8_t msg_num;
-	uint8_t ack_channel;
-	uint8_t message_type;
-
-	timestamp = read_next_byte(buf, pos);
-	msg_num = read_next_byte(buf, pos);
-	ack_channel = read_next_byte(buf, pos);
-	msg_start = *pos;
-	message_type = read_next_byte(buf, pos);
-
-	if ((message_type >> 4) == MIDI_UMP_MSG_MIDI_1_0_CHANNEL_VOICE) {
-		*pos += 3;
-		if (muid == (muid_subscribe & 0xFF))
-		{
-			return midi_msg_init(buf, msg_start, 4, MIDI_FORMAT_2_0_UMP,
-							NULL, calculate_timestamp(waited_time_sum, (127 & timestamp)),
-							0, msg_num, ack_channel);
+		if (!merge_entry_before(&merge_heap[child], &last)) {
+			break;
 		}
+		merge_heap[i] = merge_heap[child];
+		i = child;
 	}
+	merge_heap[i] = last;
 
-	return NULL;
+	return top;
+}
+
+/**
+ * Messages of all BISes are held for one ISO interval and delivered in
+ * order of their time, so the BISes and BIGs, received at different
+ * times in the interval, make one ordered input stream. With
+ * CONFIG_MIDI_ISO_RECEIVER_PLAYOUT each is held until its playout time.
+ */
+static void merge_thread_fn(void *p1, void *p2, void *p3)
+{
+	struct merge_entry entry;
+	k_spinlock_key_t key;
+	int64_t due;
+
+	for (;;) {
+		key = k_spin_lock(&merge_lock);
+		if (merge_len == 0) {
+			k_spin_unlock(&merge_lock, key);
+			k_sem_take(&merge_sem, K_FOREVER);
+			continue;
+		}
+
+		due = merge_heap[0].due;
+		if (due > midi_time_now_us()) {
+			k_spin_unlock(&merge_lock, key);
+			k_sem_take(&merge_sem, midi_time_abs_timeout(due));
+			continue;
+		}
+
+		entry = merge_pop();
+		k_spin_unlock(&merge_lock, key);
+
+		deliver_msg(entry.msg);
+	}
+}
+
+K_THREAD_DEFINE(midi_iso_merge_thread, CONFIG_MIDI_ISO_RECEIVER_THREAD_STACK_SIZE,
+		merge_thread_fn, NULL, NULL, NULL, 7, 0, 0);
+#endif
+
+static void receive_msg(struct midi_iso_rx_big *big, midi_msg_t *msg, int64_t time_us)
+{
+#if defined(CONFIG_MIDI_ISO_RECEIVER_PLAYOUT)
+	/** The message is played when it is delivered */
+	msg->timestamp = 0;
+	time_us += CONFIG_MIDI_ISO_RECEIVER_PLAYOUT_DELAY_US;
+	if (time_us < midi_time_now_us()) {
+		big->seq.stats.late++;
+	}
+
+	if (merge_push(msg, time_us, 0)) {
+		return;
+	}
+	LOG_WRN("ISO MIDI merge queue full");
+#elif MERGE_BISES
+	if (merge_push(msg, time_us, big->interval_us)) {
+		return;
+	}
+	LOG_WRN("ISO MIDI merge queue full");
+#endif
+
+	deliver_msg(msg);
+}
+
+/** @brief Move past the next sequence number, delivering its message. */
+static void seq_pop(struct midi_iso_rx_big *big)
+{
+	struct midi_iso_rx_seq *seq = &big->seq;
+	size_t slot = seq->next & REORDER_MASK;
+
+	if (!(seq->seen & 1) && (seq->next != PAYLOAD_MSG_NUM_NONE)) {
+		seq->stats.gaps++;
+	}
+
+	if (seq->held[slot]) {
+		receive_msg(big, seq->held[slot], seq->held_time[slot]);
+		seq->held[slot] = NULL;
+	}
+
+	seq->seen >>= 1;
+	seq->next++;
+}
+
+/** @brief Deliver the messages up to the next missing sequence number. */
+static void seq_advance(struct midi_iso_rx_big *big, int64_t now)
+{
+	struct midi_iso_rx_seq *seq = &big->seq;
+
+	if (seq->partial) {
+		return;
+	}
+
+	/** The sequence number of messages without retransmission is never sent */
+	while ((seq->seen & 1) || (seq->next == PAYLOAD_MSG_NUM_NONE)) {
+		seq_pop(big);
+	}
+
+	if (!seq->seen) {
+		seq->gap_since = 0;
+	} else if (!seq->gap_since) {
+		seq->gap_since = now;
+	}
+}
+
+/**
+ * @brief Deliver a UMP message in order of its sequence number.
+ *
+ * The message is held while sequence numbers before it are missing.
+ */
+static void seq_receive(struct midi_iso_rx_big *big, midi_msg_t *msg, int64_t time_us,
+			int64_t now)
+{
+	struct midi_iso_rx_seq *seq = &big->seq;
+	size_t slot = msg->num & REORDER_MASK;
+
+	if ((msg->num == PAYLOAD_MSG_NUM_NONE) || seq->partial) {
+		receive_msg(big, msg, time_us);
+		return;
+	}
+
+	seq->held[slot] = msg;
+	seq->held_time[slot] = time_us;
+	seq_advance(big, now);
+}
+
+/** @brief Skip sequence numbers missing for longer than the reorder wait. */
+static void seq_flush(struct midi_iso_rx_big *big, int64_t now)
+{
+	struct midi_iso_rx_seq *seq = &big->seq;
+	int64_t wait = (int64_t)CONFIG_MIDI_ISO_RECEIVER_REORDER_INTERVALS * big->interval_us;
+
+	if (seq->partial || !seq->seen || ((now - seq->gap_since) < wait)) {
+		return;
+	}
+
+	while (!(seq->seen & 1)) {
+		seq_pop(big);
+	}
+	seq->gap_since = 0;
+	seq_advance(big, now);
+}
+
+/** @brief Forget the sequence numbers of a broadcaster that was lost. */
+static void seq_reset(struct midi_iso_rx_big *big)
+{
+	struct midi_iso_rx_seq *seq = &big->seq;
+
+	for (size_t i = 0; i < ARRAY_SIZE(seq->held); i++) {
+		if (seq->held[i]) {
+			midi_msg_unref_alt(seq->held[i]);
+			seq->held[i] = NULL;
+		}
+	}
+	seq->synced = false;
+	seq->seen = 0;
+	seq->gap_since = 0;
+}
+
+/** @brief Count the SDU, and SDUs missing before it, of a BIS. */
+static void bis_count_sdu(struct midi_iso_rx_bis *bis, const struct bt_iso_recv_info *info)
+{
+	struct midi_iso_bis_stats *stats = &bis->stats;
+	int lock = irq_lock();
+
+	if (stats->sdus || stats->lost || stats->invalid) {
+		stats->lost += (uint16_t)(info->seq_num - stats->last_seq - 1);
+	}
+	stats->last_seq = info->seq_num;
+
+	if (info->flags & BT_ISO_FLAGS_VALID) {
+		stats->sdus++;
+	} else {
+		stats->invalid++;
+	}
+
+	irq_unlock(lock);
+}
+
+/**
+ * @brief Mark an SDU of a BIS as received.
+ *
+ * @return false if the SDU was received or recovered before, or is too
+ * old to tell.
+ */
+static bool bis_sdu_mark(struct midi_iso_rx_bis *bis, uint16_t seq)
+{
+	int16_t behind = (int16_t)(bis->fec_seq - seq);
+
+	/** SDUs before the first one received are not recovered */
+	if (!bis->fec_seen) {
+		bis->fec_seq = seq;
+		bis->fec_seen = UINT32_MAX;
+		return true;
+	}
+
+	if (behind < 0) {
+		bis->fec_seen = (-behind < 32) ? (bis->fec_seen << -behind) : 0;
+		bis->fec_seq = seq;
+		behind = 0;
+	}
+
+	if ((behind >= 32) || (bis->fec_seen & BIT(behind))) {
+		return false;
+	}
+	bis->fec_seen |= BIT(behind);
+
+	return true;
+}
+
+#if defined(CONFIG_MIDI_ISO_RECEIVER_SNAPSHOT)
+/**
+ * @brief Check if a snapshot piece is applied by a BIS.
+ *
+ * A BIS applies one snapshot, from its first piece to its last. If a
+ * piece is lost, the next snapshot is applied from its start.
+ */
+static bool snapshot_accept(struct midi_iso_rx_bis *bis, uint8_t piece, uint8_t flags)
+{
+	if (bis->snapshot_state == SNAPSHOT_DONE) {
+		return false;
+	}
+
+	if ((bis->snapshot_state == SNAPSHOT_APPLY) && (piece != bis->snapshot_next)) {
+		bis->snapshot_state = SNAPSHOT_WAIT;
+	}
+
+	if (bis->snapshot_state == SNAPSHOT_WAIT) {
+		if (piece != 0) {
+			return false;
+		}
+		bis->snapshot_state = SNAPSHOT_APPLY;
+	}
+
+	bis->snapshot_next = piece + 1;
+	if (flags & PAYLOAD_SNAPSHOT_LAST) {
+		int lock = irq_lock();
+
+		bis->snapshot_state = SNAPSHOT_DONE;
+		bis->stats.snapshots++;
+		irq_unlock(lock);
+	}
+
+	return true;
+}
+#endif
+
+/** @brief A payload of a BIS being parsed. */
+struct payload_rx {
+	struct midi_iso_rx_bis *bis;
+	const struct bt_iso_recv_info *info;
+};
+
+static void payload_msg(midi_msg_t *msg, int64_t time_us, void *user_data)
+{
+	struct payload_rx *rx = user_data;
+
+	if (msg->format == MIDI_FORMAT_2_0_UMP) {
+		seq_receive(rx->bis->big, msg, time_us, midi_time_now_us());
+	} else {
+		receive_msg(rx->bis->big, msg, time_us);
+	}
+}
+
+/**
+ * @brief Check if a UMP message of a payload is delivered.
+ *
+ * Messages to other MUIDs and messages received before only count for
+ * their sequence numbers.
+ */
+static bool payload_ump_filter(const struct midi_iso_payload_ump *ump, void *user_data)
+{
+	struct payload_rx *rx = user_data;
+	struct midi_iso_rx_big *big = rx->bis->big;
+	bool ours = (ump->muid == (muid_subscribe & 0xFF));
+
+	if ((ump->num != PAYLOAD_MSG_NUM_NONE) && !seq_mark(big, ump->num)) {
+		/** The ACK of the first copy was lost if it is resent */
+		if (ours && (ump->ack_channel != 0xFF) && ack_cb) {
+			ack_cb(ump->num, ump->ack_channel);
+		}
+		return false;
+	}
+
+	if (!ours || ((ump->type >> 4) != MIDI_UMP_MSG_MIDI_1_0_CHANNEL_VOICE)) {
+		if (ours) {
+			midi_stats_drop(&iso_dev_data->stats, MIDI_STATS_DROP_PARSE);
+		}
+		if (ump->num != PAYLOAD_MSG_NUM_NONE) {
+			seq_advance(big, midi_time_now_us());
+		}
+		return false;
+	}
+
+	return true;
+}
+
+/** @brief Check if a copy of an earlier payload is parsed, if it was lost. */
+static bool payload_fec(uint8_t age, void *user_data)
+{
+	struct payload_rx *rx = user_data;
+	int lock;
+
+	if (!bis_sdu_mark(rx->bis, rx->info->seq_num - age)) {
+		return false;
+	}
+
+	lock = irq_lock();
+	rx->bis->stats.recovered++;
+	irq_unlock(lock);
+
+	return true;
+}
+
+#if defined(CONFIG_MIDI_ISO_RECEIVER_SNAPSHOT)
+static bool payload_snapshot(uint8_t piece, uint8_t flags, void *user_data)
+{
+	struct payload_rx *rx = user_data;
+
+	return snapshot_accept(rx->bis, piece, flags);
+}
+#endif
+
+static void payload_malformed(void *user_data)
+{
+	midi_stats_drop(&iso_dev_data->stats, MIDI_STATS_DROP_PARSE);
+}
+
+/**
+ * @brief Parse a payload of a BIS.
+ *
+ * @param recv_time Time the payload was received at.
+ */
+static void parse_payload(struct midi_iso_rx_bis *bis, const struct bt_iso_recv_info *info,
+			  struct net_buf *buf, int64_t recv_time)
+{
+	struct payload_rx rx = {
+		.bis = bis,
+		.info = info,
+	};
+	const struct midi_iso_payload_parser parser = {
+		.interval_us = bis->big->interval_us,
+		.msg_cb = payload_msg,
+		.ump_filter = payload_ump_filter,
+		.fec_cb = payload_fec,
+#if defined(CONFIG_MIDI_ISO_RECEIVER_SNAPSHOT)
+		.snapshot_cb = payload_snapshot,
+#endif
+		.malformed_cb = payload_malformed,
+		.user_data = &rx,
+	};
+
+	midi_iso_payload_parse(&parser, buf, buf->data, net_buf_tail(buf), recv_time);
+}
+
+/**
+ * @brief Get the MIDI time of the SDU reference of a BIG.
+ *
+ * The controller gives the SDU reference in its own clock, the same air
+ * event on every receiver. The offset to the MIDI time is the smallest
+ * difference to the receive time seen, as the receive time only ever
+ * comes later. It is raised slowly towards later differences to follow
+ * the drift between the clocks.
+ *
+ * @return The receive time if the controller gives no SDU reference.
+ */
+static int64_t big_anchor(struct midi_iso_rx_big *big, const struct bt_iso_recv_info *info,
+			  int64_t recv_time)
+{
+	int64_t offset;
+
+	if (!(info->flags & BT_ISO_FLAGS_TS)) {
+		return recv_time;
+	}
+
+	/** The controller time wraps every 32 bits of microseconds */
+	big->ts += (uint32_t)(info->ts - (uint32_t)big->ts);
+	offset = recv_time - big->ts;
+
+	if (!big->ts_valid || (offset < big->ts_offset)) {
+		big->ts_offset = offset;
+		big->ts_valid = true;
+	} else {
+		big->ts_offset += (offset - big->ts_offset) >> TS_OFFSET_SHIFT;
+	}
+
+	return big->ts + big->ts_offset;
 }
 
 static void iso_recv(struct bt_iso_chan *chan, const struct bt_iso_recv_info *info,
 		struct net_buf *buf)
 {
-	uint8_t *buf_tail;
-	uint8_t *chunk_tail;
-	uint8_t *pos;
-
-    uint8_t chunk_len;
-	uint16_t waited_time_sum = 0;
-    midi_msg_t * parsed_msg;
-	uint8_t muid;
-	uint8_t current_msg_num = 0;
-	bool ump_received = false; 
-	
-	if (buf->len > 1) {
-		LOG_HEXDUMP_INF(buf->data, buf->len, "ISO PDU");
-
-		buf_tail = net_buf_tail(buf) - 1;
-		pos = buf->data;
-		while(pos < buf_tail) {
-			muid = read_next_byte(buf, &pos);
-
-			if (muid == 0xFF) {
-				chunk_len = read_next_byte(buf, &pos);
-				pos += 2;
-				chunk_tail = pos + chunk_len;
-
-				while (pos < chunk_tail)
-				{
-					parsed_msg = parse_chunk(buf, &pos, waited_time_sum, chunk_tail);
-					if (parsed_msg) {
-
-						waited_time_sum += parsed_msg->timestamp;
-						
-						if(iso_dev_data->api->midi_transfer_done)  {
-							iso_dev_data->api->midi_transfer_done(
-									iso_dev_data->dev, parsed_msg, iso_dev_data->user_data);
-						} else {
-							midi_msg_unref(parsed_msg);
-						}
-					}
-				}
-			} else {
-				parsed_msg = parse_ump(buf, &pos, waited_time_sum, muid);
-				if (parsed_msg) {
-					waited_time_sum += (parsed_msg->timestamp);
-					if ((parsed_msg->num == previous_msg_num) || (parsed_msg->num == previous_msg_num - 1))
-					{
-						LOG_INF("Received duplicate message. Discarding.");
-						parsed_msg->timestamp = 0xFF;
-					} else {
-						ump_received = true;
-						current_msg_num = parsed_msg->num;
-					}
-					
-
-					if(iso_dev_data->api->midi_transfer_done)  {
-						iso_dev_data->api->midi_transfer_done(
-								iso_dev_data->dev, parsed_msg, iso_dev_data->user_data);
-					} else {
-						midi_msg_unref_alt(parsed_msg);
-					}
-				}
-			}
-		}
+	struct midi_iso_rx_bis *bis = CONTAINER_OF(chan, struct midi_iso_rx_bis, chan);
+	int64_t recv_time = midi_time_now_us();
+	int64_t sdu_time = recv_time;
+
+	if (IS_ENABLED(CONFIG_MIDI_ISO_RECEIVER_PLAYOUT)) {
+		sdu_time = big_anchor(bis->big, info, recv_time);
+	}
+
+	bis_count_sdu(bis, info);
+	if (!(info->flags & BT_ISO_FLAGS_VALID)) {
+		seq_flush(bis->big, recv_time);
+		return;
 	}
 
-	if (ump_received) 
-	{	
-		previous_msg_num = current_msg_num;
+	bis_sdu_mark(bis, info->seq_num);
+
+	if (buf->len > 1) {
+		LOG_HEXDUMP_DBG(buf->data, buf->len, "ISO PDU");
+
+		parse_payload(bis, info, buf, sdu_time);
 	}
-	previous_seq_num = info->seq_num;
-	iso_recv_count++;
+
+	seq_flush(bis->big, recv_time);
 }
 
 static void iso_connected(struct bt_iso_chan *chan)
 {
+	struct midi_iso_rx_bis *bis = CONTAINER_OF(chan, struct midi_iso_rx_bis, chan);
+
 	LOG_INF("ISO Channel %p connected\n", chan);
+
+	bis->fec_seen = 0;
+#if defined(CONFIG_MIDI_ISO_RECEIVER_SNAPSHOT)
+	bis->snapshot_state = SNAPSHOT_WAIT;
+#endif
+	memset(&bis->stats, 0, sizeof(bis->stats));
+	bis->stats.synced = true;
 }
 
 static void iso_disconnected(struct bt_iso_chan *chan, uint8_t reason)
 {
+	struct midi_iso_rx_bis *bis = CONTAINER_OF(chan, struct midi_iso_rx_bis, chan);
+	struct midi_iso_rx_big *big = bis->big;
+
 	LOG_INF("ISO Channel %p disconnected with reason 0x%02x\n",
 	       chan, reason);
 
-	if (reason != BT_HCI_ERR_OP_CANCELLED_BY_HOST) {
+	bis->stats.synced = false;
+
+	for (size_t i = 0; i < NUM_SYNC_BIS; i++) {
+		if (big->bis[i].stats.synced) {
+			return;
+		}
 	}
+
+	/** All BISes of the BIG are lost, look for a broadcaster again */
+	seq_reset(big);
+	big->ts_valid = false;
+	if (big->sync) {
+		bt_le_per_adv_sync_delete(big->sync);
+	}
+	big->sync = NULL;
+	big->big = NULL;
+	big->big_synced = false;
+	scan_resume();
 }
 
 static struct bt_iso_chan_ops iso_ops = {
@@ -437,29 +1146,6 @@ static struct bt_iso_chan_ops iso_ops = {
 	.disconnected	= iso_disconnected,
 };
 
-static struct bt_iso_chan_io_qos iso_rx_qos[1];
-
-static struct bt_iso_chan_qos bis_iso_qos[] = {
-	{ .rx = &iso_rx_qos[0], },
-};
-
-static struct bt_iso_chan bis_iso_chan[] = {
-	{ .ops = &iso_ops,
-	  .qos = &bis_iso_qos[0], },
-};
-
-static struct bt_iso_chan *bis[] = {
-	&bis_iso_chan[0],
-};
-
-static struct bt_iso_big_sync_param big_sync_param = {
-	.bis_channels = bis,
-	.num_bis = 1,
-	.bis_bitfield = (BIT_MASK(1) << 1),
-	.mse = 1,
-	.sync_timeout = 100, /* in 10 ms units */
-};
-
 static int midi_iso_receiver_device_init(const struct device *dev)
 {
 	int err;
@@ -469,6 +1155,28 @@ static int midi_iso_receiver_device_init(const struct device *dev)
 	iso_dev_data->dev = dev;
 	iso_dev_data->api = (struct midi_api*)dev->api;
 
+	for (size_t i = 0; i < MAX_BIGS; i++) {
+		struct midi_iso_rx_big *big = &bigs[i];
+
+		for (size_t j = 0; j < NUM_SYNC_BIS; j++) {
+			if ((sync_bises[j] < BT_ISO_BIS_INDEX_MIN) ||
+			    (sync_bises[j] > BT_ISO_BIS_INDEX_MAX)) {
+				LOG_ERR("BIS %d out of range", sync_bises[j]);
+				return -EINVAL;
+			}
+
+			big->bis[j].big = big;
+			big->bis[j].number = sync_bises[j];
+			big->bis[j].qos.rx = &big->bis[j].rx_qos;
+			big->bis[j].chan.qos = &big->bis[j].qos;
+			big->bis[j].chan.ops = &iso_ops;
+		}
+
+		big->sync_param.bis_channels = big->chans;
+		big->sync_param.mse = 1;
+		big->sync_param.sync_timeout = 100; /* in 10 ms units */
+	}
+
     /* Initialize the Bluetooth Subsystem */
 	err = bt_enable(NULL);
 	if (err) {
@@ -478,10 +1186,6 @@ static int midi_iso_receiver_device_init(const struct device *dev)
 
 	bt_le_scan_cb_register(&scan_callbacks);
 	bt_le_per_adv_sync_cb_register(&sync_callbacks);
-	
-    per_adv_lost = false;
-    per_adv_found = false;
-    big_synced = false;
 
     return err;
 }
@@ -492,6 +1196,7 @@ static int midi_iso_receiver_device_init(const struct device *dev)
 #define DEFINE_MIDI_RECEIVER_DEVICE(dev)					  			\
 	static struct midi_api midi_iso_receiver_api_##dev = {			\
 		.midi_callback_set = midi_iso_receiver_port_callback_set,	\
+		.midi_stats_get = midi_iso_receiver_stats_get,				\
 	};															\
 	DEVICE_DT_DEFINE(MIDI_ISO_RECEIVER_DEV_N_ID(dev),			  			\
 			    &midi_iso_receiver_device_init,			  			\
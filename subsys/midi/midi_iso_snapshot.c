@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI ISO state snapshot
+ *
+ * An entry is keyed by its channel, the UMP group and MUID byte for UMP
+ * messages, the kind of message and, for notes and controllers, the note
+ * or controller number. Notes are kept as their note on. Messages that
+ * set the default state, like a note off or a centered pitch bend, free
+ * the entry instead.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+
+#include "midi/midi.h"
+#include "midi/midi_ump.h"
+#include "midi/midi_iso_snapshot.h"
+
+/** Controllers of channel mode messages */
+#define CC_ALL_SOUND_OFF 120
+#define CC_RESET_ALL_CONTROLLERS 121
+#define CC_LOCAL_CONTROL 122
+#define CC_ALL_NOTES_OFF 123
+
+/** System reset, clears the state of MIDI 1.0 messages */
+#define MIDI_SYSTEM_RESET 0xFF
+
+/** Kinds of messages in the order they are walked */
+static const uint8_t walk_ops[] = {
+	MIDI_OP_CONTROL_CHANGE,
+	MIDI_OP_PROGRAM_CHANGE,
+	MIDI_OP_PITCH_BEND,
+	MIDI_OP_CHANNEL_PRESSURE,
+	MIDI_OP_NOTE_ON,
+};
+
+/** @brief Status byte of an entry. */
+static inline uint8_t entry_status(const struct midi_iso_snapshot_entry *entry)
+{
+	return entry->data[entry->ump ? 1 : 0];
+}
+
+/** @brief First data byte of an entry. */
+static inline uint8_t entry_key(const struct midi_iso_snapshot_entry *entry)
+{
+	return entry->data[entry->ump ? 2 : 1];
+}
+
+static inline bool entry_used(const struct midi_iso_snapshot_entry *entry)
+{
+	return entry->data[0] != 0;
+}
+
+/**
+ * @brief Check if an entry holds a kind of state of the channel of a
+ * message, and with @p by_key of its note or controller.
+ */
+static bool entry_matches(const struct midi_iso_snapshot_entry *entry,
+			  const struct midi_iso_snapshot_entry *msg, uint8_t op, bool by_key)
+{
+	if (!entry_used(entry) || (entry->ump != msg->ump)) {
+		return false;
+	}
+
+	if (entry->ump && ((entry->muid != msg->muid) ||
+			   ((entry->data[0] & 0x0F) != (msg->data[0] & 0x0F)))) {
+		return false;
+	}
+
+	if (((entry_status(entry) >> 4) != op) ||
+	    ((entry_status(entry) & 0x0F) != (entry_status(msg) & 0x0F))) {
+		return false;
+	}
+
+	return !by_key || (entry_key(entry) == entry_key(msg));
+}
+
+/** @brief Keep a message as the state it sets, over the entry it replaces. */
+static void state_set(struct midi_iso_snapshot *snapshot,
+		      const struct midi_iso_snapshot_entry *msg, bool by_key)
+{
+	struct midi_iso_snapshot_entry *free_entry = NULL;
+	uint8_t op = entry_status(msg) >> 4;
+
+	for (size_t i = 0; i < ARRAY_SIZE(snapshot->entries); i++) {
+		if (entry_matches(&snapshot->entries[i], msg, op, by_key)) {
+			snapshot->entries[i] = *msg;
+			return;
+		}
+		if (!free_entry && !entry_used(&snapshot->entries[i])) {
+			free_entry = &snapshot->entries[i];
+		}
+	}
+
+	if (!free_entry) {
+		snapshot->dropped++;
+		return;
+	}
+
+	*free_entry = *msg;
+}
+
+/** @brief Free the entries of a kind of state of the channel of a message. */
+static void state_clear(struct midi_iso_snapshot *snapshot,
+			const struct midi_iso_snapshot_entry *msg, uint8_t op, bool by_key)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(snapshot->entries); i++) {
+		if (entry_matches(&snapshot->entries[i], msg, op, by_key)) {
+			memset(&snapshot->entries[i], 0, sizeof(snapshot->entries[i]));
+		}
+	}
+}
+
+/** @brief Update the state of a channel message. */
+static void state_update(struct midi_iso_snapshot *snapshot,
+			 const struct midi_iso_snapshot_entry *msg)
+{
+	uint8_t status = entry_status(msg);
+	uint8_t key = entry_key(msg);
+	uint8_t value = msg->data[msg->ump ? 3 : 2];
+
+	switch (status >> 4) {
+	case MIDI_OP_NOTE_ON:
+		if (value) {
+			state_set(snapshot, msg, true);
+		} else {
+			state_clear(snapshot, msg, MIDI_OP_NOTE_ON, true);
+		}
+		break;
+
+	case MIDI_OP_NOTE_OFF:
+		state_clear(snapshot, msg, MIDI_OP_NOTE_ON, true);
+		break;
+
+	case MIDI_OP_CONTROL_CHANGE:
+		if (key == CC_RESET_ALL_CONTROLLERS) {
+			state_clear(snapshot, msg, MIDI_OP_CONTROL_CHANGE, false);
+			state_clear(snapshot, msg, MIDI_OP_PITCH_BEND, false);
+			state_clear(snapshot, msg, MIDI_OP_CHANNEL_PRESSURE, false);
+			break;
+		}
+		/** Mode messages other than local control end the held notes */
+		if ((key >= CC_ALL_SOUND_OFF) && (key != CC_LOCAL_CONTROL)) {
+			state_clear(snapshot, msg, MIDI_OP_NOTE_ON, false);
+		}
+		if ((key == CC_ALL_SOUND_OFF) || (key == CC_ALL_NOTES_OFF)) {
+			break;
+		}
+		state_set(snapshot, msg, true);
+		break;
+
+	case MIDI_OP_PROGRAM_CHANGE:
+		state_set(snapshot, msg, false);
+		break;
+
+	case MIDI_OP_CHANNEL_PRESSURE:
+		if (key) {
+			state_set(snapshot, msg, false);
+		} else {
+			state_clear(snapshot, msg, MIDI_OP_CHANNEL_PRESSURE, false);
+		}
+		break;
+
+	case MIDI_OP_PITCH_BEND:
+		if ((key == 0x00) && (value == 0x40)) {
+			state_clear(snapshot, msg, MIDI_OP_PITCH_BEND, false);
+		} else {
+			state_set(snapshot, msg, false);
+		}
+		break;
+
+	default:
+		/** Polyphonic pressure ends with its note */
+		break;
+	}
+}
+
+void midi_iso_snapshot_init(struct midi_iso_snapshot *snapshot)
+{
+	memset(snapshot, 0, sizeof(*snapshot));
+}
+
+void midi_iso_snapshot_update(struct midi_iso_snapshot *snapshot, const midi_msg_t *msg)
+{
+	struct midi_iso_snapshot_entry entry = {0};
+
+	if (!msg || !msg->data || (msg->len == 0)) {
+		return;
+	}
+
+	if (msg->format == MIDI_FORMAT_2_0_UMP) {
+		if ((msg->len < 4) ||
+		    ((msg->data[0] >> 4) != MIDI_UMP_MSG_MIDI_1_0_CHANNEL_VOICE)) {
+			return;
+		}
+		memcpy(entry.data, msg->data, 4);
+		entry.muid = *(uint8_t *)msg->context;
+		entry.ump = true;
+	} else if (msg->format == MIDI_FORMAT_1_0_PARSED) {
+		if (msg->data[0] == MIDI_SYSTEM_RESET) {
+			for (size_t i = 0; i < ARRAY_SIZE(snapshot->entries); i++) {
+				if (!snapshot->entries[i].ump) {
+					memset(&snapshot->entries[i], 0, sizeof(snapshot->entries[i]));
+				}
+			}
+			return;
+		}
+		if ((msg->data[0] < 0x80) || (msg->data[0] >= 0xF0)) {
+			return;
+		}
+		memcpy(entry.data, msg->data, MIN(msg->len, 3));
+	} else {
+		return;
+	}
+
+	state_update(snapshot, &entry);
+}
+
+const struct midi_iso_snapshot_entry *
+midi_iso_snapshot_peek(struct midi_iso_snapshot *snapshot,
+		       struct midi_iso_snapshot_cursor *cursor)
+{
+	const struct midi_iso_snapshot_entry *entry;
+
+	for (; cursor->pass < ARRAY_SIZE(walk_ops); cursor->pass++, cursor->index = 0) {
+		for (; cursor->index < ARRAY_SIZE(snapshot->entries); cursor->index++) {
+			entry = &snapshot->entries[cursor->index];
+			if (entry_used(entry) && ((entry_status(entry) >> 4) == walk_ops[cursor->pass])) {
+				return entry;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+void midi_iso_snapshot_next(struct midi_iso_snapshot_cursor *cursor)
+{
+	cursor->index++;
+}
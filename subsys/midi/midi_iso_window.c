@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI ISO retransmit window
+ *
+ * The window holds the sequence numbers from tail up to head. A sequence
+ * number maps to the entry with its low bits, so the window may not span
+ * more than half of the 8-bit sequence space. Messages leaving the window
+ * are collected under the lock and handed to the done callback after it.
+ */
+#include <zephyr/kernel.h>
+#include <string.h>
+
+#include "midi_iso_internal.h"
+#include "midi/midi.h"
+#include "midi/midi_iso_window.h"
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_iso_window
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#define WINDOW_MASK (CONFIG_MIDI_ISO_WINDOW_SIZE - 1)
+
+/** All receivers in use */
+#define RECEIVERS_FULL (CONFIG_MIDI_ISO_WINDOW_MAX_RECEIVERS == 32 ? UINT32_MAX : \
+			BIT_MASK(CONFIG_MIDI_ISO_WINDOW_MAX_RECEIVERS))
+
+/** Messages handed to the done callback per pass of receiver_remove() */
+#define REMOVE_BATCH 8
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_MIDI_ISO_WINDOW_SIZE),
+	     "window size must be a power of two");
+BUILD_ASSERT(CONFIG_MIDI_ISO_WINDOW_SIZE <= 128,
+	     "window may span at most half of the sequence numbers");
+BUILD_ASSERT(CONFIG_MIDI_ISO_WINDOW_MAX_RECEIVERS <= 32,
+	     "pending is a bitmask of the receivers");
+
+static inline struct midi_iso_window_entry *entry_of(struct midi_iso_window *window,
+						     uint8_t seq)
+{
+	return &window->entries[seq & WINDOW_MASK];
+}
+
+static inline bool in_window(struct midi_iso_window *window, uint8_t seq)
+{
+	return (uint8_t)(seq - window->tail) < (uint8_t)(window->head - window->tail);
+}
+
+/** Move tail past messages that have left the window. */
+static void advance_tail(struct midi_iso_window *window)
+{
+	while ((window->tail != window->head) && !entry_of(window, window->tail)->msg) {
+		window->tail++;
+	}
+}
+
+void midi_iso_window_init(struct midi_iso_window *window, midi_iso_window_done_t done)
+{
+	memset(window, 0, sizeof(*window));
+	window->done = done;
+}
+
+int midi_iso_window_add(struct midi_iso_window *window, midi_msg_t *msg, uint8_t muid)
+{
+	struct midi_iso_window_entry *entry;
+	midi_msg_t *evicted[2];
+	size_t num_evicted = 0;
+	uint8_t receiver;
+	k_spinlock_key_t key = k_spin_lock(&window->lock);
+
+	receiver = window->receiver_of[muid];
+	if (receiver == 0) {
+		if (window->receivers == RECEIVERS_FULL) {
+			k_spin_unlock(&window->lock, key);
+			return -ENOMEM;
+		}
+		receiver = find_lsb_set(~window->receivers);
+		window->receivers |= BIT(receiver - 1);
+		window->receiver_of[muid] = receiver;
+	}
+	receiver--;
+
+	/** The sequence number marking messages without retransmission is skipped */
+	if (window->head == PAYLOAD_MSG_NUM_NONE) {
+		window->head++;
+	}
+
+	while ((uint8_t)(window->head - window->tail) >= CONFIG_MIDI_ISO_WINDOW_SIZE) {
+		entry = entry_of(window, window->tail);
+		if (entry->msg) {
+			evicted[num_evicted++] = entry->msg;
+			entry->msg = NULL;
+		}
+		window->tail++;
+		advance_tail(window);
+	}
+
+	entry = entry_of(window, window->head);
+	entry->msg = msg;
+	entry->pending = BIT(receiver);
+	entry->sent_in = window->interval;
+	msg->num = window->head++;
+
+	k_spin_unlock(&window->lock, key);
+
+	for (size_t i = 0; i < num_evicted; i++) {
+		window->done(evicted[i], false);
+	}
+
+	return receiver;
+}
+
+int midi_iso_window_ack(struct midi_iso_window *window, uint8_t muid, uint8_t seq,
+			uint32_t bitmap)
+{
+	struct midi_iso_window_entry *entry;
+	midi_msg_t *acked[32];
+	size_t num_acked = 0;
+	uint32_t receiver_bit;
+	uint8_t acked_seq;
+	k_spinlock_key_t key = k_spin_lock(&window->lock);
+
+	if (window->receiver_of[muid] == 0) {
+		k_spin_unlock(&window->lock, key);
+		return 0;
+	}
+	receiver_bit = BIT(window->receiver_of[muid] - 1);
+
+	while (bitmap) {
+		acked_seq = seq + find_lsb_set(bitmap) - 1;
+		bitmap &= bitmap - 1;
+
+		if (!in_window(window, acked_seq)) {
+			continue;
+		}
+
+		entry = entry_of(window, acked_seq);
+		if (!entry->msg || !(entry->pending & receiver_bit)) {
+			continue;
+		}
+
+		entry->pending &= ~receiver_bit;
+		if (!entry->pending) {
+			acked[num_acked++] = entry->msg;
+			entry->msg = NULL;
+		}
+	}
+	advance_tail(window);
+
+	k_spin_unlock(&window->lock, key);
+
+	for (size_t i = 0; i < num_acked; i++) {
+		window->done(acked[i], true);
+	}
+
+	return num_acked;
+}
+
+void midi_iso_window_tick(struct midi_iso_window *window)
+{
+	k_spinlock_key_t key = k_spin_lock(&window->lock);
+
+	window->interval++;
+	k_spin_unlock(&window->lock, key);
+}
+
+size_t midi_iso_window_resend(struct midi_iso_window *window, midi_msg_t **msgs, size_t max)
+{
+	struct midi_iso_window_entry *entry;
+	size_t count = 0;
+	k_spinlock_key_t key = k_spin_lock(&window->lock);
+
+	for (uint8_t seq = window->tail; (seq != window->head) && (count < max); seq++) {
+		entry = entry_of(window, seq);
+		if (!entry->msg || ((uint8_t)(window->interval - entry->sent_in) <
+				    CONFIG_MIDI_ISO_WINDOW_RESEND_INTERVALS)) {
+			continue;
+		}
+		entry->sent_in = window->interval;
+		msgs[count++] = midi_msg_ref(entry->msg);
+	}
+
+	k_spin_unlock(&window->lock, key);
+
+	return count;
+}
+
+int midi_iso_window_receiver(struct midi_iso_window *window, uint8_t muid)
+{
+	uint8_t receiver = window->receiver_of[muid];
+
+	return receiver ? (receiver - 1) : -ENOENT;
+}
+
+void midi_iso_window_receiver_remove(struct midi_iso_window *window, uint8_t muid)
+{
+	struct midi_iso_window_entry *entry;
+	midi_msg_t *acked[REMOVE_BATCH];
+	size_t num_acked;
+	uint32_t receiver_bit;
+	k_spinlock_key_t key;
+
+	do {
+		num_acked = 0;
+		key = k_spin_lock(&window->lock);
+
+		if (window->receiver_of[muid] == 0) {
+			k_spin_unlock(&window->lock, key);
+			return;
+		}
+		receiver_bit = BIT(window->receiver_of[muid] - 1);
+
+		for (uint8_t seq = window->tail; seq != window->head; seq++) {
+			entry = entry_of(window, seq);
+			if (!entry->msg || !(entry->pending & receiver_bit)) {
+				continue;
+			}
+			entry->pending &= ~receiver_bit;
+			if (!entry->pending) {
+				acked[num_acked++] = entry->msg;
+				entry->msg = NULL;
+				if (num_acked == REMOVE_BATCH) {
+					break;
+				}
+			}
+		}
+		advance_tail(window);
+
+		/** The receiver is free once no message is pending for it */
+		if (num_acked < REMOVE_BATCH) {
+			window->receivers &= ~receiver_bit;
+			window->receiver_of[muid] = 0;
+		}
+
+		k_spin_unlock(&window->lock, key);
+
+		for (size_t i = 0; i < num_acked; i++) {
+			window->done(acked[i], true);
+		}
+	} while (num_acked == REMOVE_BATCH);
+}
@@ -17,6 +17,34 @@
 #define LOG_MODULE_NAME midi_msg
 LOG_MODULE_REGISTER(LOG_MODULE_NAME);
 
+/** Messages may be shared between ports running in different threads */
+static struct k_spinlock ref_lock;
+
+/** @return true if the last reference was released. */
+static bool msg_release(midi_msg_t *msg)
+{
+	k_spinlock_key_t key = k_spin_lock(&ref_lock);
+	bool released = (msg->ref == 0) || (--msg->ref == 0);
+
+	k_spin_unlock(&ref_lock, key);
+
+	return released;
+}
+
+static void release_clone(midi_msg_t *msg)
+{
+	midi_msg_t *parent = msg->parent;
+
+	MIDI_TRACE(FREE, msg, msg->len);
+	k_free(msg);
+
+	if (parent->buf) {
+		midi_msg_unref_alt(parent);
+	} else {
+		midi_msg_unref(parent);
+	}
+}
+
 midi_msg_t  * __must_check midi_msg_alloc(midi_msg_t * msg, size_t size) 
 {
 	if (!msg) {
@@ -25,6 +53,7 @@ midi_msg_t  * __must_check midi_msg_alloc(midi_msg_t * msg, size_t size)
 			return NULL;
 		}
 		memset(msg, 0, sizeof(*msg));
+		MIDI_TRACE(ALLOC, msg, size);
 	}
 
 	if (size) {
@@ -40,7 +69,7 @@ midi_msg_t  * __must_check midi_msg_alloc(midi_msg_t * msg, size_t size)
 
 midi_msg_t  * __must_check midi_msg_init(struct net_buf *buf,
 						uint8_t *data, uint8_t len, enum midi_format format,
-						void *context, uint16_t timestamp, int64_t uptime, 
+						void *context, uint16_t timestamp, int64_t time_us, 
 						uint8_t num, uint8_t ack_channel)
 {
 
@@ -56,9 +85,11 @@ midi_msg_t  * __must_check midi_msg_init(struct net_buf *buf,
 	msg->context = context;
 	msg->buf = net_buf_ref(buf);
 	msg->timestamp = timestamp;
-	msg->uptime = uptime;
+	msg->time_us = time_us;
 	msg->num = num;
 	msg->ack_channel = ack_channel;
+	msg->parent = NULL;
+	MIDI_TRACE(ALLOC, msg, len);
     
 	return msg;
 }
@@ -86,27 +117,60 @@ midi_msg_t * __must_check midi_msg_ref(midi_msg_t *msg)
 		return NULL;
 	}
 
+	k_spinlock_key_t key = k_spin_lock(&ref_lock);
+
 	msg->ref++;
+	k_spin_unlock(&ref_lock, key);
+
 	return msg;
 }
 
+midi_msg_t * __must_check midi_msg_clone(midi_msg_t *msg)
+{
+	midi_msg_t *clone;
+
+	if (!msg) {
+		return NULL;
+	}
+
+	clone = k_malloc(sizeof(*clone));
+	if (!clone) {
+		return NULL;
+	}
+
+	*clone = *msg;
+	clone->fifo_reserved = NULL;
+	clone->ref = 1;
+	clone->buf = NULL;
+	/** Clones of clones share the data of the same parent */
+	clone->parent = midi_msg_ref(msg->parent ? msg->parent : msg);
+	MIDI_TRACE(ALLOC, clone, clone->len);
+
+	return clone;
+}
+
 void midi_msg_unref_alt(midi_msg_t *msg) 
 {
 	if (!msg) {
 		return;
 	}
 
-    if (msg->ref == 0) {
-		net_buf_unref(msg->buf);
-		k_free(msg);
+	if (!msg_release(msg)) {
 		return;
 	}
 
-	if (--msg->ref > 0) {
+	if (msg->parent) {
+		release_clone(msg);
 		return;
 	}
 
-	net_buf_unref(msg->buf);
+	MIDI_TRACE(FREE, msg, msg->len);
+	/** Messages of a receiver may be copies not backed by a buffer */
+	if (msg->buf) {
+		net_buf_unref(msg->buf);
+	} else {
+		k_free(msg->data);
+	}
 	k_free(msg);
 	return;
 }
@@ -117,16 +181,16 @@ void midi_msg_unref(midi_msg_t *msg)
 		return;
 	}
 
-    if (msg->ref == 0) {
-        k_free(msg->data);
-		k_free(msg);
+	if (!msg_release(msg)) {
 		return;
 	}
 
-	if (--msg->ref > 0) {
+	if (msg->parent) {
+		release_clone(msg);
 		return;
 	}
 
+	MIDI_TRACE(FREE, msg, msg->len);
 	k_free(msg->data);
 	k_free(msg);
 	return;
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI router
+ *
+ * Routes messages from input ports to output ports
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/device.h>
+
+#include "midi/midi.h"
+#include "midi/midi_router.h"
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_router
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#define MERGE_WINDOW_US CONFIG_MIDI_ROUTER_MERGE_WINDOW_US
+
+struct midi_route {
+
+	struct midi_route_config config;
+
+	bool in_use;
+
+	/** The message currently passed through is filtered out */
+	bool drop;
+};
+
+static struct midi_route routes[CONFIG_MIDI_ROUTER_MAX_ROUTES];
+
+static struct k_spinlock routes_lock;
+
+static bool route_filter_pass(struct midi_route *route, const midi_msg_t *msg)
+{
+	uint8_t status = midi_msg_status(msg);
+
+	if (status >= 0xF8) {
+		/** System Real-Time, does not affect the current message */
+		return !(route->config.type_filter & BIT(8));
+	}
+
+	if (status >= 0xF0) {
+		route->drop = route->config.type_filter & BIT(7);
+	} else if (status >= 0x80) {
+		route->drop = (route->config.type_filter & BIT((status >> 4) - 8)) ||
+			      !(route->config.channel_mask & BIT(status & 0x0F));
+	}
+
+	/** Databytes of a serial stream follow the decision of their statusbyte */
+	return !route->drop;
+}
+
+static int router_sent(const struct device *dev, midi_msg_t *msg, void *user_data)
+{
+	if (msg->buf) {
+		midi_msg_unref_alt(msg);
+	} else {
+		midi_msg_unref(msg);
+	}
+
+	return 0;
+}
+
+static void route_msg(const struct device *source, midi_msg_t *msg)
+{
+	const struct device *dests[CONFIG_MIDI_ROUTER_MAX_ROUTES *
+				   CONFIG_MIDI_ROUTER_MAX_DESTINATIONS];
+	k_spinlock_key_t key = k_spin_lock(&routes_lock);
+	midi_msg_t *out_msg;
+	size_t num = 0;
+	size_t i;
+
+	/** Collect the destinations, sending is done without the lock held */
+	for (size_t r = 0; r < ARRAY_SIZE(routes); r++) {
+		if (!routes[r].in_use || (routes[r].config.source != source) ||
+		    !route_filter_pass(&routes[r], msg)) {
+			continue;
+		}
+
+		for (size_t d = 0; d < routes[r].config.num_destinations; d++) {
+			for (i = 0; i < num; i++) {
+				if (dests[i] == routes[r].config.destinations[d]) {
+					break;
+				}
+			}
+			if (i == num) {
+				dests[num++] = routes[r].config.destinations[d];
+			}
+		}
+	}
+
+	k_spin_unlock(&routes_lock, key);
+
+	for (i = 0; i < num; i++) {
+		/** The last destination gets the received message itself */
+		out_msg = (i == num - 1) ? msg : midi_msg_clone(msg);
+		if (!out_msg) {
+			LOG_WRN("could not clone midi message!");
+			continue;
+		}
+
+		if (midi_send(dests[i], out_msg)) {
+			router_sent(dests[i], out_msg, NULL);
+		}
+	}
+
+	if (num == 0) {
+		router_sent(source, msg, NULL);
+	}
+}
+
+#if MERGE_WINDOW_US > 0
+struct merge_entry {
+	/** Time the message is routed at, time_us plus the merge window */
+	int64_t due;
+	/** Insertion order, keeps messages with equal due time in order */
+	uint32_t seq;
+	const struct device *source;
+	midi_msg_t *msg;
+};
+
+static struct merge_entry merge_heap[CONFIG_MIDI_ROUTER_MERGE_QUEUE_SIZE];
+
+static size_t merge_len;
+
+static uint32_t merge_seq;
+
+static struct k_spinlock merge_lock;
+
+static K_SEM_DEFINE(merge_sem, 0, 1);
+
+static inline bool merge_entry_before(const struct merge_entry *a,
+				      const struct merge_entry *b)
+{
+	return (a->due < b->due) ||
+	       ((a->due == b->due) && ((int32_t)(a->seq - b->seq) < 0));
+}
+
+/** @return false if the merge queue is full. */
+static bool merge_push(const struct device *source, midi_msg_t *msg)
+{
+	k_spinlock_key_t key = k_spin_lock(&merge_lock);
+	struct merge_entry entry = {
+		.due = msg->time_us + MERGE_WINDOW_US,
+		.seq = merge_seq++,
+		.source = source,
+		.msg = msg,
+	};
+	size_t i = merge_len;
+
+	if (merge_len == ARRAY_SIZE(merge_heap)) {
+		k_spin_unlock(&merge_lock, key);
+		return false;
+	}
+	merge_len++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (!merge_entry_before(&entry, &merge_heap[parent])) {
+			break;
+		}
+		merge_heap[i] = merge_heap[parent];
+		i = parent;
+	}
+	merge_heap[i] = entry;
+
+	k_spin_unlock(&merge_lock, key);
+
+	if (i == 0) {
+		/** New earliest message, the thread must wake up earlier */
+		k_sem_give(&merge_sem);
+	}
+
+	return true;
+}
+
+static struct merge_entry merge_pop(void)
+{
+	struct merge_entry top = merge_heap[0];
+	struct merge_entry last = merge_heap[--merge_len];
+	size_t i = 0;
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+
+		if (child >= merge_len) {
+			break;
+		}
+		if ((child + 1 < merge_len) &&
+		    merge_entry_before(&merge_heap[child + 1], &merge_heap[child])) {
+			child++;
+		}
+		if (!merge_entry_before(&merge_heap[child], &last)) {
+			break;
+		}
+		merge_heap[i] = merge_heap[child];
+		i = child;
+	}
+	merge_heap[i] = last;
+
+	return top;
+}
+
+/**
+ * Messages from all sources are held for the merge window and routed in
+ * order of their time, so inputs merged into one output stay in order
+ * when their transports deliver them with different latency.
+ */
+static void midi_router_thread(void *p1, void *p2, void *p3)
+{
+	struct merge_entry entry;
+	k_spinlock_key_t key;
+	int64_t due;
+
+	for (;;) {
+		key = k_spin_lock(&merge_lock);
+		if (merge_len == 0) {
+			k_spin_unlock(&merge_lock, key);
+			k_sem_take(&merge_sem, K_FOREVER);
+			continue;
+		}
+
+		due = merge_heap[0].due;
+		if (due > midi_time_now_us()) {
+			k_spin_unlock(&merge_lock, key);
+			k_sem_take(&merge_sem, midi_time_abs_timeout(due));
+			continue;
+		}
+
+		entry = merge_pop();
+		k_spin_unlock(&merge_lock, key);
+
+		route_msg(entry.source, entry.msg);
+	}
+}
+
+K_THREAD_DEFINE(midi_router_tid, CONFIG_MIDI_ROUTER_THREAD_STACK_SIZE,
+		midi_router_thread, NULL, NULL, NULL, 7, 0, 0);
+#endif
+
+static int router_received(const struct device *dev, midi_msg_t *msg, void *user_data)
+{
+#if MERGE_WINDOW_US > 0
+	if (merge_push(dev, msg)) {
+		return 0;
+	}
+	LOG_WRN("MIDI router merge queue full");
+#endif
+
+	route_msg(dev, msg);
+
+	return 0;
+}
+
+static bool source_in_use(const struct device *source)
+{
+	for (size_t r = 0; r < ARRAY_SIZE(routes); r++) {
+		if (routes[r].in_use && (routes[r].config.source == source)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int midi_router_add_route(const struct midi_route_config *config)
+{
+	k_spinlock_key_t key;
+	bool new_source;
+	int route = -ENOMEM;
+	int err;
+
+	if (!config->source || (config->num_destinations == 0) ||
+	    (config->num_destinations > CONFIG_MIDI_ROUTER_MAX_DESTINATIONS)) {
+		return -EINVAL;
+	}
+
+	for (size_t d = 0; d < config->num_destinations; d++) {
+		if (!config->destinations[d]) {
+			return -EINVAL;
+		}
+		err = midi_callback_set(config->destinations[d], router_sent, NULL);
+		if (err) {
+			LOG_WRN("Can not route to %s (err %d)",
+				config->destinations[d]->name, err);
+			return err;
+		}
+	}
+
+	key = k_spin_lock(&routes_lock);
+	new_source = !source_in_use(config->source);
+	for (size_t r = 0; r < ARRAY_SIZE(routes); r++) {
+		if (!routes[r].in_use) {
+			routes[r].config = *config;
+			routes[r].drop = false;
+			routes[r].in_use = true;
+			route = r;
+			break;
+		}
+	}
+	k_spin_unlock(&routes_lock, key);
+
+	if ((route >= 0) && new_source) {
+		err = midi_callback_set(config->source, router_received, NULL);
+		if (err) {
+			LOG_WRN("Can not route from %s (err %d)", config->source->name, err);
+			midi_router_remove_route(route);
+			return err;
+		}
+	}
+
+	return route;
+}
+
+int midi_router_remove_route(int route)
+{
+	const struct device *source;
+	k_spinlock_key_t key;
+	bool last;
+
+	if ((route < 0) || (route >= ARRAY_SIZE(routes))) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&routes_lock);
+	if (!routes[route].in_use) {
+		k_spin_unlock(&routes_lock, key);
+		return -EINVAL;
+	}
+	routes[route].in_use = false;
+	source = routes[route].config.source;
+	last = !source_in_use(source);
+	k_spin_unlock(&routes_lock, key);
+
+	if (last) {
+		/** Received messages are released by the port again */
+		midi_callback_set(source, NULL, NULL);
+	}
+
+	return 0;
+}
+
+#define DT_ROUTE_DESTINATION(node_id, prop, idx)				\
+	DEVICE_DT_GET(DT_PHANDLE_BY_IDX(node_id, prop, idx)),
+
+#define DT_ROUTE_CONFIG(node_id)						\
+	{									\
+		.source = DEVICE_DT_GET(DT_PHANDLE(node_id, source)),		\
+		.destinations = {						\
+			DT_FOREACH_PROP_ELEM(node_id, destinations,		\
+					     DT_ROUTE_DESTINATION)		\
+		},								\
+		.num_destinations = DT_PROP_LEN(node_id, destinations),	\
+		.channel_mask = DT_PROP(node_id, channel_mask),			\
+		.type_filter = DT_PROP(node_id, type_filter),			\
+	},
+
+#define DT_ROUTER_ROUTES(node_id)						\
+	DT_FOREACH_CHILD_STATUS_OKAY(node_id, DT_ROUTE_CONFIG)
+
+static const struct midi_route_config dt_routes[] = {
+	DT_FOREACH_STATUS_OKAY(midi_router, DT_ROUTER_ROUTES)
+};
+
+static int midi_router_init(void)
+{
+	int route;
+
+	for (size_t i = 0; i < ARRAY_SIZE(dt_routes); i++) {
+		route = midi_router_add_route(&dt_routes[i]);
+		if (route < 0) {
+			LOG_ERR("Failed to add route from %s (err %d)",
+				dt_routes[i].source->name, route);
+		}
+	}
+
+	return 0;
+}
+
+SYS_INIT(midi_router_init, APPLICATION, CONFIG_MIDI_ROUTER_INIT_PRIORITY);
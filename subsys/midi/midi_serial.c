@@ -16,8 +16,13 @@
 #include "midi_serial_internal.h"
 
 #include "midi/midi.h"
+#include "midi/midi_stats.h"
+#include "midi/midi_ring.h"
 
 #include <zephyr/sys/util.h>
+#include <zephyr/sys/ring_buffer.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
 
 #include <zephyr/device.h>
 
@@ -31,17 +36,98 @@ enum timestamp_setting {
 	MIDI_TIMESTAMP_ON
 };
 
+/** Number of jitter histogram buckets. Bucket 0 counts messages that were
+ * on time, bucket n counts messages that were late by [2^(n-1), 2^n) us and
+ * the last bucket everything later than that.
+ */
+#define MIDI_SERIAL_JITTER_BUCKETS 16
+
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_MIDI_SERIAL_RX_QUEUE_SIZE),
+	     "CONFIG_MIDI_SERIAL_RX_QUEUE_SIZE must be a power of two");
+
+/** Maximum number of System Real-Time bytes inserted into a running transfer at once */
+#define MIDI_SERIAL_RT_BUF_SIZE 8
+
+/**
+ * Longest wait in milliseconds for the next byte of an open thru message
+ * before queued messages are sent anyway.
+ */
+#define MIDI_SERIAL_THRU_HOLD_MS 20
+
+/**
+ * Fast link frame: sync byte, sequence number, 16-bit payload length,
+ * payload and a CRC-16/CCITT over everything after the sync byte.
+ * The payload holds one entry per message: format, length, 16-bit
+ * timestamp and the message data.
+ */
+#define FAST_LINK_SYNC 0xA5
+#define FAST_LINK_HEADER_SIZE 4
+#define FAST_LINK_CRC_SIZE 2
+#define FAST_LINK_OVERHEAD (FAST_LINK_HEADER_SIZE + FAST_LINK_CRC_SIZE)
+#define FAST_LINK_ENTRY_HEADER_SIZE 4
+
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+struct midi_serial_fast_link_rx {
+
+	/** Bytes received by the UART, waiting to be decoded */
+	struct ring_buf ring;
+
+	uint8_t ring_buffer[CONFIG_MIDI_SERIAL_FAST_LINK_RX_BUFFER_SIZE];
+
+	struct k_sem sem;
+
+	/** Frame being received, pos is the number of bytes of it so far */
+	uint8_t frame[CONFIG_MIDI_SERIAL_FAST_LINK_MAX_FRAME_SIZE];
+
+	size_t pos;
+
+	/** Expected sequence number of the next frame */
+	uint8_t seq;
+
+	bool synced;
+};
+#endif
+
+struct midi_serial_sched_entry {
+	/** Due time in microseconds of the MIDI timebase */
+	int64_t due;
+	/** Insertion order, keeps messages with equal due time in order */
+	uint32_t seq;
+	midi_msg_t *msg;
+};
+
 struct midi_serial_in_dev_data {
 
 	struct midi_api *api;
 
 	const struct device *dev;
-	
-	uint8_t rx_buffer[2];
+
+	uint8_t *rx_buffers[2];
+
+	size_t rx_buffer_size;
 
 	uint8_t *released_buf;
 
-	struct k_fifo rx_queue;
+	/** Received bytes, from the UART callback to the receive thread */
+	struct midi_ring rx_queue;
+
+	void *rx_slots[CONFIG_MIDI_SERIAL_RX_QUEUE_SIZE];
+
+	/** Output port that received bytes are copied to, NULL if thru is off */
+	const struct device *thru_dev;
+
+	struct midi_serial_out_dev_data *thru;
+
+	/** Message types not copied to the thru port, see thru-filter */
+	uint16_t thru_filter;
+
+	/** The message currently received is filtered out of the thru port */
+	bool thru_drop;
+
+	/** Frame decoder of a fast link port, NULL for a MIDI DIN port */
+	struct midi_serial_fast_link_rx *fast_link;
+
+	struct midi_stats_data stats;
 
 	void *user_data;
 
@@ -53,16 +139,75 @@ struct midi_serial_out_dev_data {
 
 	const struct device *dev;
 
-	// uint8_t tx_buffer[2];
+	uint8_t *tx_buffers[2];
 
-	// uint8_t current_buf_idx;
+	size_t tx_buffer_size;
 
 	struct k_sem tx_sem;
 
 	struct k_fifo tx_queue;
 
+	/** System Real-Time messages, sent ahead of tx_queue */
+	struct k_fifo rt_queue;
+
+	/** Messages copied into a TX buffer, waiting for UART_TX_DONE */
+	struct k_fifo sent_queue;
+
+	uint8_t rt_buffer[MIDI_SERIAL_RT_BUF_SIZE];
+
+	/** Bytes sent by an aborted transfer, -1 if it was not aborted */
+	int tx_aborted_len;
+
+	/** Bytes copied from a thru input port */
+	struct ring_buf thru_ring;
+
+	uint8_t thru_ring_buffer[CONFIG_MIDI_SERIAL_THRU_BUFFER_SIZE];
+
+	struct k_poll_signal thru_signal;
+
+	/** Running status of the thru stream, data bytes left of its open message */
+	uint8_t thru_status;
+
+	uint8_t thru_left;
+
+	/** A SysEx message of the thru stream is open */
+	bool thru_sysex;
+
+	/** Uptime in ms the last thru byte was sent at */
+	int64_t thru_time;
+
+	uint8_t running_status;
+
+	int64_t running_status_time;
+
 	enum timestamp_setting timestamp_setting;
 
+	/** Send framed batches instead of raw MIDI bytes, see fast-link */
+	bool fast_link;
+
+	uint8_t fast_link_seq;
+
+	/** Min-heap of timestamped messages ordered by due time */
+	struct midi_serial_sched_entry sched_heap[CONFIG_MIDI_SERIAL_SCHEDULER_SIZE];
+
+	size_t sched_len;
+
+	uint32_t sched_seq;
+
+	int64_t sched_last_due;
+
+	struct k_spinlock sched_lock;
+
+	struct k_timer sched_timer;
+
+#if defined(CONFIG_MIDI_SERIAL_JITTER_HISTOGRAM)
+	uint32_t jitter_histogram[MIDI_SERIAL_JITTER_BUCKETS];
+
+	uint32_t jitter_count;
+#endif
+
+	struct midi_stats_data stats;
+
 	void *user_data;
 };
 
@@ -76,10 +221,43 @@ struct midi_serial_dev_data {
 
 };
 
-uint8_t buffer_1[16];
-uint8_t buffer_2[16];
-uint8_t *buffers[2] = {buffer_1, buffer_2};
+static bool thru_filter_pass(struct midi_serial_in_dev_data *in, uint8_t byte)
+{
+	if (byte >= 0xF8) {
+		/** System Real-Time, does not affect the current message */
+		return !(in->thru_filter & BIT(8));
+	}
+
+	if (byte >= 0xF0) {
+		in->thru_drop = in->thru_filter & BIT(7);
+	} else if (byte >= 0x80) {
+		in->thru_drop = in->thru_filter & BIT((byte >> 4) - 8);
+	}
 
+	/** Databytes follow the decision of their statusbyte */
+	return !in->thru_drop;
+}
+
+static void copy_to_thru(struct midi_serial_in_dev_data *in, uint8_t *data, size_t len)
+{
+	struct midi_serial_out_dev_data *out = in->thru;
+	size_t copied = 0;
+
+	if (!out->dev) {
+		/** Output port not initialized yet */
+		return;
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		if (thru_filter_pass(in, data[i])) {
+			copied += ring_buf_put(&out->thru_ring, &data[i], 1);
+		}
+	}
+
+	if (copied) {
+		k_poll_signal_raise(&out->thru_signal, 0);
+	}
+}
 
 static void uart_cb(const struct device *dev, struct uart_event *evt,
 		    void *user_data)
@@ -87,28 +265,57 @@ static void uart_cb(const struct device *dev, struct uart_event *evt,
 	struct midi_serial_dev_data *serial_dev_data = user_data;
 	struct midi_serial_in_dev_data *in = serial_dev_data->in;
 	struct midi_serial_out_dev_data *out = serial_dev_data->out;
-	static uint8_t *released_buf;
-	if (serial_dev_data->in)
-	{
-		released_buf = serial_dev_data->in->released_buf;
-	}
-	
 	midi_msg_t *msg;
+	int64_t now;
 
 	switch (evt->type) {
 	case UART_TX_DONE:
 		k_sem_give(&out->tx_sem);
 		break;
+	case UART_TX_ABORTED:
+		out->tx_aborted_len = evt->data.tx.len;
+		k_sem_give(&out->tx_sem);
+		break;
 	case UART_RX_RDY:
 		// LOG_INF("UART RX-ready, len %d, %d", evt->data.rx.len, evt->data.rx.buf[evt->data.rx.offset]);
-		msg = midi_msg_alloc(NULL, 1);
-		memcpy(msg->data, &evt->data.rx.buf[evt->data.rx.offset], 1);
-		msg->format = MIDI_FORMAT_1_0_SERIAL;
-		msg->len = 1;
-		msg->timestamp = MIDI_TIME_13BIT(k_ticks_to_ms_near64(k_uptime_ticks()));
-		
-		if (msg) {
-			k_fifo_put(&in->rx_queue, msg);
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+		if (in->fast_link) {
+			/** Frames are decoded by the receive thread */
+			if (ring_buf_put(&in->fast_link->ring, &evt->data.rx.buf[evt->data.rx.offset],
+					 evt->data.rx.len) < evt->data.rx.len) {
+				LOG_WRN("Fast link receive buffer full");
+				midi_stats_drop(&in->stats, MIDI_STATS_DROP_QUEUE_FULL);
+			}
+			k_sem_give(&in->fast_link->sem);
+			break;
+		}
+#endif
+		if (in->thru) {
+			copy_to_thru(in, &evt->data.rx.buf[evt->data.rx.offset], evt->data.rx.len);
+		}
+
+		/** Several bytes may be ready at once, pass them on one by one */
+		now = midi_time_now_us();
+		for (size_t i = 0; i < evt->data.rx.len; i++) {
+			msg = midi_msg_alloc(NULL, 1);
+			if (!msg || !msg->data) {
+				LOG_WRN("could not allocate midi buffer!");
+				midi_stats_drop(&in->stats, MIDI_STATS_DROP_ALLOC);
+				midi_msg_unref(msg);
+				break;
+			}
+			memcpy(msg->data, &evt->data.rx.buf[evt->data.rx.offset + i], 1);
+			msg->format = MIDI_FORMAT_1_0_SERIAL;
+			msg->len = 1;
+			msg->time_us = now;
+			msg->timestamp = midi_time_to_13bit_ms(now);
+
+			if (midi_ring_put(&in->rx_queue, msg)) {
+				LOG_WRN("Serial MIDI receive queue full");
+				midi_stats_drop(&in->stats, MIDI_STATS_DROP_QUEUE_FULL);
+				midi_msg_unref(msg);
+				break;
+			}
 		}
 
 		break;
@@ -123,15 +330,17 @@ static void uart_cb(const struct device *dev, struct uart_event *evt,
 		// } else {
 		// 	uart_rx_buf_rsp(serial_dev_data->uart_dev, &in->rx_buffer[1], 1);
 		// }		
-		if (released_buf == buffers[0]) {
-			uart_rx_buf_rsp(serial_dev_data->uart_dev, buffers[0], 16);
+		if (in->released_buf == in->rx_buffers[0]) {
+			uart_rx_buf_rsp(serial_dev_data->uart_dev,
+					in->rx_buffers[0], in->rx_buffer_size);
 		} else {
-			uart_rx_buf_rsp(serial_dev_data->uart_dev, buffers[1], 16);
+			uart_rx_buf_rsp(serial_dev_data->uart_dev,
+					in->rx_buffers[1], in->rx_buffer_size);
 		}
 		break;
 	case UART_RX_BUF_RELEASED:
 	// LOG_INF("UART RX-released");
-		released_buf = evt->data.rx_buf.buf;
+		in->released_buf = evt->data.rx_buf.buf;
 		// uart_rx_buf_rsp(serial_dev_data->uart_dev, released_buf, 16);
 		break;
 	case UART_RX_STOPPED:
@@ -150,6 +359,166 @@ static void uart_cb(const struct device *dev, struct uart_event *evt,
 	}
 }
 
+static void queue_serial_msg(struct midi_serial_out_dev_data *out, midi_msg_t *msg)
+{
+	MIDI_TRACE(ENQUEUE, msg, msg->len);
+	midi_stats_enqueue(&out->stats, msg);
+
+	/** A fast link frame is sent in microseconds, real-time messages
+	 * keep their place in the queue instead of interrupting it.
+	 */
+	if (midi_msg_is_realtime(msg) && !out->fast_link) {
+		k_fifo_put(&out->rt_queue, msg);
+	} else {
+		k_fifo_put(&out->tx_queue, msg);
+	}
+}
+
+static inline bool sched_entry_before(const struct midi_serial_sched_entry *a,
+				      const struct midi_serial_sched_entry *b)
+{
+	return (a->due < b->due) ||
+	       ((a->due == b->due) && ((int32_t)(a->seq - b->seq) < 0));
+}
+
+static void sched_push(struct midi_serial_out_dev_data *out, int64_t due, midi_msg_t *msg)
+{
+	struct midi_serial_sched_entry *heap = out->sched_heap;
+	struct midi_serial_sched_entry entry = {
+		.due = due,
+		.seq = out->sched_seq++,
+		.msg = msg,
+	};
+	size_t i = out->sched_len++;
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (!sched_entry_before(&entry, &heap[parent])) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = entry;
+}
+
+static midi_msg_t *sched_pop(struct midi_serial_out_dev_data *out)
+{
+	struct midi_serial_sched_entry *heap = out->sched_heap;
+	struct midi_serial_sched_entry last;
+	midi_msg_t *msg = heap[0].msg;
+	size_t len = --out->sched_len;
+	size_t i = 0;
+
+	last = heap[len];
+	for (;;) {
+		size_t child = 2 * i + 1;
+
+		if (child >= len) {
+			break;
+		}
+		if ((child + 1 < len) && sched_entry_before(&heap[child + 1], &heap[child])) {
+			child++;
+		}
+		if (!sched_entry_before(&heap[child], &last)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+
+	return msg;
+}
+
+static void sched_timer_expiry(struct k_timer *timer)
+{
+	struct midi_serial_out_dev_data *out =
+		CONTAINER_OF(timer, struct midi_serial_out_dev_data, sched_timer);
+	k_spinlock_key_t key = k_spin_lock(&out->sched_lock);
+	int64_t now = midi_time_now_us();
+
+	/** Release every message that is due, in timestamp order */
+	while ((out->sched_len > 0) && (out->sched_heap[0].due <= now)) {
+		queue_serial_msg(out, sched_pop(out));
+	}
+
+	if (out->sched_len > 0) {
+		k_timer_start(timer, midi_time_abs_timeout(out->sched_heap[0].due), K_NO_WAIT);
+	}
+
+	k_spin_unlock(&out->sched_lock, key);
+}
+
+/**
+ * @brief Queue a timestamped message for output at its due time.
+ *
+ * The due time is kept in msg->time_us.
+ * Messages without delay are queued for output directly unless earlier
+ * messages are still waiting in the scheduler.
+ */
+static void schedule_serial_msg(struct midi_serial_out_dev_data *out, midi_msg_t *msg)
+{
+	k_spinlock_key_t key = k_spin_lock(&out->sched_lock);
+	int64_t now = midi_time_now_us();
+	int64_t due;
+
+	MIDI_TRACE(ENQUEUE, msg, msg->len);
+	if (msg->format == MIDI_FORMAT_1_0_PARSED_DELTA_US) {
+		/** Delta timestamps are relative to the previous message */
+		due = midi_time_from_delta_us(msg->timestamp, MAX(now, out->sched_last_due));
+	} else {
+		due = MAX(now, midi_time_from_13bit_ms(msg->timestamp, now));
+	}
+
+	out->sched_last_due = due;
+	msg->time_us = due;
+
+	if (((due <= now) && (out->sched_len == 0)) ||
+	    (out->sched_len == CONFIG_MIDI_SERIAL_SCHEDULER_SIZE)) {
+		if (due > now) {
+			LOG_WRN("Serial MIDI scheduler full, sending early");
+		}
+		k_spin_unlock(&out->sched_lock, key);
+		queue_serial_msg(out, msg);
+		return;
+	}
+
+	sched_push(out, due, msg);
+	if (out->sched_heap[0].msg == msg) {
+		k_timer_start(&out->sched_timer, midi_time_abs_timeout(due), K_NO_WAIT);
+	}
+
+	k_spin_unlock(&out->sched_lock, key);
+}
+
+#if defined(CONFIG_MIDI_SERIAL_JITTER_HISTOGRAM)
+static void record_jitter(struct midi_serial_out_dev_data *out, midi_msg_t *msg)
+{
+	int64_t late = midi_time_now_us() - msg->time_us;
+	uint8_t bucket = 0;
+
+	if (late > 0) {
+		bucket = MIN(32 - __builtin_clz((uint32_t)MIN(late, UINT32_MAX)),
+			     MIDI_SERIAL_JITTER_BUCKETS - 1);
+	}
+
+	out->jitter_histogram[bucket]++;
+	if (++out->jitter_count < CONFIG_MIDI_SERIAL_JITTER_HISTOGRAM_LOG_INTERVAL) {
+		return;
+	}
+
+	LOG_INF("Output jitter of %s over %u messages:", out->dev->name, out->jitter_count);
+	LOG_INF("  on time: %u", out->jitter_histogram[0]);
+	for (uint8_t i = 1; i < MIDI_SERIAL_JITTER_BUCKETS; i++) {
+		LOG_INF("  < %u us: %u", BIT(i), out->jitter_histogram[i]);
+	}
+	memset(out->jitter_histogram, 0, sizeof(out->jitter_histogram));
+	out->jitter_count = 0;
+}
+#endif
+
 int midi_serial_out_port_callback_set(const struct device *dev,
 				 midi_transfer cb,
 				 void *user_data)
@@ -190,9 +559,25 @@ static int midi_serial_in_device_init(const struct device *dev)
 	const struct device * uart_dev;
 	
 	serial_dev_data->in->dev = dev;
-	k_fifo_init(&serial_dev_data->in->rx_queue);
+	midi_ring_init(&serial_dev_data->in->rx_queue, serial_dev_data->in->rx_slots,
+		       ARRAY_SIZE(serial_dev_data->in->rx_slots));
 	serial_dev_data->in->api = (struct midi_api*)dev->api;
 
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+	if (serial_dev_data->in->fast_link) {
+		ring_buf_init(&serial_dev_data->in->fast_link->ring,
+			      sizeof(serial_dev_data->in->fast_link->ring_buffer),
+			      serial_dev_data->in->fast_link->ring_buffer);
+		k_sem_init(&serial_dev_data->in->fast_link->sem, 0, 1);
+	}
+#endif
+
+	if (serial_dev_data->in->thru_dev) {
+		/** Output ports share the device data type of this driver */
+		serial_dev_data->in->thru = ((struct midi_serial_dev_data *)
+					     serial_dev_data->in->thru_dev->data)->out;
+	}
+
 
 	uart_dev = serial_dev_data->uart_dev;
 
@@ -207,7 +592,8 @@ static int midi_serial_in_device_init(const struct device *dev)
 	if (err) {
 		return err;
 	}
-	err = uart_rx_enable(uart_dev, buffers[0], 16, 0);
+	err = uart_rx_enable(uart_dev, serial_dev_data->in->rx_buffers[0],
+			     serial_dev_data->in->rx_buffer_size, 0);
 	if (err) {
 		return err;
 	}
@@ -225,6 +611,11 @@ static int midi_serial_out_device_init(const struct device *dev)
 	struct midi_serial_dev_data *serial_dev_data = dev->data;
 	const struct device * uart_dev;
 	
+	ring_buf_init(&serial_dev_data->out->thru_ring,
+		      sizeof(serial_dev_data->out->thru_ring_buffer),
+		      serial_dev_data->out->thru_ring_buffer);
+	k_poll_signal_init(&serial_dev_data->out->thru_signal);
+
 	serial_dev_data->out->dev = dev;
 	serial_dev_data->out->api = (struct midi_api*)dev->api;
 
@@ -232,6 +623,9 @@ static int midi_serial_out_device_init(const struct device *dev)
 	uart_dev = serial_dev_data->uart_dev;
 
 	k_fifo_init(&serial_dev_data->out->tx_queue);
+	k_fifo_init(&serial_dev_data->out->rt_queue);
+	k_fifo_init(&serial_dev_data->out->sent_queue);
+	k_timer_init(&serial_dev_data->out->sched_timer, sched_timer_expiry, NULL);
 	k_sem_init(&serial_dev_data->out->tx_sem, 1, 1);
 
 	if (!device_is_ready(uart_dev)) {
@@ -251,20 +645,130 @@ static int midi_serial_out_device_init(const struct device *dev)
 	return 0;
 }
 
+static void deliver_received_msg(struct midi_serial_in_dev_data *in, midi_msg_t *msg)
+{
+	MIDI_TRACE(RECEIVE, msg, msg->len);
+	midi_stats_rx(&in->stats, msg);
+	if(in->api->midi_transfer_done) {
+		in->api->midi_transfer_done(in->dev, msg, in->user_data);
+	} else {
+		midi_msg_unref(msg);
+	}
+}
+
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+static void fast_link_frame_received(struct midi_serial_in_dev_data *in,
+				     uint8_t *frame, size_t payload_len)
+{
+	struct midi_serial_fast_link_rx *rx = in->fast_link;
+	uint8_t *payload = &frame[FAST_LINK_HEADER_SIZE];
+	uint16_t crc = crc16_ccitt(0xFFFF, &frame[1], FAST_LINK_HEADER_SIZE - 1 + payload_len);
+	midi_msg_t *msg;
+	size_t pos = 0;
+	uint8_t len;
+
+	if (crc != sys_get_le16(&payload[payload_len])) {
+		LOG_WRN("Fast link frame with wrong CRC dropped");
+		midi_stats_drop(&in->stats, MIDI_STATS_DROP_PARSE);
+		return;
+	}
+
+	if (rx->synced && (frame[1] != rx->seq)) {
+		LOG_WRN("Fast link lost %d frames", (uint8_t)(frame[1] - rx->seq));
+	}
+	rx->seq = frame[1] + 1;
+	rx->synced = true;
+
+	while (pos + FAST_LINK_ENTRY_HEADER_SIZE <= payload_len) {
+		len = payload[pos + 1];
+		if (pos + FAST_LINK_ENTRY_HEADER_SIZE + len > payload_len) {
+			LOG_WRN("Malformed fast link frame");
+			midi_stats_drop(&in->stats, MIDI_STATS_DROP_PARSE);
+			return;
+		}
+
+		if (len == 0) {
+			pos += FAST_LINK_ENTRY_HEADER_SIZE;
+			continue;
+		}
+
+		msg = midi_msg_alloc(NULL, len);
+		if (!msg || !msg->data) {
+			LOG_WRN("could not allocate midi buffer!");
+			midi_stats_drop(&in->stats, MIDI_STATS_DROP_ALLOC);
+			midi_msg_unref(msg);
+			return;
+		}
+		msg->format = payload[pos];
+		msg->len = len;
+		msg->timestamp = sys_get_le16(&payload[pos + 2]);
+		msg->time_us = midi_time_now_us();
+		memcpy(msg->data, &payload[pos + FAST_LINK_ENTRY_HEADER_SIZE], len);
+
+		deliver_received_msg(in, msg);
+		pos += FAST_LINK_ENTRY_HEADER_SIZE + len;
+	}
+}
+
+/** @brief Decode the frames in the receive buffer of a fast link port. */
+static void fast_link_receive(struct midi_serial_in_dev_data *in)
+{
+	struct midi_serial_fast_link_rx *rx = in->fast_link;
+	size_t need;
+
+	for (;;) {
+		if (rx->pos == 0) {
+			/** Hunt for the start of a frame */
+			if (!ring_buf_get(&rx->ring, rx->frame, 1)) {
+				return;
+			}
+			if (rx->frame[0] == FAST_LINK_SYNC) {
+				rx->pos = 1;
+			}
+			continue;
+		}
+
+		need = (rx->pos < FAST_LINK_HEADER_SIZE) ? FAST_LINK_HEADER_SIZE :
+			FAST_LINK_OVERHEAD + sys_get_le16(&rx->frame[2]);
+		if (need > sizeof(rx->frame)) {
+			LOG_WRN("Fast link frame of %zu bytes too long", need);
+			midi_stats_drop(&in->stats, MIDI_STATS_DROP_PARSE);
+			rx->pos = 0;
+			continue;
+		}
+
+		rx->pos += ring_buf_get(&rx->ring, &rx->frame[rx->pos], need - rx->pos);
+		if (rx->pos < need) {
+			return;
+		}
+
+		if (need > FAST_LINK_HEADER_SIZE) {
+			fast_link_frame_received(in, rx->frame, need - FAST_LINK_OVERHEAD);
+			rx->pos = 0;
+		}
+	}
+}
+#endif
+
 void midi_rx_thread(struct midi_serial_dev_data *serial_dev_data)
 {	
 	midi_msg_t *msg;
 	struct midi_serial_in_dev_data *in = serial_dev_data->in;
 
-	for (;;) {
-		msg = k_fifo_get(&in->rx_queue, K_FOREVER);
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+	while (in->fast_link) {
+		k_sem_take(&in->fast_link->sem, K_FOREVER);
+		fast_link_receive(in);
+	}
+#endif
 
-		
-		if(in->api->midi_transfer_done) {
-			in->api->midi_transfer_done(in->dev, msg, in->user_data);
-		} else {
-			midi_msg_unref(msg);
+	for (;;) {
+		msg = midi_ring_get_wait(&in->rx_queue, K_FOREVER);
+		if (!msg) {
+			continue;
 		}
+
+		deliver_received_msg(in, msg);
 	}
 }
 
@@ -275,71 +779,557 @@ static int send_to_serial_port(const struct device *dev,
 	struct midi_serial_dev_data *serial_dev_data = dev->data;
 	struct midi_serial_out_dev_data *out = serial_dev_data->out;
 
+	if(!out) {
+		return -ENOTSUP;
+	}
+
 	if((msg->format != MIDI_FORMAT_1_0_SERIAL) &
 	   (msg->format != MIDI_FORMAT_1_0_PARSED) &
-	   (msg->format != MIDI_FORMAT_1_0_PARSED_DELTA_US)) {
+	   (msg->format != MIDI_FORMAT_1_0_PARSED_DELTA_US) &
+	   !(out->fast_link && (msg->format == MIDI_FORMAT_2_0_UMP))) {
 		LOG_WRN("Tried to send wrong format on serial port. format: %d", msg->format);
 		return -EINVAL;
 	}
 
-	if(!out) {
-		return -ENOTSUP;
+	if (out->timestamp_setting == MIDI_TIMESTAMP_ON) {
+		schedule_serial_msg(out, msg);
+	} else {
+		msg->time_us = midi_time_now_us();
+		queue_serial_msg(out, msg);
 	}
-
-	k_fifo_put(&out->tx_queue, msg);
 	return 0;
 
 }
 
+static void complete_sent_msg(struct midi_serial_out_dev_data *out, midi_msg_t *msg)
+{
+	MIDI_TRACE(COMPLETE, msg, msg->len);
+	midi_stats_tx(&out->stats, msg);
+	if(out->api->midi_transfer_done) {
+		out->api->midi_transfer_done(out->dev, msg, out->user_data);
+	} else {
+		midi_msg_unref(msg);
+	}
+}
+
+static int midi_serial_in_stats_get(const struct device *dev,
+				    struct midi_stats *stats, bool reset)
+{
+	struct midi_serial_dev_data *serial_dev_data = dev->data;
+
+	return midi_stats_read(&serial_dev_data->in->stats, stats, reset);
+}
+
+static int midi_serial_out_stats_get(const struct device *dev,
+				     struct midi_stats *stats, bool reset)
+{
+	struct midi_serial_dev_data *serial_dev_data = dev->data;
+
+	return midi_stats_read(&serial_dev_data->out->stats, stats, reset);
+}
+
+static void complete_sent_msgs(struct midi_serial_out_dev_data *out, size_t count)
+{
+	midi_msg_t *msg;
+
+	while (count--) {
+		msg = k_fifo_get(&out->sent_queue, K_NO_WAIT);
+		if (!msg) {
+			return;
+		}
+
+		complete_sent_msg(out, msg);
+	}
+}
+
+static void update_running_status(struct midi_serial_out_dev_data *out, uint8_t byte)
+{
+	if ((byte < 0x80) || (byte >= 0xF8)) {
+		/** Databytes and System Real-Time messages leave running status as is */
+		return;
+	}
+
+	/** Channel statusbytes set running status, System Common cancels it */
+	out->running_status = (byte < 0xF0) ? byte : 0;
+	out->running_status_time = k_uptime_get();
+}
+
+static size_t encode_serial_msg(struct midi_serial_out_dev_data *out,
+				uint8_t *dst, midi_msg_t *msg)
+{
+#if defined(CONFIG_MIDI_SERIAL_RUNNING_STATUS)
+	if ((msg->format != MIDI_FORMAT_1_0_SERIAL) &&
+	    (msg->data[0] == out->running_status) &&
+	    ((CONFIG_MIDI_SERIAL_RUNNING_STATUS_REFRESH_MS == 0) ||
+	     ((k_uptime_get() - out->running_status_time) <
+	      CONFIG_MIDI_SERIAL_RUNNING_STATUS_REFRESH_MS))) {
+		/** Running status, statusbyte is omitted */
+		memcpy(dst, msg->data + 1, msg->len - 1);
+		return msg->len - 1;
+	}
+#endif
+
+	for (size_t i = 0; i < msg->len; i++) {
+		update_running_status(out, msg->data[i]);
+	}
+
+	memcpy(dst, msg->data, msg->len);
+	return msg->len;
+}
+
+static inline size_t tx_payload_offset(struct midi_serial_out_dev_data *out)
+{
+	return out->fast_link ? FAST_LINK_HEADER_SIZE : 0;
+}
+
+static inline size_t tx_payload_size(struct midi_serial_out_dev_data *out)
+{
+	return out->tx_buffer_size - (out->fast_link ? FAST_LINK_OVERHEAD : 0);
+}
+
+static size_t fast_link_entry_header(uint8_t *dst, enum midi_format format,
+				     uint8_t len, uint16_t timestamp)
+{
+	dst[0] = format;
+	dst[1] = len;
+	sys_put_le16(timestamp, &dst[2]);
+
+	return FAST_LINK_ENTRY_HEADER_SIZE;
+}
+
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+/**
+ * @brief Add header and CRC around the payload of a fast link frame.
+ *
+ * @return Length of the frame.
+ */
+static size_t fast_link_seal(struct midi_serial_out_dev_data *out,
+			     uint8_t *frame, size_t payload_len)
+{
+	uint16_t crc;
+
+	frame[0] = FAST_LINK_SYNC;
+	frame[1] = out->fast_link_seq++;
+	sys_put_le16(payload_len, &frame[2]);
+	crc = crc16_ccitt(0xFFFF, &frame[1], FAST_LINK_HEADER_SIZE - 1 + payload_len);
+	sys_put_le16(crc, &frame[FAST_LINK_HEADER_SIZE + payload_len]);
+
+	return FAST_LINK_OVERHEAD + payload_len;
+}
+#endif
+
+/** @brief Number of data bytes of a message by its statusbyte. */
+static uint8_t thru_data_len(uint8_t status)
+{
+	if (status < 0xF0) {
+		return ((status & 0xE0) == 0xC0) ? 1 : 2;
+	}
+
+	switch (status) {
+	case 0xF1:
+	case 0xF3:
+		return 1;
+	case 0xF2:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/** @brief Follow the message boundaries of the thru stream. */
+static void thru_track(struct midi_serial_out_dev_data *out, uint8_t byte)
+{
+	if (byte >= 0xF8) {
+		/** System Real-Time, does not affect the current message */
+		return;
+	}
+
+	if (byte >= 0x80) {
+		out->thru_sysex = (byte == 0xF0);
+		out->thru_status = (byte < 0xF0) ? byte : 0;
+		out->thru_left = thru_data_len(byte);
+	} else if (!out->thru_sysex && out->thru_left) {
+		out->thru_left--;
+	}
+}
+
+/**
+ * @brief Check if a message of the thru stream is partly sent.
+ *
+ * Queued messages are not merged into it, or its remaining data bytes
+ * would attach to their statusbyte.
+ */
+static bool thru_msg_open(struct midi_serial_out_dev_data *out)
+{
+	return (out->thru_left || out->thru_sysex) &&
+	       ((k_uptime_get() - out->thru_time) < MIDI_SERIAL_THRU_HOLD_MS);
+}
+
+static void fill_thru_bytes(struct midi_serial_out_dev_data *out, uint8_t *buf,
+			    size_t *len, size_t size)
+{
+	size_t thru_len;
+	uint8_t byte;
+
+	if (out->fast_link) {
+		/** The raw stream is sent as one serial format message */
+		if (size - *len <= FAST_LINK_ENTRY_HEADER_SIZE) {
+			return;
+		}
+		thru_len = ring_buf_get(&out->thru_ring, buf + *len + FAST_LINK_ENTRY_HEADER_SIZE,
+					MIN(size - *len - FAST_LINK_ENTRY_HEADER_SIZE, UINT8_MAX));
+		if (thru_len) {
+			*len += fast_link_entry_header(buf + *len, MIDI_FORMAT_1_0_SERIAL, thru_len,
+				midi_time_to_13bit_ms(midi_time_now_us()));
+			*len += thru_len;
+		}
+		return;
+	}
+
+	/** Thru bytes are a raw stream, copied as received */
+	while ((*len < size) && (ring_buf_peek(&out->thru_ring, &byte, 1) == 1)) {
+		if ((byte < 0x80) && !out->thru_sysex && out->thru_status) {
+			if (!out->thru_left) {
+				/** A message in running status */
+				out->thru_left = thru_data_len(out->thru_status);
+			}
+			/** A queued message sent in between changed the running status */
+			if (out->running_status != out->thru_status) {
+				if ((size - *len) < 2) {
+					break;
+				}
+				buf[(*len)++] = out->thru_status;
+				update_running_status(out, out->thru_status);
+			}
+		}
+
+		thru_track(out, byte);
+		ring_buf_get(&out->thru_ring, NULL, 1);
+		buf[(*len)++] = byte;
+		update_running_status(out, byte);
+		out->thru_time = k_uptime_get();
+	}
+}
+
+/**
+ * @brief Copy queued messages into a TX buffer.
+ *
+ * Messages are merged until the queue is empty or the buffer is full.
+ * A message that did not fit, or that waits for an open message of the
+ * thru stream, is left in @p pending. Queued System Real-Time messages
+ * are placed first when @p realtime is set.
+ *
+ * @return Number of messages added to the buffer.
+ */
+static size_t fill_tx_buffer(struct midi_serial_out_dev_data *out, uint8_t *buf,
+			     size_t *len, midi_msg_t **pending, bool realtime)
+{
+	size_t size = tx_payload_size(out);
+	midi_msg_t *msg;
+	size_t rt_pos = 0;
+	size_t wire_len;
+	size_t count = 0;
+
+	while (realtime && (*len < size) &&
+	       (msg = k_fifo_get(&out->rt_queue, K_NO_WAIT))) {
+		/** Real-time bytes go ahead of what is already merged */
+		memmove(buf + rt_pos + 1, buf + rt_pos, *len - rt_pos);
+		buf[rt_pos++] = msg->data[0];
+		(*len)++;
+		MIDI_TRACE(SEND, msg, msg->len);
+		k_fifo_put(&out->sent_queue, msg);
+		count++;
+	}
+
+	if (!*pending || thru_msg_open(out)) {
+		fill_thru_bytes(out, buf, len, size);
+	}
+
+	while (*pending || (*pending = k_fifo_get(&out->tx_queue, K_NO_WAIT))) {
+		msg = *pending;
+
+		if (!out->fast_link && thru_msg_open(out)) {
+			break;
+		}
+		wire_len = msg->len + (out->fast_link ? FAST_LINK_ENTRY_HEADER_SIZE : 0);
+
+		if ((msg->len == 0) || (wire_len > size)) {
+			LOG_WRN("Can not send midi message of length %d", msg->len);
+			*pending = NULL;
+			k_fifo_put(&out->sent_queue, msg);
+			count++;
+			continue;
+		}
+
+		if (wire_len > (size - *len)) {
+			/** Buffer is full */
+			break;
+		}
+
+#if defined(CONFIG_MIDI_SERIAL_JITTER_HISTOGRAM)
+		if (out->timestamp_setting == MIDI_TIMESTAMP_ON) {
+			record_jitter(out, msg);
+		}
+#endif
+		if (out->fast_link) {
+			*len += fast_link_entry_header(buf + *len, msg->format,
+						       msg->len, msg->timestamp);
+			memcpy(buf + *len, msg->data, msg->len);
+			*len += msg->len;
+		} else {
+			*len += encode_serial_msg(out, buf + *len, msg);
+		}
+		*pending = NULL;
+		MIDI_TRACE(SEND, msg, msg->len);
+		k_fifo_put(&out->sent_queue, msg);
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * @brief Send queued System Real-Time messages in the middle of a transfer.
+ *
+ * The running transfer is aborted, the real-time bytes are sent on their
+ * own and the rest of the aborted transfer is started again. Any byte
+ * boundary is a legal point for a System Real-Time message.
+ *
+ * @return true if part of the aborted transfer is still in flight.
+ */
+static bool insert_realtime(struct midi_serial_dev_data *serial_dev_data,
+			    uint8_t **flight_buf, size_t *flight_len)
+{
+	struct midi_serial_out_dev_data *out = serial_dev_data->out;
+	midi_msg_t *rt_msgs[MIDI_SERIAL_RT_BUF_SIZE];
+	size_t sent = *flight_len;
+	size_t rt_len = 0;
+
+	out->tx_aborted_len = -1;
+	uart_tx_abort(serial_dev_data->uart_dev);
+	k_sem_take(&out->tx_sem, K_FOREVER);
+	if (out->tx_aborted_len >= 0) {
+		sent = out->tx_aborted_len;
+	}
+
+	while ((rt_len < MIDI_SERIAL_RT_BUF_SIZE) &&
+	       (rt_msgs[rt_len] = k_fifo_get(&out->rt_queue, K_NO_WAIT))) {
+		out->rt_buffer[rt_len] = rt_msgs[rt_len]->data[0];
+		rt_len++;
+	}
+
+	if (!uart_tx(serial_dev_data->uart_dev, out->rt_buffer, rt_len, SYS_FOREVER_MS)) {
+		k_sem_take(&out->tx_sem, K_FOREVER);
+	} else {
+		LOG_WRN("Failed to send uart midi");
+	}
+
+	for (size_t i = 0; i < rt_len; i++) {
+		complete_sent_msg(out, rt_msgs[i]);
+	}
+
+	if (sent >= *flight_len) {
+		return false;
+	}
+
+	*flight_buf += sent;
+	*flight_len -= sent;
+	if(uart_tx(serial_dev_data->uart_dev, *flight_buf, *flight_len, SYS_FOREVER_MS)) {
+		LOG_WRN("Failed to send uart midi");
+		return false;
+	}
+
+	return true;
+}
+
 void midi_tx_thread(struct midi_serial_dev_data *serial_dev_data)
 {
-	int32_t msg_delay;
 	struct midi_serial_out_dev_data * out = serial_dev_data->out;
-	midi_msg_t *msg = NULL;
+	struct k_poll_event events[4];
+	midi_msg_t *pending = NULL;
+	uint8_t *buf;
+	uint8_t *frame;
+	size_t frame_len;
+	uint8_t *flight_buf = NULL;
+	uint8_t buf_idx = 0;
+	size_t count = 0;
+	size_t in_flight_count = 0;
+	bool in_flight = false;
+	size_t flight_len = 0;
+	size_t len = 0;
+
+	k_poll_event_init(&events[0], K_POLL_TYPE_SEM_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &out->tx_sem);
+	k_poll_event_init(&events[1], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &out->rt_queue);
+	k_poll_event_init(&events[2], K_POLL_TYPE_SIGNAL,
+			  K_POLL_MODE_NOTIFY_ONLY, &out->thru_signal);
+	k_poll_event_init(&events[3], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &out->tx_queue);
 
 	for (;;) {
-		/* Wait indefinitely for data to be sent over bluetooth NOTE: ???*/
-		k_sem_take(&out->tx_sem, K_FOREVER);
-		if (msg) {
-			if(out->api->midi_transfer_done) {
-				out->api->midi_transfer_done(out->dev, msg, out->user_data);
-			} else {
-				midi_msg_unref(msg);
+		/** Merge everything queued into the buffer not owned by the UART */
+		buf = out->tx_buffers[buf_idx] + tx_payload_offset(out);
+		k_poll_signal_reset(&out->thru_signal);
+		count += fill_tx_buffer(out, buf, &len, &pending, !in_flight);
+
+		if (in_flight) {
+			if (k_sem_take(&out->tx_sem, K_NO_WAIT)) {
+				if (!k_fifo_is_empty(&out->rt_queue)) {
+					/** Real-time messages do not wait for the transfer */
+					in_flight = insert_realtime(serial_dev_data,
+								    &flight_buf, &flight_len);
+					if (!in_flight) {
+						complete_sent_msgs(out, in_flight_count);
+						k_sem_give(&out->tx_sem);
+					}
+					continue;
+				}
+
+				/** Wait for the transfer to finish, a real-time message,
+				 * or more data to merge if there is room for it.
+				 */
+				k_poll(events, (pending || (len >= tx_payload_size(out))) ?
+					2 : ARRAY_SIZE(events), K_FOREVER);
+				events[0].state = K_POLL_STATE_NOT_READY;
+				events[1].state = K_POLL_STATE_NOT_READY;
+				events[2].state = K_POLL_STATE_NOT_READY;
+				events[3].state = K_POLL_STATE_NOT_READY;
+				continue;
 			}
-		}
-		msg = k_fifo_get(&out->tx_queue, K_FOREVER);
-		if (out->timestamp_setting == MIDI_TIMESTAMP_ON)
-		{
-			if (msg->format == MIDI_FORMAT_1_0_PARSED_DELTA_US) {
-				k_sleep(K_USEC(msg->timestamp));
-				// LOG_INF("Timestamp: %d", msg->timestamp);
-			} else {
-				msg_delay = (int32_t)((msg->timestamp) -
-					(k_ticks_to_ms_near32((uint32_t)k_uptime_ticks()) % 8192));
-				if (msg_delay > 0) {
-					k_sleep(K_MSEC(msg_delay));
+			complete_sent_msgs(out, in_flight_count);
+			in_flight = false;
+			if (!k_fifo_is_empty(&out->rt_queue)) {
+				/** Put real-time messages ahead of the merged buffer */
+				k_sem_give(&out->tx_sem);
+				continue;
+			}
+		} else {
+			if ((len == 0) && pending) {
+				/** Wait for the rest of the open thru message, not the queue */
+				complete_sent_msgs(out, count);
+				count = 0;
+				k_poll(&events[1], 2, K_MSEC(MIDI_SERIAL_THRU_HOLD_MS));
+				events[1].state = K_POLL_STATE_NOT_READY;
+				events[2].state = K_POLL_STATE_NOT_READY;
+				continue;
+			}
+			if (len == 0) {
+				complete_sent_msgs(out, count);
+				count = 0;
+#if defined(CONFIG_MIDI_SERIAL_ACTIVE_SENSING)
+				if (k_poll(&events[1], 3,
+					K_MSEC(CONFIG_MIDI_SERIAL_ACTIVE_SENSING_INTERVAL_MS)) &&
+				    !out->fast_link) {
+					/** Output has been idle, send active sensing */
+					buf[len++] = 0xFE;
+				}
+#else
+				k_poll(&events[1], 3, K_FOREVER);
+#endif
+				events[1].state = K_POLL_STATE_NOT_READY;
+				events[2].state = K_POLL_STATE_NOT_READY;
+				events[3].state = K_POLL_STATE_NOT_READY;
+				if (len == 0) {
+					continue;
 				}
 			}
-		
+			k_sem_take(&out->tx_sem, K_FOREVER);
+		}
+
+		if (len == 0) {
+			complete_sent_msgs(out, count);
+			count = 0;
+			k_sem_give(&out->tx_sem);
+			continue;
+		}
+
+		frame = buf - tx_payload_offset(out);
+		frame_len = len;
+#if defined(CONFIG_MIDI_SERIAL_FAST_LINK)
+		if (out->fast_link) {
+			frame_len = fast_link_seal(out, frame, len);
 		}
-		if(uart_tx(serial_dev_data->uart_dev, 
-				msg->data, msg->len, SYS_FOREVER_MS)) {
+#endif
+
+		if(uart_tx(serial_dev_data->uart_dev, frame, frame_len, SYS_FOREVER_MS)) {
 			LOG_WRN("Failed to send uart midi");
+			complete_sent_msgs(out, count);
+			k_sem_give(&out->tx_sem);
+		} else {
+			in_flight_count = count;
+			in_flight = true;
+			flight_buf = frame;
+			flight_len = frame_len;
+			buf_idx ^= 1;
 		}
+
+		count = 0;
+		len = 0;
 	}
 }
 
+#define MIDI_SERIAL_RX_BUF_SIZE(dev) DT_PROP(SERIAL_IN_DEV_N_ID(dev), rx_buffer_size)
+
+#define MIDI_SERIAL_FAST_LINK(dev) DT_PROP(MIDI_SERIAL_DEV_N_ID(dev), fast_link)
+
+#define DEFINE_MIDI_SERIAL_FAST_LINK_RX(dev)									\
+	COND_CODE_1(MIDI_SERIAL_FAST_LINK(dev),									\
+		(static struct midi_serial_fast_link_rx midi_serial_fast_link_rx_##dev;),	\
+		())
+
+/* 1 if an input node copies its bytes to the output node target */
+#define MIDI_SERIAL_THRU_TO(node_id, target)									\
+	+ COND_CODE_1(DT_NODE_HAS_PROP(node_id, thru),							\
+		(DT_SAME_NODE(DT_PHANDLE(node_id, thru), target)), (0))
+
+/* Number of input nodes copying their bytes to the output node target */
+#define MIDI_SERIAL_THRU_INPUTS(target)										\
+	(0 DT_FOREACH_STATUS_OKAY_VARGS(COMPAT_MIDI_SERIAL_IN_DEVICE, MIDI_SERIAL_THRU_TO, target))
+
 #define DEFINE_MIDI_SERIAL_IN_DEV_DATA(dev)										\
-	static struct midi_serial_in_dev_data midi_serial_in_dev_data_##dev; 			
+	BUILD_ASSERT(!MIDI_SERIAL_FAST_LINK(dev) ||									\
+		!DT_NODE_HAS_PROP(SERIAL_IN_DEV_N_ID(dev), thru),						\
+		"thru is not supported on fast link ports");							\
+	COND_CODE_1(DT_NODE_HAS_PROP(SERIAL_IN_DEV_N_ID(dev), thru),				\
+		(BUILD_ASSERT(MIDI_SERIAL_THRU_INPUTS(										\
+			DT_PHANDLE(SERIAL_IN_DEV_N_ID(dev), thru)) == 1,						\
+			"thru port shared by several inputs, their bytes would interleave");), \
+		())																		\
+	static uint8_t midi_serial_rx_buf_##dev[2][MIDI_SERIAL_RX_BUF_SIZE(dev)];	\
+	DEFINE_MIDI_SERIAL_FAST_LINK_RX(dev)										\
+	static struct midi_serial_in_dev_data midi_serial_in_dev_data_##dev = {		\
+		.rx_buffers = {midi_serial_rx_buf_##dev[0], midi_serial_rx_buf_##dev[1]},	\
+		.rx_buffer_size = MIDI_SERIAL_RX_BUF_SIZE(dev),							\
+		COND_CODE_1(DT_NODE_HAS_PROP(SERIAL_IN_DEV_N_ID(dev), thru),			\
+			(.thru_dev = DEVICE_DT_GET(DT_PHANDLE(SERIAL_IN_DEV_N_ID(dev), thru)),), \
+			(.thru_dev = NULL,))												\
+		.thru_filter = DT_PROP(SERIAL_IN_DEV_N_ID(dev), thru_filter),			\
+		COND_CODE_1(MIDI_SERIAL_FAST_LINK(dev),									\
+			(.fast_link = &midi_serial_fast_link_rx_##dev,),					\
+			(.fast_link = NULL,))												\
+	};
+
+#define MIDI_SERIAL_TX_BUF_SIZE(dev) DT_PROP(SERIAL_OUT_DEV_N_ID(dev), tx_buffer_size)
 
 #define DEFINE_MIDI_SERIAL_OUT_DEV_DATA(dev)									\
+	BUILD_ASSERT(!MIDI_SERIAL_FAST_LINK(dev) ||									\
+		(MIDI_SERIAL_TX_BUF_SIZE(dev) > FAST_LINK_OVERHEAD + FAST_LINK_ENTRY_HEADER_SIZE), \
+		"tx-buffer-size too small for a fast link frame");						\
+	static uint8_t midi_serial_tx_buf_##dev[2][MIDI_SERIAL_TX_BUF_SIZE(dev)];	\
 	static struct midi_serial_out_dev_data midi_serial_out_dev_data_##dev = {	\
+		.tx_buffers = {midi_serial_tx_buf_##dev[0], midi_serial_tx_buf_##dev[1]},	\
+		.tx_buffer_size = MIDI_SERIAL_TX_BUF_SIZE(dev),							\
+		.fast_link = MIDI_SERIAL_FAST_LINK(dev),								\
 		COND_CODE_1(DT_PROP(SERIAL_OUT_DEV_N_ID(dev), handle_timestamps),		\
 		(.timestamp_setting = MIDI_TIMESTAMP_ON,), 					\
 		(.timestamp_setting = MIDI_TIMESTAMP_OFF,))																		\
 	};																			\
 
 #define DEFINE_MIDI_SERIAL_DEV_DATA(dev)				\
+	BUILD_ASSERT(!MIDI_SERIAL_FAST_LINK(dev) ||					\
+		IS_ENABLED(CONFIG_MIDI_SERIAL_FAST_LINK),				\
+		"fast-link requires CONFIG_MIDI_SERIAL_FAST_LINK");		\
 	COND_NODE_HAS_COMPAT_CHILD(MIDI_SERIAL_DEV_N_ID(dev), 		\
 		COMPAT_MIDI_SERIAL_IN_DEVICE, 					\
 		(DEFINE_MIDI_SERIAL_IN_DEV_DATA(dev)), ()) 		\
@@ -361,6 +1351,7 @@ void midi_tx_thread(struct midi_serial_dev_data *serial_dev_data)
 #define DEFINE_MIDI_IN_DEVICE(dev)					  			\
 	static struct midi_api midi_serial_in_api_##dev = {			\
 		.midi_callback_set = midi_serial_in_port_callback_set,	\
+		.midi_stats_get = midi_serial_in_stats_get,				\
 	};															\
 	DEVICE_DT_DEFINE(SERIAL_IN_DEV_N_ID(dev),			  			\
 			    &midi_serial_in_device_init,			  			\
@@ -374,6 +1365,7 @@ void midi_tx_thread(struct midi_serial_dev_data *serial_dev_data)
 	static struct midi_api midi_serial_out_api_##dev = {			\
 		.midi_transfer = send_to_serial_port,					\
 		.midi_callback_set = midi_serial_out_port_callback_set,	\
+		.midi_stats_get = midi_serial_out_stats_get,			\
 	};															\
 	DEVICE_DT_DEFINE(SERIAL_OUT_DEV_N_ID(dev),			  			\
 			    &midi_serial_out_device_init,			  			\
@@ -400,8 +1392,7 @@ void midi_tx_thread(struct midi_serial_dev_data *serial_dev_data)
 	DEFINE_MIDI_OUT_THREADS(dev)
 
 #define MIDI_SERIAL_DEVICE(dev, _) \
-	COND_CODE_1(UTIL_AND(DT_NODE_HAS_COMPAT(SERIAL_DEV_N_ID(dev), \
-		nordic_nrf_uarte), DT_NODE_HAS_STATUS(SERIAL_DEV_N_ID(dev), okay)),( \
+	COND_CODE_1(DT_NODE_HAS_STATUS(SERIAL_DEV_N_ID(dev), okay),( \
 	DEFINE_MIDI_SERIAL_DEV_DATA(dev)\
 	COND_NODE_HAS_COMPAT_CHILD(MIDI_SERIAL_DEV_N_ID(dev), \
 		COMPAT_MIDI_SERIAL_IN_DEVICE, \
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI shell commands
+ */
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/shell/shell.h>
+
+#include "midi/midi.h"
+
+static int cmd_midi_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	const struct device *dev;
+	struct midi_stats stats;
+	bool reset = false;
+	int err;
+
+	dev = device_get_binding(argv[1]);
+	if (!dev) {
+		shell_error(sh, "Device %s not found", argv[1]);
+		return -ENODEV;
+	}
+
+	if (argc > 2) {
+		if (strcmp(argv[2], "reset")) {
+			shell_error(sh, "Unknown argument %s", argv[2]);
+			return -EINVAL;
+		}
+		reset = true;
+	}
+
+	err = midi_stats_get(dev, &stats, reset);
+	if (err) {
+		shell_error(sh, "Can not read counters of %s (err %d)", dev->name, err);
+		return err;
+	}
+
+	shell_print(sh, "rx:      %u msgs, %u bytes", stats.rx_msgs, stats.rx_bytes);
+	shell_print(sh, "tx:      %u msgs, %u bytes", stats.tx_msgs, stats.tx_bytes);
+	shell_print(sh, "dropped: alloc %u, queue full %u, late %u, parse %u, too long %u",
+		    stats.drop_alloc, stats.drop_queue_full, stats.drop_late, stats.drop_parse,
+		    stats.drop_too_long);
+	shell_print(sh, "queue:   high water %u", stats.queue_high_water);
+	if (stats.tx_msgs) {
+		shell_print(sh, "latency: min %u us, avg %u us, max %u us",
+			    stats.latency_min_us,
+			    (uint32_t)(stats.latency_sum_us / stats.tx_msgs),
+			    stats.latency_max_us);
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(midi_cmds,
+	SHELL_CMD_ARG(stats, NULL, "Print port counters: stats <device> [reset]",
+		      cmd_midi_stats, 2, 1),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(midi, &midi_cmds, "MIDI commands", NULL);
@@ -0,0 +1,596 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI SPI driver
+ *
+ * Driver for MIDI between two MCUs over SPI
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/drivers/gpio.h>
+#include "midi_spi_internal.h"
+
+#include "midi/midi.h"
+
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/device.h>
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_spi
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+/**
+ * Frame: flags and a 16-bit payload length, followed by the payload. The
+ * payload holds one entry per message: format, length, 16-bit timestamp
+ * and the message data. The rest of the frame is padding.
+ */
+#define MIDI_SPI_FRAME_HEADER_SIZE 3
+#define MIDI_SPI_ENTRY_HEADER_SIZE 4
+
+/** The sender has more messages queued than fit in the frame */
+#define MIDI_SPI_FLAG_PENDING BIT(0)
+
+/**
+ * Time between arming and a request pulse on the ready line, so that the
+ * controller takes them as two edges.
+ */
+#define MIDI_SPI_REQUEST_GAP_US 20
+
+struct midi_spi_port_data {
+
+	struct midi_api *api;
+
+	const struct device *dev;
+
+	void *user_data;
+};
+
+struct midi_spi_dev_data {
+
+	struct spi_dt_spec bus;
+
+	struct gpio_dt_spec ready;
+
+	/** SPI slave side, drives the ready line */
+	bool peripheral;
+
+	bool initialized;
+
+	uint8_t *tx_frame;
+
+	uint8_t *rx_frame;
+
+	size_t frame_size;
+
+	struct k_fifo tx_queue;
+
+	/** Messages in the frame being exchanged */
+	struct k_fifo sent_queue;
+
+	/** Message that did not fit in the previous frame */
+	midi_msg_t *pending;
+
+	/** Controller: rising edge of the ready line */
+	struct k_poll_signal ready_signal;
+
+	struct gpio_callback ready_cb;
+
+	/** Controller: the peripheral has armed the next exchange */
+	atomic_t ready_armed;
+
+	/** Controller: the peripheral asked for the armed exchange */
+	atomic_t ready_request;
+
+	/** Peripheral: end of the armed exchange */
+	struct k_poll_signal xfer_signal;
+
+	struct midi_spi_port_data *in;
+
+	struct midi_spi_port_data *out;
+};
+
+static void ready_isr(const struct device *port, struct gpio_callback *cb,
+		      gpio_port_pins_t pins)
+{
+	struct midi_spi_dev_data *data = CONTAINER_OF(cb, struct midi_spi_dev_data, ready_cb);
+
+	/** The first edge after an exchange arms the next one, others are requests */
+	if (atomic_set(&data->ready_armed, true)) {
+		atomic_set(&data->ready_request, true);
+	}
+
+	k_poll_signal_raise(&data->ready_signal, 0);
+}
+
+static int midi_spi_init(struct midi_spi_dev_data *data)
+{
+	int err;
+
+	if (data->initialized) {
+		return 0;
+	}
+
+	k_fifo_init(&data->tx_queue);
+	k_fifo_init(&data->sent_queue);
+	k_poll_signal_init(&data->ready_signal);
+	k_poll_signal_init(&data->xfer_signal);
+
+	if (!spi_is_ready_dt(&data->bus)) {
+		LOG_WRN("SPI device not found!");
+		return -ENXIO;
+	}
+
+	if (!device_is_ready(data->ready.port)) {
+		LOG_WRN("Ready GPIO not found!");
+		return -ENXIO;
+	}
+
+	if (data->peripheral) {
+		err = gpio_pin_configure_dt(&data->ready, GPIO_OUTPUT_INACTIVE);
+		if (err) {
+			return err;
+		}
+	} else {
+		err = gpio_pin_configure_dt(&data->ready, GPIO_INPUT);
+		if (err) {
+			return err;
+		}
+		gpio_init_callback(&data->ready_cb, ready_isr, BIT(data->ready.pin));
+		err = gpio_add_callback(data->ready.port, &data->ready_cb);
+		if (err) {
+			return err;
+		}
+		err = gpio_pin_interrupt_configure_dt(&data->ready, GPIO_INT_EDGE_TO_ACTIVE);
+		if (err) {
+			return err;
+		}
+	}
+
+	data->initialized = true;
+
+	return 0;
+}
+
+int midi_spi_in_port_callback_set(const struct device *dev,
+				 midi_transfer cb,
+				 void *user_data)
+{
+	struct midi_spi_dev_data *spi_dev_data = dev->data;
+
+	if(spi_dev_data->in) {
+		spi_dev_data->in->api->midi_transfer_done = cb;
+		spi_dev_data->in->user_data = user_data;
+		return 0;
+	}
+
+	return -ENOTSUP;
+}
+
+int midi_spi_out_port_callback_set(const struct device *dev,
+				 midi_transfer cb,
+				 void *user_data)
+{
+	struct midi_spi_dev_data *spi_dev_data = dev->data;
+
+	if(spi_dev_data->out) {
+		spi_dev_data->out->api->midi_transfer_done = cb;
+		spi_dev_data->out->user_data = user_data;
+		return 0;
+	}
+
+	return -ENOTSUP;
+}
+
+static int midi_spi_in_device_init(const struct device *dev)
+{
+	struct midi_spi_dev_data *spi_dev_data = dev->data;
+
+	spi_dev_data->in->dev = dev;
+	spi_dev_data->in->api = (struct midi_api*)dev->api;
+
+	LOG_INF("Init MIDI SPI IN PORT: dev %p (%s)", dev, dev->name);
+
+	return midi_spi_init(spi_dev_data);
+}
+
+static int midi_spi_out_device_init(const struct device *dev)
+{
+	struct midi_spi_dev_data *spi_dev_data = dev->data;
+
+	spi_dev_data->out->dev = dev;
+	spi_dev_data->out->api = (struct midi_api*)dev->api;
+
+	LOG_INF("Init MIDI SPI OUT PORT: dev %p (%s)", dev, dev->name);
+
+	return midi_spi_init(spi_dev_data);
+}
+
+/**
+ * @brief Ask the controller for the armed exchange with a short pulse on
+ * the ready line.
+ *
+ * @param armed_at Cycle count when the ready line became active.
+ */
+static void request_exchange(struct midi_spi_dev_data *data, uint32_t armed_at)
+{
+	uint32_t armed_us = k_cyc_to_us_floor32(k_cycle_get_32() - armed_at);
+
+	if (armed_us < MIDI_SPI_REQUEST_GAP_US) {
+		k_busy_wait(MIDI_SPI_REQUEST_GAP_US - armed_us);
+	}
+
+	gpio_pin_set_dt(&data->ready, 0);
+	k_busy_wait(1);
+	gpio_pin_set_dt(&data->ready, 1);
+}
+
+static int send_to_spi_port(const struct device *dev,
+				    midi_msg_t *msg,
+					void *user_data)
+{
+	struct midi_spi_dev_data *spi_dev_data = dev->data;
+
+	if(!spi_dev_data->out) {
+		return -ENOTSUP;
+	}
+
+	if (MIDI_SPI_FRAME_HEADER_SIZE + MIDI_SPI_ENTRY_HEADER_SIZE + msg->len >
+	    spi_dev_data->frame_size) {
+		LOG_WRN("Can not send midi message of length %d", msg->len);
+		return -EINVAL;
+	}
+
+	msg->time_us = midi_time_now_us();
+	MIDI_TRACE(ENQUEUE, msg, msg->len);
+	k_fifo_put(&spi_dev_data->tx_queue, msg);
+
+	return 0;
+}
+
+/** @return true if the frame carries at least one message. */
+static bool fill_tx_frame(struct midi_spi_dev_data *data)
+{
+	uint8_t *frame = data->tx_frame;
+	size_t len = MIDI_SPI_FRAME_HEADER_SIZE;
+	uint8_t flags = 0;
+	midi_msg_t *msg;
+
+	while (data->pending || (data->pending = k_fifo_get(&data->tx_queue, K_NO_WAIT))) {
+		msg = data->pending;
+
+		if (MIDI_SPI_ENTRY_HEADER_SIZE + msg->len > data->frame_size - len) {
+			/** Frame is full */
+			flags |= MIDI_SPI_FLAG_PENDING;
+			break;
+		}
+
+		frame[len] = msg->format;
+		frame[len + 1] = msg->len;
+		sys_put_le16(msg->timestamp, &frame[len + 2]);
+		memcpy(&frame[len + MIDI_SPI_ENTRY_HEADER_SIZE], msg->data, msg->len);
+		len += MIDI_SPI_ENTRY_HEADER_SIZE + msg->len;
+
+		data->pending = NULL;
+		MIDI_TRACE(SEND, msg, msg->len);
+		k_fifo_put(&data->sent_queue, msg);
+	}
+
+	frame[0] = flags;
+	sys_put_le16(len - MIDI_SPI_FRAME_HEADER_SIZE, &frame[1]);
+
+	return len > MIDI_SPI_FRAME_HEADER_SIZE;
+}
+
+static void complete_sent_msgs(struct midi_spi_dev_data *data)
+{
+	midi_msg_t *msg;
+
+	while ((msg = k_fifo_get(&data->sent_queue, K_NO_WAIT))) {
+		MIDI_TRACE(COMPLETE, msg, msg->len);
+		if(data->out->api->midi_transfer_done) {
+			data->out->api->midi_transfer_done(data->out->dev, msg,
+							   data->out->user_data);
+		} else {
+			midi_msg_unref(msg);
+		}
+	}
+}
+
+/**
+ * @brief Pass the messages of a received frame to the input port.
+ *
+ * @return true if the other side has more messages queued.
+ */
+static bool parse_rx_frame(struct midi_spi_dev_data *data)
+{
+	uint8_t *frame = data->rx_frame;
+	size_t payload_len = sys_get_le16(&frame[1]);
+	uint8_t *payload = &frame[MIDI_SPI_FRAME_HEADER_SIZE];
+	midi_msg_t *msg;
+	size_t pos = 0;
+	uint8_t len;
+
+	if (MIDI_SPI_FRAME_HEADER_SIZE + payload_len > data->frame_size) {
+		LOG_WRN("Malformed midi spi frame");
+		return false;
+	}
+
+	while (pos + MIDI_SPI_ENTRY_HEADER_SIZE <= payload_len) {
+		len = payload[pos + 1];
+		if (pos + MIDI_SPI_ENTRY_HEADER_SIZE + len > payload_len) {
+			LOG_WRN("Malformed midi spi frame");
+			break;
+		}
+
+		if (!data->in || (len == 0)) {
+			pos += MIDI_SPI_ENTRY_HEADER_SIZE + len;
+			continue;
+		}
+
+		msg = midi_msg_alloc(NULL, len);
+		if (!msg || !msg->data) {
+			LOG_WRN("could not allocate midi buffer!");
+			midi_msg_unref(msg);
+			break;
+		}
+		msg->format = payload[pos];
+		msg->len = len;
+		msg->timestamp = sys_get_le16(&payload[pos + 2]);
+		msg->time_us = midi_time_now_us();
+		memcpy(msg->data, &payload[pos + MIDI_SPI_ENTRY_HEADER_SIZE], len);
+		MIDI_TRACE(RECEIVE, msg, len);
+
+		if(data->in->api->midi_transfer_done) {
+			data->in->api->midi_transfer_done(data->in->dev, msg, data->in->user_data);
+		} else {
+			midi_msg_unref(msg);
+		}
+		pos += MIDI_SPI_ENTRY_HEADER_SIZE + len;
+	}
+
+	return frame[0] & MIDI_SPI_FLAG_PENDING;
+}
+
+/**
+ * @brief Exchange frames as SPI master.
+ *
+ * An exchange is started when there is something to send, when the
+ * peripheral reported more queued messages in the previous frame, or when
+ * the peripheral pulses the ready line. After each exchange the controller
+ * waits for the ready line to become active again, meaning the peripheral
+ * has armed the next exchange. The edges are sorted in ready_isr(), so a
+ * pulse right after arming is not taken for the arming edge.
+ */
+static void midi_spi_controller_run(struct midi_spi_dev_data *data)
+{
+	struct spi_buf tx_buf = { .buf = data->tx_frame, .len = data->frame_size };
+	struct spi_buf rx_buf = { .buf = data->rx_frame, .len = data->frame_size };
+	const struct spi_buf_set tx = { .buffers = &tx_buf, .count = 1 };
+	const struct spi_buf_set rx = { .buffers = &rx_buf, .count = 1 };
+	struct k_poll_event events[2];
+	bool rx_pending = false;
+	int err;
+
+	k_poll_event_init(&events[0], K_POLL_TYPE_SIGNAL,
+			  K_POLL_MODE_NOTIFY_ONLY, &data->ready_signal);
+	k_poll_event_init(&events[1], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &data->tx_queue);
+
+	atomic_set(&data->ready_armed, gpio_pin_get_dt(&data->ready) > 0);
+
+	for (;;) {
+		k_poll_signal_reset(&data->ready_signal);
+		events[0].state = K_POLL_STATE_NOT_READY;
+		events[1].state = K_POLL_STATE_NOT_READY;
+
+		if (!atomic_get(&data->ready_armed)) {
+			if (k_poll(&events[0], 1, K_MSEC(CONFIG_MIDI_SPI_READY_TIMEOUT_MS)) &&
+			    (gpio_pin_get_dt(&data->ready) > 0)) {
+				/** The arming edge was missed */
+				atomic_set(&data->ready_armed, true);
+			}
+			continue;
+		}
+
+		if (!atomic_get(&data->ready_request) && !rx_pending && !data->pending &&
+		    k_fifo_is_empty(&data->tx_queue)) {
+			k_poll(events, ARRAY_SIZE(events), K_FOREVER);
+			continue;
+		}
+
+		fill_tx_frame(data);
+
+		err = spi_transceive_dt(&data->bus, &tx, &rx);
+		/** Pulses during the exchange are repeated once the next one is armed */
+		atomic_set(&data->ready_armed, false);
+		atomic_set(&data->ready_request, false);
+		if (err) {
+			LOG_WRN("Failed to exchange midi spi frame, err %d", err);
+			rx_pending = false;
+		} else {
+			rx_pending = parse_rx_frame(data);
+		}
+
+		complete_sent_msgs(data);
+	}
+}
+
+/**
+ * @brief Exchange frames as SPI slave.
+ *
+ * The next exchange is always armed, with whatever is queued at that
+ * time, and the ready line is active while it is armed. The controller is
+ * asked for the exchange once if the armed frame carries messages, or if
+ * messages are queued while it is armed.
+ */
+static void midi_spi_peripheral_run(struct midi_spi_dev_data *data)
+{
+	struct spi_buf tx_buf = { .buf = data->tx_frame, .len = data->frame_size };
+	struct spi_buf rx_buf = { .buf = data->rx_frame, .len = data->frame_size };
+	const struct spi_buf_set tx = { .buffers = &tx_buf, .count = 1 };
+	const struct spi_buf_set rx = { .buffers = &rx_buf, .count = 1 };
+	struct k_poll_event events[2];
+	unsigned int signaled;
+	uint32_t armed_at;
+	bool requested;
+	bool has_data;
+	int result;
+	int err;
+
+	k_poll_event_init(&events[0], K_POLL_TYPE_SIGNAL,
+			  K_POLL_MODE_NOTIFY_ONLY, &data->xfer_signal);
+	k_poll_event_init(&events[1], K_POLL_TYPE_FIFO_DATA_AVAILABLE,
+			  K_POLL_MODE_NOTIFY_ONLY, &data->tx_queue);
+
+	for (;;) {
+		has_data = fill_tx_frame(data);
+
+		k_poll_signal_reset(&data->xfer_signal);
+		err = spi_transceive_signal(data->bus.bus, &data->bus.config,
+					    &tx, &rx, &data->xfer_signal);
+		if (err) {
+			LOG_WRN("Failed to arm midi spi frame, err %d", err);
+			complete_sent_msgs(data);
+			k_sleep(K_MSEC(CONFIG_MIDI_SPI_READY_TIMEOUT_MS));
+			continue;
+		}
+
+		gpio_pin_set_dt(&data->ready, 1);
+		armed_at = k_cycle_get_32();
+		requested = false;
+
+		for (;;) {
+			/** Checked after arming, so a message queued meanwhile is not missed */
+			if (!requested && (has_data || data->pending ||
+					   !k_fifo_is_empty(&data->tx_queue))) {
+				request_exchange(data, armed_at);
+				requested = true;
+			}
+
+			k_poll(events, requested ? 1 : ARRAY_SIZE(events), K_FOREVER);
+			if (events[0].state == K_POLL_STATE_SIGNALED) {
+				break;
+			}
+			events[1].state = K_POLL_STATE_NOT_READY;
+		}
+		events[0].state = K_POLL_STATE_NOT_READY;
+		events[1].state = K_POLL_STATE_NOT_READY;
+
+		gpio_pin_set_dt(&data->ready, 0);
+
+		k_poll_signal_check(&data->xfer_signal, &signaled, &result);
+		if (result < 0) {
+			LOG_WRN("Failed to exchange midi spi frame, err %d", result);
+		} else {
+			/** The controller polls again for pending messages once armed */
+			parse_rx_frame(data);
+		}
+
+		complete_sent_msgs(data);
+	}
+}
+
+void midi_spi_thread(struct midi_spi_dev_data *spi_dev_data)
+{
+	if (!spi_dev_data->initialized) {
+		LOG_WRN("MIDI SPI device not initialized");
+		return;
+	}
+
+	if (spi_dev_data->peripheral) {
+		midi_spi_peripheral_run(spi_dev_data);
+	} else {
+		midi_spi_controller_run(spi_dev_data);
+	}
+}
+
+#define MIDI_SPI_FRAME_SIZE(dev) DT_PROP(MIDI_SPI_DEV_N_ID(dev), frame_size)
+
+#define MIDI_SPI_OPERATION(dev)											\
+	(SPI_WORD_SET(8) | SPI_TRANSFER_MSB |								\
+	 COND_CODE_1(DT_PROP(MIDI_SPI_DEV_N_ID(dev), peripheral),			\
+		(SPI_OP_MODE_SLAVE), (SPI_OP_MODE_MASTER)))
+
+#define DEFINE_MIDI_SPI_PORT_DATA(dev, dir)								\
+	static struct midi_spi_port_data midi_spi_##dir##_dev_data_##dev;
+
+#define DEFINE_MIDI_SPI_DEV_DATA(dev)									\
+	BUILD_ASSERT(MIDI_SPI_FRAME_SIZE(dev) >									\
+		MIDI_SPI_FRAME_HEADER_SIZE + MIDI_SPI_ENTRY_HEADER_SIZE,			\
+		"frame-size too small");											\
+	static uint8_t midi_spi_tx_frame_##dev[MIDI_SPI_FRAME_SIZE(dev)];		\
+	static uint8_t midi_spi_rx_frame_##dev[MIDI_SPI_FRAME_SIZE(dev)];		\
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_SPI_DEV_N_ID(dev),						\
+		COMPAT_MIDI_SPI_IN_DEVICE,											\
+		(DEFINE_MIDI_SPI_PORT_DATA(dev, in)), ())							\
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_SPI_DEV_N_ID(dev),						\
+		COMPAT_MIDI_SPI_OUT_DEVICE,											\
+		(DEFINE_MIDI_SPI_PORT_DATA(dev, out)), ())							\
+	static struct midi_spi_dev_data midi_spi_dev_data_##dev = {				\
+		.bus = SPI_DT_SPEC_GET(MIDI_SPI_DEV_N_ID(dev),						\
+				       MIDI_SPI_OPERATION(dev), 0),							\
+		.ready = GPIO_DT_SPEC_GET(MIDI_SPI_DEV_N_ID(dev), ready_gpios),		\
+		.peripheral = DT_PROP(MIDI_SPI_DEV_N_ID(dev), peripheral),			\
+		.tx_frame = midi_spi_tx_frame_##dev,								\
+		.rx_frame = midi_spi_rx_frame_##dev,								\
+		.frame_size = MIDI_SPI_FRAME_SIZE(dev),								\
+		COND_NODE_HAS_COMPAT_CHILD(MIDI_SPI_DEV_N_ID(dev),					\
+			COMPAT_MIDI_SPI_IN_DEVICE,										\
+			(.in = &midi_spi_in_dev_data_##dev,),							\
+			(.in = NULL,))													\
+		COND_NODE_HAS_COMPAT_CHILD(MIDI_SPI_DEV_N_ID(dev),					\
+			COMPAT_MIDI_SPI_OUT_DEVICE,										\
+			(.out = &midi_spi_out_dev_data_##dev,),							\
+			(.out = NULL,))													\
+	};
+
+#define DEFINE_MIDI_SPI_IN_DEVICE(dev)									\
+	static struct midi_api midi_spi_in_api_##dev = {					\
+		.midi_callback_set = midi_spi_in_port_callback_set,				\
+	};																	\
+	DEVICE_DT_DEFINE(SPI_IN_DEV_N_ID(dev),								\
+			    &midi_spi_in_device_init,								\
+			    NULL,													\
+			    &midi_spi_dev_data_##dev,								\
+			    NULL, APPLICATION,										\
+			    CONFIG_KERNEL_INIT_PRIORITY_DEVICE,						\
+			    &midi_spi_in_api_##dev);
+
+#define DEFINE_MIDI_SPI_OUT_DEVICE(dev)									\
+	static struct midi_api midi_spi_out_api_##dev = {					\
+		.midi_transfer = send_to_spi_port,								\
+		.midi_callback_set = midi_spi_out_port_callback_set,			\
+	};																	\
+	DEVICE_DT_DEFINE(SPI_OUT_DEV_N_ID(dev),								\
+			    &midi_spi_out_device_init,								\
+			    NULL,													\
+			    &midi_spi_dev_data_##dev,								\
+			    NULL, APPLICATION,										\
+			    CONFIG_KERNEL_INIT_PRIORITY_DEVICE,						\
+			    &midi_spi_out_api_##dev);
+
+#define DEFINE_MIDI_SPI_THREAD(dev)										\
+	K_THREAD_DEFINE(midi_spi_thread_##dev, 1024,						\
+		midi_spi_thread, &midi_spi_dev_data_##dev, NULL, NULL, 7, 0, 0);
+
+#define MIDI_SPI_DEVICE(dev, _) \
+	DEFINE_MIDI_SPI_DEV_DATA(dev) \
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_SPI_DEV_N_ID(dev), \
+		COMPAT_MIDI_SPI_IN_DEVICE, \
+		(DEFINE_MIDI_SPI_IN_DEVICE(dev)), ()) \
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_SPI_DEV_N_ID(dev), \
+		COMPAT_MIDI_SPI_OUT_DEVICE, \
+		(DEFINE_MIDI_SPI_OUT_DEVICE(dev)), ()) \
+	DEFINE_MIDI_SPI_THREAD(dev)
+
+LISTIFY(MIDI_SPI_DEVICE_COUNT, MIDI_SPI_DEVICE, ());
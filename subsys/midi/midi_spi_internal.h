@@ -0,0 +1,44 @@
+/**
+ * @file
+ * @brief SPI MIDI internal header
+ *
+ * This header file is used to store internal configuration
+ * defines.
+ */
+
+#include "sys/util_macro_expansion.h"
+#include <zephyr/sys/util_internal.h>
+
+#ifndef ZEPHYR_INCLUDE_MIDI_SPI_INTERNAL_H_
+#define ZEPHYR_INCLUDE_MIDI_SPI_INTERNAL_H_
+
+#define COMPAT_MIDI_SPI_DEVICE midi_spi_device
+#define COMPAT_MIDI_SPI_IN_DEVICE midi_spi_in_device
+#define COMPAT_MIDI_SPI_OUT_DEVICE midi_spi_out_device
+
+#define NODE_LIST(node_id) LIST(node_id, _)
+
+#define COMPAT_LIST(i, compat) 					\
+	COND_CODE_1(DT_NODE_HAS_COMPAT(i, compat), (i), ()),
+
+/* List of children with a given compatible of a node*/
+#define COMPAT_CHILDREN_LIST(node_id, compat)	\
+	LIST_DROP_EMPTY(FOR_EACH_FIXED_ARG(			\
+			COMPAT_LIST, (), compat, DT_FOREACH_CHILD(node_id, NODE_LIST)))
+
+/* Number of children with a given compatible of a node*/
+#define COND_NODE_HAS_COMPAT_CHILD(node_id, compat, if_code, else_code)	\
+	COND_CODE_1(DT_NODE_EXISTS(GET_ARG_N(1, COMPAT_CHILDREN_LIST(node_id, compat))),	\
+	 if_code, else_code)
+
+/* Number of MIDI SPI devices*/
+#define MIDI_SPI_DEVICE_COUNT  DT_NUM_INST_STATUS_OKAY(COMPAT_MIDI_SPI_DEVICE)
+
+/* Get MIDI SPI device node ID */
+#define MIDI_SPI_DEV_N_ID(dev)	        DT_INST(dev, COMPAT_MIDI_SPI_DEVICE)
+#define SPI_IN_DEV_N_ID(dev)	\
+	GET_ARG_N(1, COMPAT_CHILDREN_LIST(MIDI_SPI_DEV_N_ID(dev), COMPAT_MIDI_SPI_IN_DEVICE))
+#define SPI_OUT_DEV_N_ID(dev)	\
+	GET_ARG_N(1, COMPAT_CHILDREN_LIST(MIDI_SPI_DEV_N_ID(dev), COMPAT_MIDI_SPI_OUT_DEVICE))
+
+#endif /* ZEPHYR_INCLUDE_MIDI_SPI_INTERNAL_H_ */
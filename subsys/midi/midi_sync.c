@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI sync
+ *
+ * Clock times are kept in 1/65536 microseconds and computed from a base
+ * clock, so rounding does not add up over a song.
+ */
+#include <zephyr/kernel.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi/midi.h"
+#include "midi/midi_sync.h"
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_sync
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#define Q16(us) ((int64_t)(us) << 16)
+
+#define MIDI_STATUS_SPP 0xF2
+#define MIDI_STATUS_CLOCK 0xF8
+#define MIDI_STATUS_START 0xFA
+#define MIDI_STATUS_CONTINUE 0xFB
+#define MIDI_STATUS_STOP 0xFC
+
+/** Phase and frequency gain of the tempo estimator, as right shifts */
+#define PLL_PHASE_SHIFT 2
+#define PLL_FREQ_SHIFT 5
+
+#define MAX_SPP 0x3FFF
+
+BUILD_ASSERT(CONFIG_MIDI_SYNC_MAX_PORTS <= 16, "port_start is a bitmask of the ports");
+
+static void sync_send(const struct device *dev, const uint8_t *data, uint8_t len)
+{
+	midi_msg_t *msg = midi_msg_init_alloc(NULL, len, MIDI_FORMAT_1_0_PARSED, NULL);
+
+	if (!msg || !msg->data) {
+		LOG_WRN("could not allocate midi message!");
+		if (msg) {
+			midi_msg_unref(msg);
+		}
+		return;
+	}
+
+	memcpy(msg->data, data, len);
+	msg->time_us = midi_time_now_us();
+	msg->timestamp = midi_time_to_13bit_ms(msg->time_us);
+
+	if (midi_send(dev, msg)) {
+		midi_msg_unref(msg);
+	}
+}
+
+static void sync_send_all(struct midi_sync *sync, const uint8_t *data, uint8_t len)
+{
+	for (uint8_t i = 0; i < sync->cfg.num_ports; i++) {
+		sync_send(sync->cfg.ports[i].dev, data, len);
+	}
+}
+
+static uint32_t max_offset_us(struct midi_sync *sync)
+{
+	uint32_t offset = 0;
+
+	for (uint8_t i = 0; i < sync->cfg.num_ports; i++) {
+		offset = MAX(offset, sync->cfg.ports[i].offset_us);
+	}
+
+	return offset;
+}
+
+static inline int64_t clock_time_q16(struct midi_sync *sync, uint32_t clock)
+{
+	return sync->base_time_q16 +
+	       (int64_t)(int32_t)(clock - sync->base_clock) * (int64_t)sync->period_q16;
+}
+
+/** Time a port sends @p clock at, in microseconds. */
+static inline int64_t port_due_us(struct midi_sync *sync, uint8_t port, uint32_t clock)
+{
+	return ((clock_time_q16(sync, clock) + BIT(15)) >> 16) - sync->cfg.ports[port].offset_us;
+}
+
+/** Oldest clock not yet sent on every port, or @p fallback without ports. */
+static uint32_t next_clock(struct midi_sync *sync, uint32_t fallback)
+{
+	uint32_t clock = fallback;
+
+	for (uint8_t i = 0; i < sync->cfg.num_ports; i++) {
+		if ((i == 0) || ((int32_t)(sync->port_clock[i] - clock) < 0)) {
+			clock = sync->port_clock[i];
+		}
+	}
+
+	return clock;
+}
+
+/** Must be called with the lock held. */
+static void sync_run(struct midi_sync *sync, uint8_t status, uint32_t clock)
+{
+	sync->running = true;
+	sync->gen++;
+	sync->start_status = status;
+	sync->port_start = BIT_MASK(sync->cfg.num_ports);
+	sync->base_clock = clock;
+	/** The port with the largest offset sends its first clock right away */
+	sync->base_time_q16 = Q16(midi_time_now_us() + max_offset_us(sync));
+	sync->pll.in_clock = clock;
+	sync->pll.synced = false;
+
+	for (uint8_t i = 0; i < sync->cfg.num_ports; i++) {
+		sync->port_clock[i] = clock;
+	}
+}
+
+void midi_sync_start(struct midi_sync *sync)
+{
+	k_spinlock_key_t key = k_spin_lock(&sync->lock);
+
+	sync->position = 0;
+	sync_run(sync, MIDI_STATUS_START, 0);
+	k_spin_unlock(&sync->lock, key);
+
+	k_sem_give(&sync->sem);
+}
+
+void midi_sync_continue(struct midi_sync *sync)
+{
+	k_spinlock_key_t key = k_spin_lock(&sync->lock);
+
+	sync_run(sync, MIDI_STATUS_CONTINUE, sync->position);
+	k_spin_unlock(&sync->lock, key);
+
+	k_sem_give(&sync->sem);
+}
+
+void midi_sync_stop(struct midi_sync *sync)
+{
+	const uint8_t stop = MIDI_STATUS_STOP;
+	k_spinlock_key_t key = k_spin_lock(&sync->lock);
+	bool was_running = sync->running;
+
+	if (was_running) {
+		sync->running = false;
+		sync->gen++;
+		sync->position = next_clock(sync, sync->position);
+	}
+	k_spin_unlock(&sync->lock, key);
+
+	if (was_running) {
+		sync_send_all(sync, &stop, 1);
+		k_sem_give(&sync->sem);
+	}
+}
+
+int midi_sync_set_position(struct midi_sync *sync, uint16_t spp)
+{
+	uint8_t data[3] = { MIDI_STATUS_SPP, spp & 0x7F, (spp >> 7) & 0x7F };
+	k_spinlock_key_t key;
+
+	if (spp > MAX_SPP) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&sync->lock);
+	if (sync->running) {
+		k_spin_unlock(&sync->lock, key);
+		return -EBUSY;
+	}
+	sync->position = spp * MIDI_SYNC_CLOCKS_PER_SPP;
+	k_spin_unlock(&sync->lock, key);
+
+	sync_send_all(sync, data, sizeof(data));
+
+	return 0;
+}
+
+int midi_sync_set_tempo(struct midi_sync *sync, uint32_t tempo_us)
+{
+	k_spinlock_key_t key;
+	uint32_t clock;
+
+	if (tempo_us < MIDI_SYNC_PPQN) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&sync->lock);
+	sync->cfg.tempo_us = tempo_us;
+	if (sync->cfg.source == SYNC_INTERNAL) {
+		/** Rebase on the next clock, so clocks already due keep their time */
+		clock = next_clock(sync, sync->base_clock);
+		sync->base_time_q16 = clock_time_q16(sync, clock);
+		sync->base_clock = clock;
+		sync->period_q16 = Q16(tempo_us) / MIDI_SYNC_PPQN;
+		sync->gen++;
+	}
+	k_spin_unlock(&sync->lock, key);
+
+	k_sem_give(&sync->sem);
+
+	return 0;
+}
+
+uint32_t midi_sync_get_tempo(struct midi_sync *sync)
+{
+	return (uint32_t)((sync->period_q16 * MIDI_SYNC_PPQN + BIT(15)) >> 16);
+}
+
+/**
+ * Second order loop following the received clocks. The period is
+ * corrected by a fraction of the phase error of every clock, so the
+ * jitter of the received clock is filtered out of the sent clock.
+ * Must be called with the lock held.
+ */
+static void pll_update(struct midi_sync *sync, int64_t time_us)
+{
+	int64_t predicted = sync->pll.time_q16 + (int64_t)sync->period_q16;
+	int64_t err = Q16(time_us) - predicted;
+
+	if ((sync->pll.clocks == 0) || (time_us <= sync->pll.last_us)) {
+		sync->pll.time_q16 = Q16(time_us);
+	} else if ((sync->pll.clocks == 1) ||
+		   (llabs(err) > (int64_t)(sync->period_q16 / 2))) {
+		/** (Re)lock on the measured period */
+		sync->period_q16 = Q16(time_us - sync->pll.last_us);
+		sync->pll.time_q16 = Q16(time_us);
+	} else {
+		sync->period_q16 += err >> PLL_FREQ_SHIFT;
+		sync->pll.time_q16 = predicted + (err >> PLL_PHASE_SHIFT);
+	}
+
+	sync->pll.last_us = time_us;
+	sync->pll.clocks++;
+}
+
+void midi_sync_input(struct midi_sync *sync, const midi_msg_t *msg)
+{
+	uint8_t status = midi_msg_status(msg);
+	int64_t time_us = msg->time_us ? msg->time_us : midi_time_now_us();
+	k_spinlock_key_t key;
+	uint8_t i;
+
+	if (sync->cfg.source != SYNC_EXTERNAL) {
+		return;
+	}
+
+	switch (status) {
+	case MIDI_STATUS_CLOCK:
+		key = k_spin_lock(&sync->lock);
+		pll_update(sync, time_us);
+		if (sync->running) {
+			/** Sent clocks follow the estimated time of the received one */
+			sync->base_clock = sync->pll.in_clock++;
+			sync->base_time_q16 = sync->pll.time_q16;
+			sync->pll.synced = true;
+			sync->gen++;
+		}
+		k_spin_unlock(&sync->lock, key);
+		k_sem_give(&sync->sem);
+		break;
+	case MIDI_STATUS_START:
+		midi_sync_start(sync);
+		break;
+	case MIDI_STATUS_CONTINUE:
+		midi_sync_continue(sync);
+		break;
+	case MIDI_STATUS_STOP:
+		midi_sync_stop(sync);
+		break;
+	case MIDI_STATUS_SPP:
+		/** USB and UMP carry the statusbyte after a header byte */
+		i = ((msg->format == MIDI_FORMAT_1_0_USB) ||
+		     (msg->format == MIDI_FORMAT_2_0_UMP)) ? 1 : 0;
+		if (msg->len >= i + 3) {
+			midi_sync_set_position(sync, (msg->data[i + 1] & 0x7F) |
+						     ((msg->data[i + 2] & 0x7F) << 7));
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void stats_update(struct midi_sync *sync, int64_t due_us, int64_t sent_us)
+{
+	int32_t jitter = (int32_t)CLAMP(sent_us - due_us, INT32_MIN, INT32_MAX);
+	k_spinlock_key_t key = k_spin_lock(&sync->lock);
+
+	if (sync->stats.clocks == 0) {
+		sync->stats.jitter_min_us = jitter;
+		sync->stats.jitter_max_us = jitter;
+	}
+	sync->stats.clocks++;
+	sync->stats.jitter_min_us = MIN(sync->stats.jitter_min_us, jitter);
+	sync->stats.jitter_max_us = MAX(sync->stats.jitter_max_us, jitter);
+	sync->stats.jitter_sum_us += jitter;
+	sync->stats.jitter_sq_sum_us += (int64_t)jitter * jitter;
+
+	k_spin_unlock(&sync->lock, key);
+}
+
+void midi_sync_stats_get(struct midi_sync *sync, struct midi_sync_stats *stats)
+{
+	k_spinlock_key_t key = k_spin_lock(&sync->lock);
+
+	*stats = sync->stats;
+	memset(&sync->stats, 0, sizeof(sync->stats));
+
+	k_spin_unlock(&sync->lock, key);
+}
+
+/**
+ * Find the port sending the next clock. With an external clock, ports
+ * run at most CONFIG_MIDI_SYNC_FREEWHEEL_CLOCKS ahead of the received one.
+ * Must be called with the lock held.
+ *
+ * @return The port, -1 if no clock is due.
+ */
+static int next_port(struct midi_sync *sync, int64_t *due_us)
+{
+	int port = -1;
+	int64_t due;
+
+	if (!sync->running) {
+		return -1;
+	}
+
+	if ((sync->cfg.source == SYNC_EXTERNAL) && !sync->pll.synced) {
+		return -1;
+	}
+
+	for (uint8_t i = 0; i < sync->cfg.num_ports; i++) {
+		if ((sync->cfg.source == SYNC_EXTERNAL) &&
+		    ((int32_t)(sync->port_clock[i] - sync->pll.in_clock) >=
+		     CONFIG_MIDI_SYNC_FREEWHEEL_CLOCKS)) {
+			continue;
+		}
+
+		due = port_due_us(sync, i, sync->port_clock[i]);
+		if ((port < 0) || (due < *due_us)) {
+			port = i;
+			*due_us = due;
+		}
+	}
+
+	return port;
+}
+
+static void midi_sync_thread(void *p1, void *p2, void *p3)
+{
+	struct midi_sync *sync = p1;
+	const uint8_t clock = MIDI_STATUS_CLOCK;
+	k_spinlock_key_t key;
+	uint8_t start_status;
+	bool start;
+	int64_t due_us;
+	int64_t now_us;
+	uint32_t gen;
+	int port;
+
+	for (;;) {
+		key = k_spin_lock(&sync->lock);
+		port = next_port(sync, &due_us);
+		gen = sync->gen;
+		k_spin_unlock(&sync->lock, key);
+
+		if (port < 0) {
+			k_sem_take(&sync->sem, K_FOREVER);
+			continue;
+		}
+
+		/**
+		 * Kernel timeouts have tick resolution. Wake up early and wait
+		 * for the exact time on the MIDI timebase.
+		 */
+		if ((due_us - midi_time_now_us()) > CONFIG_MIDI_SYNC_SPIN_US) {
+			k_sem_take(&sync->sem,
+				   midi_time_abs_timeout(due_us - CONFIG_MIDI_SYNC_SPIN_US));
+			continue;
+		}
+
+		now_us = midi_time_now_us();
+		if (due_us > now_us) {
+			/** A bare spin on the time never ends on native_sim */
+			k_busy_wait((uint32_t)(due_us - now_us));
+		}
+
+		key = k_spin_lock(&sync->lock);
+		if (sync->gen != gen) {
+			k_spin_unlock(&sync->lock, key);
+			continue;
+		}
+		start = sync->port_start & BIT(port);
+		start_status = sync->start_status;
+		sync->port_start &= ~BIT(port);
+		sync->port_clock[port]++;
+		k_spin_unlock(&sync->lock, key);
+
+		if (start) {
+			sync_send(sync->cfg.ports[port].dev, &start_status, 1);
+		}
+		stats_update(sync, due_us, midi_time_now_us());
+		sync_send(sync->cfg.ports[port].dev, &clock, 1);
+	}
+}
+
+int midi_sync_init(struct midi_sync *sync, const struct midi_sync_cfg *cfg)
+{
+	if ((cfg->num_ports > CONFIG_MIDI_SYNC_MAX_PORTS) ||
+	    (cfg->tempo_us < MIDI_SYNC_PPQN)) {
+		return -EINVAL;
+	}
+
+	for (uint8_t i = 0; i < cfg->num_ports; i++) {
+		if (!cfg->ports[i].dev) {
+			return -EINVAL;
+		}
+	}
+
+	memset(sync, 0, sizeof(*sync));
+	sync->cfg = *cfg;
+	sync->period_q16 = Q16(cfg->tempo_us) / MIDI_SYNC_PPQN;
+	k_sem_init(&sync->sem, 0, 1);
+
+	k_thread_create(&sync->thread, sync->stack,
+			K_KERNEL_STACK_SIZEOF(sync->stack),
+			midi_sync_thread, sync, NULL, NULL,
+			CONFIG_MIDI_SYNC_THREAD_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&sync->thread, "midi_sync");
+
+	return 0;
+}
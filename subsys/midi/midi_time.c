@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI timebase backed by a counter device
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/counter.h>
+
+#include "midi/midi_time.h"
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_time
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+static const struct device *const counter_dev =
+	DEVICE_DT_GET(DT_CHOSEN(midi_timebase_counter));
+
+static struct k_spinlock lock;
+
+/** Counter ticks of the wraps seen so far */
+static uint64_t ticks_wrapped;
+
+static uint32_t last_ticks;
+
+static uint32_t freq;
+
+/** Kernel uptime at counter start, keeps the time aligned with uptime */
+static int64_t offset_us;
+
+static struct k_timer wrap_timer;
+
+static uint64_t read_ticks(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint32_t ticks;
+	uint64_t total;
+
+	counter_get_value(counter_dev, &ticks);
+	if (ticks < last_ticks) {
+		ticks_wrapped += (uint64_t)counter_get_top_value(counter_dev) + 1;
+	}
+	last_ticks = ticks;
+	total = ticks_wrapped + ticks;
+
+	k_spin_unlock(&lock, key);
+
+	return total;
+}
+
+int64_t midi_time_now_us(void)
+{
+	uint64_t ticks;
+
+	/** Kernel uptime until the counter is started, or if it failed to */
+	if (freq == 0) {
+		return k_ticks_to_us_floor64(k_uptime_ticks());
+	}
+
+	ticks = read_ticks();
+
+	return offset_us + (int64_t)((ticks / freq) * USEC_PER_SEC +
+				     ((ticks % freq) * USEC_PER_SEC) / freq);
+}
+
+static void wrap_timer_expiry(struct k_timer *timer)
+{
+	/** Reading the counter at least once per wrap keeps track of wraps */
+	(void)read_ticks();
+}
+
+static int midi_time_init(void)
+{
+	uint32_t counter_freq;
+	uint64_t wrap_ms;
+	uint64_t ticks;
+	int err;
+
+	if (!device_is_ready(counter_dev)) {
+		LOG_ERR("MIDI timebase counter not ready");
+		return -ENODEV;
+	}
+
+	counter_freq = counter_get_frequency(counter_dev);
+	if (counter_freq == 0) {
+		return -EINVAL;
+	}
+
+	err = counter_start(counter_dev);
+	if (err) {
+		return err;
+	}
+
+	/** Counter time from here on, starting at the current uptime */
+	ticks = read_ticks();
+	offset_us = k_ticks_to_us_floor64(k_uptime_ticks()) -
+		    (int64_t)((ticks * USEC_PER_SEC) / counter_freq);
+	/** Set last, midi_time_now_us() gives uptime until then */
+	freq = counter_freq;
+
+	wrap_ms = (((uint64_t)counter_get_top_value(counter_dev) + 1) * MSEC_PER_SEC) / freq;
+	k_timer_init(&wrap_timer, wrap_timer_expiry, NULL);
+	k_timer_start(&wrap_timer, K_MSEC(MAX(wrap_ms / 2, 1)), K_MSEC(MAX(wrap_ms / 2, 1)));
+
+	return 0;
+}
+
+SYS_INIT(midi_time_init, APPLICATION, 0);
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief MIDI trace buffer
+ *
+ * Records are written to a ring buffer overwriting the oldest. A record
+ * slot is claimed with an atomic increment, so tracepoints can be hit
+ * from any context without a lock. Tracepoints count themselves in and
+ * out, so a dump can wait for the ones it interrupted to finish.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include "midi/midi_trace.h"
+
+#define TRACE_SIZE CONFIG_MIDI_TRACE_BUFFER_SIZE
+
+BUILD_ASSERT(IS_POWER_OF_TWO(TRACE_SIZE), "trace buffer size must be a power of two");
+
+/** Decoder reads this symbol when the buffer is read with a debugger */
+struct midi_trace_record midi_trace_buf[TRACE_SIZE];
+
+/** Number of records written since the buffer was emptied */
+static atomic_t trace_head;
+
+static atomic_t trace_paused;
+
+/** Number of tracepoints writing a record */
+static atomic_t trace_writers;
+
+void midi_trace_record(enum midi_trace_event event, const void *msg, uint16_t arg)
+{
+	struct midi_trace_record *rec;
+
+	atomic_inc(&trace_writers);
+	if (atomic_get(&trace_paused)) {
+		atomic_dec(&trace_writers);
+		return;
+	}
+
+	rec = &midi_trace_buf[atomic_inc(&trace_head) & (TRACE_SIZE - 1)];
+	rec->cycles = k_cycle_get_32();
+	rec->id = (uint32_t)(uintptr_t)msg;
+	rec->event = event;
+	rec->reserved = 0;
+	rec->arg = arg;
+	atomic_dec(&trace_writers);
+}
+
+/**
+ * Format: a header line with the cycle frequency and record count, then
+ * one line per record in hex, all prefixed so the lines can be picked
+ * out of a console log.
+ */
+void midi_trace_dump(void)
+{
+	atomic_val_t head;
+	atomic_val_t first;
+	const uint8_t *rec;
+
+	atomic_set(&trace_paused, 1);
+	/** Sleep, not yield, so preempted writers of lower priority get to run */
+	while (atomic_get(&trace_writers)) {
+		k_msleep(1);
+	}
+
+	head = atomic_get(&trace_head);
+	first = (head > TRACE_SIZE) ? (head - TRACE_SIZE) : 0;
+
+	printk("MIDI_TRACE HDR %u %u\n", sys_clock_hw_cycles_per_sec(),
+	       (uint32_t)(head - first));
+
+	for (atomic_val_t i = first; i < head; i++) {
+		rec = (const uint8_t *)&midi_trace_buf[i & (TRACE_SIZE - 1)];
+		printk("MIDI_TRACE ");
+		for (size_t j = 0; j < sizeof(struct midi_trace_record); j++) {
+			printk("%02x", rec[j]);
+		}
+		printk("\n");
+	}
+
+	printk("MIDI_TRACE END\n");
+
+	atomic_set(&trace_head, 0);
+	atomic_set(&trace_paused, 0);
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Virtual MIDI driver
+ *
+ * Loops messages sent to the out port back to the in port, through an
+ * emulated link with limited bandwidth, latency and loss.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+#include "midi_virtual_internal.h"
+
+#include "midi/midi.h"
+
+#include <zephyr/sys/util.h>
+
+#include <zephyr/device.h>
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_virtual
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+struct midi_virtual_port_data {
+
+	struct midi_api *api;
+
+	const struct device *dev;
+
+	void *user_data;
+};
+
+struct midi_virtual_dev_data {
+
+	bool initialized;
+
+	/** Bytes per second, 0 is unlimited */
+	uint32_t bandwidth;
+
+	uint32_t latency_us;
+
+	uint32_t loss_permille;
+
+	/** State of the loss generator */
+	uint32_t loss_state;
+
+	/** Time the emulated link is done sending the previous message */
+	int64_t link_free_us;
+
+	struct k_fifo tx_queue;
+
+	/** Received copies, in order of their receive time */
+	struct k_fifo link_queue;
+
+	struct midi_virtual_port_data *in;
+
+	struct midi_virtual_port_data *out;
+};
+
+static int midi_virtual_init(struct midi_virtual_dev_data *data)
+{
+	if (data->initialized) {
+		return 0;
+	}
+
+	k_fifo_init(&data->tx_queue);
+	k_fifo_init(&data->link_queue);
+
+	data->initialized = true;
+
+	return 0;
+}
+
+int midi_virtual_in_port_callback_set(const struct device *dev,
+				 midi_transfer cb,
+				 void *user_data)
+{
+	struct midi_virtual_dev_data *virtual_dev_data = dev->data;
+
+	if(virtual_dev_data->in) {
+		virtual_dev_data->in->api->midi_transfer_done = cb;
+		virtual_dev_data->in->user_data = user_data;
+		return 0;
+	}
+
+	return -ENOTSUP;
+}
+
+int midi_virtual_out_port_callback_set(const struct device *dev,
+				 midi_transfer cb,
+				 void *user_data)
+{
+	struct midi_virtual_dev_data *virtual_dev_data = dev->data;
+
+	if(virtual_dev_data->out) {
+		virtual_dev_data->out->api->midi_transfer_done = cb;
+		virtual_dev_data->out->user_data = user_data;
+		return 0;
+	}
+
+	return -ENOTSUP;
+}
+
+static int midi_virtual_in_device_init(const struct device *dev)
+{
+	struct midi_virtual_dev_data *virtual_dev_data = dev->data;
+
+	virtual_dev_data->in->dev = dev;
+	virtual_dev_data->in->api = (struct midi_api*)dev->api;
+
+	LOG_INF("Init MIDI VIRTUAL IN PORT: dev %p (%s)", dev, dev->name);
+
+	return midi_virtual_init(virtual_dev_data);
+}
+
+static int midi_virtual_out_device_init(const struct device *dev)
+{
+	struct midi_virtual_dev_data *virtual_dev_data = dev->data;
+
+	virtual_dev_data->out->dev = dev;
+	virtual_dev_data->out->api = (struct midi_api*)dev->api;
+
+	LOG_INF("Init MIDI VIRTUAL OUT PORT: dev %p (%s)", dev, dev->name);
+
+	return midi_virtual_init(virtual_dev_data);
+}
+
+static int send_to_virtual_port(const struct device *dev,
+				    midi_msg_t *msg,
+					void *user_data)
+{
+	struct midi_virtual_dev_data *virtual_dev_data = dev->data;
+
+	if(!virtual_dev_data->out) {
+		return -ENOTSUP;
+	}
+
+	msg->time_us = midi_time_now_us();
+	MIDI_TRACE(ENQUEUE, msg, msg->len);
+	k_fifo_put(&virtual_dev_data->tx_queue, msg);
+
+	return 0;
+}
+
+/** @brief Xorshift generator, the same seed gives the same losses. */
+static bool link_lost(struct midi_virtual_dev_data *data)
+{
+	uint32_t x = data->loss_state;
+
+	if (data->loss_permille == 0) {
+		return false;
+	}
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	data->loss_state = x;
+
+	return (x % 1000) < data->loss_permille;
+}
+
+/**
+ * @brief Send messages over the emulated link.
+ *
+ * Messages are sent one after another at the link bandwidth. A copy of
+ * each message is put on the link queue, to be received latency_us after
+ * it is sent, and the message is completed on the out port.
+ */
+static void midi_virtual_tx_thread(void *p1, void *p2, void *p3)
+{
+	struct midi_virtual_dev_data *data = p1;
+	midi_msg_t *msg;
+	midi_msg_t *rx_msg;
+
+	for (;;) {
+		msg = k_fifo_get(&data->tx_queue, K_FOREVER);
+
+		data->link_free_us = MAX(data->link_free_us, msg->time_us);
+		if (data->bandwidth) {
+			data->link_free_us += DIV_ROUND_UP((uint64_t)msg->len * USEC_PER_SEC,
+							   data->bandwidth);
+			if (data->link_free_us > midi_time_now_us()) {
+				k_sleep(midi_time_abs_timeout(data->link_free_us));
+			}
+		}
+
+		MIDI_TRACE(SEND, msg, msg->len);
+
+		rx_msg = NULL;
+		if (data->in && !link_lost(data)) {
+			rx_msg = midi_msg_alloc(NULL, msg->len);
+			if (!rx_msg || !rx_msg->data) {
+				LOG_WRN("could not allocate midi buffer!");
+				midi_msg_unref(rx_msg);
+				rx_msg = NULL;
+			}
+		}
+
+		if (rx_msg) {
+			memcpy(rx_msg->data, msg->data, msg->len);
+			rx_msg->len = msg->len;
+			rx_msg->format = msg->format;
+			rx_msg->timestamp = msg->timestamp;
+			/** Time to receive at, stamped again when received */
+			rx_msg->time_us = data->link_free_us + data->latency_us;
+			k_fifo_put(&data->link_queue, rx_msg);
+		}
+
+		MIDI_TRACE(COMPLETE, msg, msg->len);
+		if(data->out->api->midi_transfer_done) {
+			data->out->api->midi_transfer_done(data->out->dev, msg,
+							   data->out->user_data);
+		} else {
+			midi_msg_unref(msg);
+		}
+	}
+}
+
+static void midi_virtual_rx_thread(void *p1, void *p2, void *p3)
+{
+	struct midi_virtual_dev_data *data = p1;
+	midi_msg_t *msg;
+
+	for (;;) {
+		msg = k_fifo_get(&data->link_queue, K_FOREVER);
+
+		if (msg->time_us > midi_time_now_us()) {
+			k_sleep(midi_time_abs_timeout(msg->time_us));
+		}
+		msg->time_us = midi_time_now_us();
+		MIDI_TRACE(RECEIVE, msg, msg->len);
+
+		if(data->in->api->midi_transfer_done) {
+			data->in->api->midi_transfer_done(data->in->dev, msg, data->in->user_data);
+		} else {
+			midi_msg_unref(msg);
+		}
+	}
+}
+
+#define DEFINE_MIDI_VIRTUAL_PORT_DATA(dev, dir)								\
+	static struct midi_virtual_port_data midi_virtual_##dir##_dev_data_##dev;
+
+#define DEFINE_MIDI_VIRTUAL_DEV_DATA(dev)									\
+	BUILD_ASSERT(DT_PROP(MIDI_VIRTUAL_DEV_N_ID(dev), loss_permille) <= 1000,	\
+		"loss-permille above 1000");										\
+	BUILD_ASSERT(DT_PROP(MIDI_VIRTUAL_DEV_N_ID(dev), loss_seed) != 0,		\
+		"loss-seed must not be 0");											\
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_VIRTUAL_DEV_N_ID(dev),					\
+		COMPAT_MIDI_VIRTUAL_IN_DEVICE,										\
+		(DEFINE_MIDI_VIRTUAL_PORT_DATA(dev, in)), ())						\
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_VIRTUAL_DEV_N_ID(dev),					\
+		COMPAT_MIDI_VIRTUAL_OUT_DEVICE,										\
+		(DEFINE_MIDI_VIRTUAL_PORT_DATA(dev, out)), ())						\
+	static struct midi_virtual_dev_data midi_virtual_dev_data_##dev = {		\
+		.bandwidth = DT_PROP(MIDI_VIRTUAL_DEV_N_ID(dev), bandwidth),		\
+		.latency_us = DT_PROP(MIDI_VIRTUAL_DEV_N_ID(dev), latency_us),		\
+		.loss_permille = DT_PROP(MIDI_VIRTUAL_DEV_N_ID(dev), loss_permille),	\
+		.loss_state = DT_PROP(MIDI_VIRTUAL_DEV_N_ID(dev), loss_seed),		\
+		COND_NODE_HAS_COMPAT_CHILD(MIDI_VIRTUAL_DEV_N_ID(dev),				\
+			COMPAT_MIDI_VIRTUAL_IN_DEVICE,									\
+			(.in = &midi_virtual_in_dev_data_##dev,),						\
+			(.in = NULL,))													\
+		COND_NODE_HAS_COMPAT_CHILD(MIDI_VIRTUAL_DEV_N_ID(dev),				\
+			COMPAT_MIDI_VIRTUAL_OUT_DEVICE,									\
+			(.out = &midi_virtual_out_dev_data_##dev,),						\
+			(.out = NULL,))													\
+	};
+
+#define DEFINE_MIDI_VIRTUAL_IN_DEVICE(dev)									\
+	static struct midi_api midi_virtual_in_api_##dev = {					\
+		.midi_callback_set = midi_virtual_in_port_callback_set,				\
+	};																		\
+	DEVICE_DT_DEFINE(VIRTUAL_IN_DEV_N_ID(dev),								\
+			    &midi_virtual_in_device_init,								\
+			    NULL,														\
+			    &midi_virtual_dev_data_##dev,								\
+			    NULL, APPLICATION,											\
+			    CONFIG_KERNEL_INIT_PRIORITY_DEVICE,							\
+			    &midi_virtual_in_api_##dev);									\
+	K_THREAD_DEFINE(midi_virtual_rx_thread_##dev, 1024,						\
+		midi_virtual_rx_thread, &midi_virtual_dev_data_##dev, NULL, NULL, 7, 0, 0);
+
+#define DEFINE_MIDI_VIRTUAL_OUT_DEVICE(dev)									\
+	static struct midi_api midi_virtual_out_api_##dev = {					\
+		.midi_transfer = send_to_virtual_port,								\
+		.midi_callback_set = midi_virtual_out_port_callback_set,			\
+	};																		\
+	DEVICE_DT_DEFINE(VIRTUAL_OUT_DEV_N_ID(dev),								\
+			    &midi_virtual_out_device_init,								\
+			    NULL,														\
+			    &midi_virtual_dev_data_##dev,								\
+			    NULL, APPLICATION,											\
+			    CONFIG_KERNEL_INIT_PRIORITY_DEVICE,							\
+			    &midi_virtual_out_api_##dev);									\
+	K_THREAD_DEFINE(midi_virtual_tx_thread_##dev, 1024,						\
+		midi_virtual_tx_thread, &midi_virtual_dev_data_##dev, NULL, NULL, 7, 0, 0);
+
+#define MIDI_VIRTUAL_DEVICE(dev, _) \
+	DEFINE_MIDI_VIRTUAL_DEV_DATA(dev) \
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_VIRTUAL_DEV_N_ID(dev), \
+		COMPAT_MIDI_VIRTUAL_IN_DEVICE, \
+		(DEFINE_MIDI_VIRTUAL_IN_DEVICE(dev)), ()) \
+	COND_NODE_HAS_COMPAT_CHILD(MIDI_VIRTUAL_DEV_N_ID(dev), \
+		COMPAT_MIDI_VIRTUAL_OUT_DEVICE, \
+		(DEFINE_MIDI_VIRTUAL_OUT_DEVICE(dev)), ())
+
+LISTIFY(MIDI_VIRTUAL_DEVICE_COUNT, MIDI_VIRTUAL_DEVICE, ());
@@ -18,6 +18,7 @@
 #include "usb_midi_internal.h"
 
 #include "midi/midi.h"
+#include "midi/midi_stats.h"
 
 #include <zephyr/sys/byteorder.h>
 #include <zephyr/sys/util.h>
@@ -49,6 +50,8 @@ struct usb_midi_jack_pair_data {
 
 	struct midi_api *api;
 
+	struct midi_stats_data stats;
+
 	void *user_data;
 
 };
@@ -489,7 +492,10 @@ static int send_to_jack_pair(const struct device *dev,
 	struct usb_midi_jack_pair_data *jack_pair_data = dev->data;
 	uint32_t bytes_ret = 0;
 
+	msg->time_us = midi_time_now_us();
+	midi_stats_enqueue(&jack_pair_data->stats, msg);
 	usb_write(jack_pair_data->ep_num, msg->data, msg->len, &bytes_ret);
+	midi_stats_tx(&jack_pair_data->stats, msg);
 
 	// LOG_INF("pointer %p, %p", jack_pair_data->api, jack_pair_data->api->midi_transfer_done);
 
@@ -519,7 +525,7 @@ static void midi_receive_cb(uint8_t ep, enum usb_dc_ep_cb_status_code status)
 	uint8_t cable_number;
 	int n_pending_bytes;
 	int ret;
-	LOG_INF("CB");
+
 	common = usb_get_dev_data_by_ep(&usb_midi_data_devlist, ep);
 	if (common == NULL) {
 		return;
@@ -532,17 +538,15 @@ static void midi_receive_cb(uint8_t ep, enum usb_dc_ep_cb_status_code status)
 	
 	// msg = midi_msg_alloc(4);
 
-	LOG_INF("CB1");
-	
 	// TODO: Del opp jack pair, bruk cable number for å spore hvor cb skal sendes.
 
 	ret = usb_read(ep, NULL, 0, &n_pending_bytes);
-	LOG_INF("CB2 %d", n_pending_bytes);
 	while (n_pending_bytes) {
 		msg = midi_msg_alloc(NULL, 4);
 		
-		if (!msg->data) {
+		if (!msg || !msg->data) {
 			LOG_ERR("Failed to allocate data buffer");
+			midi_msg_unref(msg);
 			return;
 		}
 
@@ -552,24 +556,27 @@ static void midi_receive_cb(uint8_t ep, enum usb_dc_ep_cb_status_code status)
 			midi_msg_unref(msg);
 			return;
 		}
-		LOG_INF("CB3 %d", n_pending_bytes);
 		msg->len = 4;
 		msg->format = MIDI_FORMAT_1_0_USB;
+		msg->time_us = midi_time_now_us();
 		if (!n_pending_bytes) {
 			midi_msg_unref(msg);
 			return;
 		}
-		
-		LOG_INF("CB4 %d", n_pending_bytes);
-		LOG_HEXDUMP_INF(msg->data, n_pending_bytes, "cb:");
 
 		cable_number = (*msg->data) >> 4;
 		jack_dev_data = get_midi_emb_jack_pair_by_in_cable_number(cable_number);
-		
-		LOG_INF("CB5 %d", n_pending_bytes);
+		if (!jack_dev_data) {
+			LOG_WRN("No jack for cable number %d", cable_number);
+			midi_msg_unref(msg);
+			ret = usb_read(ep, NULL, 0, &n_pending_bytes);
+			continue;
+		}
+
+		MIDI_TRACE(RECEIVE, msg, msg->len);
+		midi_stats_rx(&jack_dev_data->stats, msg);
 		midi_send(jack_dev_data->dev, msg);
-		
-		LOG_INF("CB6 %d", n_pending_bytes);
+
 		ret = usb_read(ep, NULL, 0, &n_pending_bytes);
 	}
 }
@@ -596,6 +603,14 @@ void usb_midi_register(const struct device *dev,
 	// 	&usb_midi_data_devlist);
 }
 
+static int usb_midi_jack_pair_stats_get(const struct device *dev,
+					struct midi_stats *stats, bool reset)
+{
+	struct usb_midi_jack_pair_data *jack_pair_data = dev->data;
+
+	return midi_stats_read(&jack_pair_data->stats, stats, reset);
+}
+
 int usb_midi_jack_pair_callback_set(const struct device *dev,
 				 midi_transfer cb,
 				 void *user_data)
@@ -633,6 +648,7 @@ int usb_midi_jack_pair_callback_set(const struct device *dev,
 	static struct midi_api usb_midi_jack_pair_api_##dev##iface##set##jack = {		\
 		.midi_transfer = send_to_jack_pair, 												\
 		.midi_callback_set = usb_midi_jack_pair_callback_set,							\
+		.midi_stats_get = usb_midi_jack_pair_stats_get,								\
 	};																				\
 	DEVICE_DT_DEFINE(JACK_PAIR_N_ID(dev, iface, set, jack), 							\
 			    &usb_midi_jack_pair_init,			  									\
@@ -0,0 +1,535 @@
+#include <zephyr/kernel.h>
+#include <zephyr/types.h>
+#include <zephyr/device.h>
+#include <zephyr/timing/timing.h>
+#include <string.h>
+
+#include <midi/midi.h>
+#include <midi/midi_parser.h>
+#include <midi/midi_ump.h>
+#include <midi/midi_ci.h>
+#include <midi/midi_iso_window.h>
+#include <midi/midi_ring.h>
+#include <midi/midi_router.h>
+#include <midi/midi_sync.h>
+
+#include <zephyr/logging/log.h>
+
+#define LOG_MODULE_NAME midi_benchmark
+LOG_MODULE_REGISTER(LOG_MODULE_NAME);
+
+#define BENCH_ITERATIONS 10000
+#define BENCH_PARSE_CHUNKS 1000
+#define BENCH_LATENCY_ITERATIONS 200
+#define BENCH_SYNC_TEMPO_US 100000
+#define BENCH_SYNC_TIME_MS 2000
+
+/** Packet size of the Bluetooth drivers with the default MTU */
+#define BLE_PACKET_SIZE 73
+
+#define RING_SIZE 64
+
+#define WINDOW_MSGS MIN(CONFIG_MIDI_ISO_WINDOW_SIZE, RING_SIZE)
+/** Bitmaps covering a full window, one more for the skipped sequence number */
+#define WINDOW_BITMAPS ((WINDOW_MSGS / 32) + 2)
+
+static const struct device *const a_in_dev =
+	DEVICE_DT_GET(DT_PATH(midi_virtual_a, midi_virtual_in_device));
+static const struct device *const a_out_dev =
+	DEVICE_DT_GET(DT_PATH(midi_virtual_a, midi_virtual_out_device));
+static const struct device *const b_in_dev =
+	DEVICE_DT_GET(DT_PATH(midi_virtual_b, midi_virtual_in_device));
+static const struct device *const b_out_dev =
+	DEVICE_DT_GET(DT_PATH(midi_virtual_b, midi_virtual_out_device));
+static const struct device *const clock_out_dev =
+	DEVICE_DT_GET(DT_PATH(midi_virtual_clock, midi_virtual_out_device));
+
+MIDI_RING_DEFINE(bench_ring, RING_SIZE);
+
+static struct k_fifo bench_fifo;
+
+static midi_msg_t bench_msgs[RING_SIZE];
+
+DEFINE_MIDI_PARSER_SERIAL(bench_parser);
+
+DEFINE_MIDI_PARSER_BLUETOOTH(bench_ble_parser);
+
+/** A note on followed by note ons with running status */
+static uint8_t serial_stream[255];
+
+static uint8_t ble_packet[BLE_PACKET_SIZE];
+
+static midi_ump_endpoint_t bench_endpoint = {
+	.max_sysex_size = 512,
+};
+
+static midi_ump_function_block_t bench_function_block = {
+	.name = "benchmark",
+	.muid = 0x1234567,
+	.ump_endpoint = &bench_endpoint,
+};
+
+static K_SEM_DEFINE(latency_sem, 0, 1);
+
+static struct midi_sync bench_sync;
+
+static struct midi_iso_window bench_window;
+
+/**
+ * Results are printed one JSON object per line, so runs can be compared
+ * with a script.
+ */
+static void report(const char *name, int64_t value, const char *unit)
+{
+	printk("{\"bench\":\"%s\",\"value\":%lld,\"unit\":\"%s\"}\n", name, value, unit);
+}
+
+static void report_rate(const char *name, uint64_t count, timing_t start, timing_t end,
+			const char *unit)
+{
+	uint64_t ns = timing_cycles_to_ns(timing_cycles_get(&start, &end));
+
+	/** native_sim time does not advance while the CPU is busy */
+	report(name, ns ? (count * NSEC_PER_SEC) / ns : 0, unit);
+}
+
+static uint64_t isqrt(uint64_t x)
+{
+	uint64_t r = 0;
+
+	for (uint64_t bit = 1ULL << 62; bit; bit >>= 2) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+	}
+
+	return r;
+}
+
+static void bench_msg_alloc(void)
+{
+	timing_t start, end;
+	midi_msg_t *msg;
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		msg = midi_msg_alloc(NULL, 3);
+		midi_msg_unref(msg);
+	}
+	end = timing_counter_get();
+	report_rate("msg_alloc_unref", BENCH_ITERATIONS, start, end, "ops/s");
+
+	msg = midi_msg_alloc(NULL, 3);
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		midi_msg_unref(midi_msg_clone(msg));
+	}
+	end = timing_counter_get();
+	midi_msg_unref(msg);
+	report_rate("msg_clone_unref", BENCH_ITERATIONS, start, end, "ops/s");
+}
+
+static void bench_queues(void)
+{
+	timing_t start, end;
+
+	k_fifo_init(&bench_fifo);
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS / RING_SIZE; i++) {
+		for (int j = 0; j < RING_SIZE; j++) {
+			midi_ring_put(&bench_ring, &bench_msgs[j]);
+		}
+		while (midi_ring_get(&bench_ring)) {
+		}
+	}
+	end = timing_counter_get();
+	report_rate("midi_ring_put_get", (BENCH_ITERATIONS / RING_SIZE) * RING_SIZE,
+		    start, end, "ops/s");
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS / RING_SIZE; i++) {
+		for (int j = 0; j < RING_SIZE; j++) {
+			k_fifo_put(&bench_fifo, &bench_msgs[j]);
+		}
+		while (k_fifo_get(&bench_fifo, K_NO_WAIT)) {
+		}
+	}
+	end = timing_counter_get();
+	report_rate("k_fifo_put_get", (BENCH_ITERATIONS / RING_SIZE) * RING_SIZE,
+		    start, end, "ops/s");
+}
+
+static void bench_serial_parse(void)
+{
+	midi_msg_t stream = {
+		.format = MIDI_FORMAT_1_0_SERIAL,
+	};
+	timing_t start, end;
+	midi_msg_t *parsed;
+
+	serial_stream[0] = 0x90;
+	for (size_t i = 1; i < sizeof(serial_stream); i++) {
+		serial_stream[i] = (i % 2) ? 0x3C : 0x64;
+	}
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_PARSE_CHUNKS; i++) {
+		stream.data = serial_stream;
+		stream.len = sizeof(serial_stream);
+		while (stream.len) {
+			parsed = midi_parse_serial(&stream, &bench_parser);
+			if (parsed) {
+				midi_msg_unref(parsed);
+			}
+		}
+	}
+	end = timing_counter_get();
+	report_rate("serial_parse", (uint64_t)BENCH_PARSE_CHUNKS * sizeof(serial_stream),
+		    start, end, "bytes/s");
+}
+
+/**
+ * @brief Add a message to a BLE-MIDI packet, the way the Bluetooth drivers
+ * encode it.
+ *
+ * @return false if the packet is full.
+ */
+static bool ble_encode(const uint8_t *data, uint8_t len, uint16_t timestamp,
+		       uint8_t *pck_len, uint8_t *running_status)
+{
+	if ((len + 1) > BLE_PACKET_SIZE - *pck_len) {
+		return false;
+	}
+
+	if (*pck_len == 0) {
+		ble_packet[0] = ((timestamp >> 7) | 0x80) & 0xBF;
+		*pck_len = 1;
+		*running_status = 0;
+	}
+
+	if (data[0] == *running_status) {
+		data++;
+		len--;
+	} else if (data[0] < 0xF8) {
+		*running_status = (data[0] < 0xF0) ? data[0] : 0;
+	}
+
+	ble_packet[(*pck_len)++] = (timestamp & 0x7F) | 0x80;
+	memcpy(&ble_packet[*pck_len], data, len);
+	*pck_len += len;
+
+	return true;
+}
+
+/**
+ * @brief Decode a BLE-MIDI packet, the way the Bluetooth drivers split it
+ * into timestamps and MIDI bytes, and parse the MIDI bytes.
+ *
+ * @return Number of messages parsed.
+ */
+static int ble_decode(uint8_t pck_len)
+{
+	midi_msg_t stream = {
+		.format = MIDI_FORMAT_1_0_SERIAL,
+	};
+	bool next_is_timestamp = false;
+	midi_msg_t *parsed;
+	int msgs = 0;
+
+	for (uint8_t pos = 2; pos < pck_len; pos++) {
+		if ((ble_packet[pos] >> 7) && next_is_timestamp) {
+			next_is_timestamp = false;
+			continue;
+		}
+
+		next_is_timestamp = true;
+		stream.data = &ble_packet[pos];
+		stream.len = 1;
+		parsed = midi_parse_serial(&stream, &bench_ble_parser);
+		if (parsed) {
+			midi_msg_unref(parsed);
+			msgs++;
+		}
+	}
+
+	return msgs;
+}
+
+/**
+ * Note ons are encoded into BLE-MIDI packets with running status, and
+ * each full packet is decoded again. The Bluetooth drivers encode and
+ * decode inline with the Bluetooth stack, so the packet format is timed
+ * here without it.
+ */
+static void bench_ble(void)
+{
+	uint8_t note_on[3] = { 0x90, 0x3C, 0x64 };
+	uint64_t encode_ns = 0, decode_ns = 0;
+	uint64_t decoded = 0;
+	uint8_t running_status = 0;
+	uint8_t pck_len = 0;
+	int pck_msgs = 0;
+	timing_t start, end;
+	int msgs;
+
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		note_on[1] = 0x3C + (i % 12);
+
+		start = timing_counter_get();
+		if (ble_encode(note_on, sizeof(note_on), i, &pck_len, &running_status)) {
+			end = timing_counter_get();
+			encode_ns += timing_cycles_to_ns(timing_cycles_get(&start, &end));
+			pck_msgs++;
+			continue;
+		}
+
+		/** The packet is full, decode it and start the next one */
+		start = timing_counter_get();
+		msgs = ble_decode(pck_len);
+		end = timing_counter_get();
+		decode_ns += timing_cycles_to_ns(timing_cycles_get(&start, &end));
+		decoded += msgs;
+		if (msgs != pck_msgs) {
+			LOG_WRN("%d of %d messages decoded", msgs, pck_msgs);
+		}
+
+		pck_len = 0;
+		start = timing_counter_get();
+		ble_encode(note_on, sizeof(note_on), i, &pck_len, &running_status);
+		end = timing_counter_get();
+		encode_ns += timing_cycles_to_ns(timing_cycles_get(&start, &end));
+		pck_msgs = 1;
+	}
+
+	report("ble_encode", encode_ns ? (BENCH_ITERATIONS * NSEC_PER_SEC) / encode_ns : 0,
+	       "msgs/s");
+	report("ble_decode", decode_ns ? (decoded * NSEC_PER_SEC) / decode_ns : 0, "msgs/s");
+}
+
+static void bench_ump(void)
+{
+	uint8_t ump[4] = { 0x20, 0x90, 0x3C, 0x64 };
+	timing_t start, end;
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		midi_msg_unref(midi_ump_1_0_channel_voice_msg_create_alloc(0, MIDI_OP_NOTE_ON,
+									   0, 0x3C, 0x64, NULL));
+	}
+	end = timing_counter_get();
+	report_rate("ump_create", BENCH_ITERATIONS, start, end, "msgs/s");
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		midi_msg_unref(midi_ump_32_msg_parse(ump));
+	}
+	end = timing_counter_get();
+	report_rate("ump_parse", BENCH_ITERATIONS, start, end, "msgs/s");
+}
+
+static void bench_ci(void)
+{
+	midi_ci_discovery_msg_t discovery;
+	timing_t start, end;
+
+	start = timing_counter_get();
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		midi_ci_discovery_msg_create(&discovery, &bench_function_block);
+	}
+	end = timing_counter_get();
+	report_rate("ci_discovery_build", BENCH_ITERATIONS, start, end, "msgs/s");
+}
+
+static void window_done(midi_msg_t *msg, bool acked)
+{
+}
+
+/**
+ * The window is filled with messages to @p receivers receivers in turn,
+ * then each receiver acks all of its messages with bitmaps.
+ */
+static void bench_window_ack(uint8_t receivers)
+{
+	static uint32_t bitmaps[CONFIG_MIDI_ISO_WINDOW_MAX_RECEIVERS][WINDOW_BITMAPS];
+	uint64_t ns = 0;
+	uint64_t acked = 0;
+	timing_t start, end;
+	uint8_t first, offset;
+	char name[32];
+
+	midi_iso_window_init(&bench_window, window_done);
+
+	for (int round = 0; round < BENCH_ITERATIONS / WINDOW_MSGS; round++) {
+		memset(bitmaps, 0, sizeof(bitmaps));
+		for (int i = 0; i < WINDOW_MSGS; i++) {
+			midi_iso_window_add(&bench_window, &bench_msgs[i], (i % receivers) + 1);
+		}
+
+		first = bench_msgs[0].num;
+		for (int i = 0; i < WINDOW_MSGS; i++) {
+			offset = bench_msgs[i].num - first;
+			bitmaps[i % receivers][offset / 32] |= BIT(offset % 32);
+		}
+
+		start = timing_counter_get();
+		for (uint8_t r = 0; r < receivers; r++) {
+			for (int j = 0; j < WINDOW_BITMAPS; j++) {
+				if (bitmaps[r][j]) {
+					acked += midi_iso_window_ack(&bench_window, r + 1,
+								     first + (j * 32), bitmaps[r][j]);
+				}
+			}
+		}
+		end = timing_counter_get();
+		ns += timing_cycles_to_ns(timing_cycles_get(&start, &end));
+	}
+
+	snprintk(name, sizeof(name), "iso_window_ack_%urx", receivers);
+	report(name, ns ? (acked * NSEC_PER_SEC) / ns : 0, "msgs/s");
+}
+
+static void bench_window(void)
+{
+	for (uint8_t receivers = 1; receivers <= MIN(32, CONFIG_MIDI_ISO_WINDOW_MAX_RECEIVERS);
+	     receivers *= 2) {
+		bench_window_ack(receivers);
+	}
+}
+
+static int latency_received(const struct device *dev, midi_msg_t *msg, void *user_data)
+{
+	int64_t *received_us = user_data;
+
+	*received_us = msg->time_us;
+	midi_msg_unref(msg);
+	k_sem_give(&latency_sem);
+
+	return 0;
+}
+
+/**
+ * Messages sent on port A are looped back to A in, routed to B out and
+ * looped back to B in. B emulates a serial MIDI link.
+ */
+static void bench_router_latency(void)
+{
+	struct midi_route_config route = {
+		.source = a_in_dev,
+		.destinations = { b_out_dev },
+		.num_destinations = 1,
+		.channel_mask = MIDI_ROUTE_ALL_CHANNELS,
+	};
+	int64_t min_us = INT64_MAX, max_us = 0, sum_us = 0;
+	int64_t received_us, sent_us, latency_us;
+	midi_msg_t *msg;
+	int completed = 0;
+	int route_id;
+
+	route_id = midi_router_add_route(&route);
+	if (route_id < 0) {
+		LOG_ERR("Can not add route (err %d)", route_id);
+		return;
+	}
+	midi_callback_set(b_in_dev, latency_received, &received_us);
+
+	for (int i = 0; i < BENCH_LATENCY_ITERATIONS; i++) {
+		msg = midi_msg_init_alloc(NULL, 3, MIDI_FORMAT_1_0_PARSED, NULL);
+		if (!msg) {
+			LOG_ERR("could not allocate midi message!");
+			break;
+		}
+		msg->data[0] = 0x90;
+		msg->data[1] = 0x3C;
+		msg->data[2] = 0x64;
+
+		sent_us = midi_time_now_us();
+		if (midi_send(a_out_dev, msg)) {
+			midi_msg_unref(msg);
+			break;
+		}
+		if (k_sem_take(&latency_sem, K_MSEC(100))) {
+			LOG_ERR("Routed message not received");
+			break;
+		}
+
+		latency_us = received_us - sent_us;
+		min_us = MIN(min_us, latency_us);
+		max_us = MAX(max_us, latency_us);
+		sum_us += latency_us;
+		completed++;
+	}
+
+	midi_router_remove_route(route_id);
+
+	if (completed == 0) {
+		return;
+	}
+
+	report("router_latency_min", min_us, "us");
+	report("router_latency_avg", sum_us / completed, "us");
+	report("router_latency_max", max_us, "us");
+}
+
+static void bench_sync_jitter(void)
+{
+	struct midi_sync_cfg cfg = {
+		.source = SYNC_INTERNAL,
+		.tempo_us = BENCH_SYNC_TEMPO_US,
+		.ports = { { .dev = clock_out_dev } },
+		.num_ports = 1,
+	};
+	struct midi_sync_stats stats;
+	int64_t mean, var;
+	int err;
+
+	err = midi_sync_init(&bench_sync, &cfg);
+	if (err) {
+		LOG_ERR("Can not init sync (err %d)", err);
+		return;
+	}
+
+	midi_sync_start(&bench_sync);
+	k_sleep(K_MSEC(BENCH_SYNC_TIME_MS));
+	midi_sync_stop(&bench_sync);
+	midi_sync_stats_get(&bench_sync, &stats);
+
+	if (stats.clocks == 0) {
+		LOG_ERR("No clocks sent");
+		return;
+	}
+
+	mean = stats.jitter_sum_us / stats.clocks;
+	var = (stats.jitter_sq_sum_us / stats.clocks) - (mean * mean);
+
+	report("sync_clocks", stats.clocks, "clocks");
+	report("sync_jitter_min", stats.jitter_min_us, "us");
+	report("sync_jitter_max", stats.jitter_max_us, "us");
+	report("sync_jitter_mean", mean, "us");
+	report("sync_jitter_stddev", isqrt(MAX(var, 0)), "us");
+}
+
+int main(void)
+{
+	timing_init();
+	timing_start();
+
+	bench_msg_alloc();
+	bench_queues();
+	bench_serial_parse();
+	bench_ble();
+	bench_ump();
+	bench_ci();
+	bench_window();
+	bench_router_latency();
+	bench_sync_jitter();
+
+	timing_stop();
+
+	printk("BENCH DONE\n");
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Tests of the serial MIDI driver on emulated UARTs
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#include <zephyr/ztest.h>
+#include <string.h>
+
+#include <midi/midi.h>
+
+#define STREAM_MSGS 40
+#define STREAM_SIZE (STREAM_MSGS * 3)
+
+/** Bytes put on a UART at once, not a multiple of the RX buffer sizes */
+#define CHUNK_SIZE 7
+
+#define RX_WAIT K_MSEC(500)
+
+/** Shorter than the time the output waits for an open thru message */
+#define THRU_OPEN_WAIT K_MSEC(5)
+
+static const struct device *const uart_a = DEVICE_DT_GET(DT_NODELABEL(euart_a));
+static const struct device *const uart_b = DEVICE_DT_GET(DT_NODELABEL(euart_b));
+static const struct device *const a_in_dev = DEVICE_DT_GET(DT_NODELABEL(midi_serial_a_in));
+static const struct device *const b_in_dev = DEVICE_DT_GET(DT_NODELABEL(midi_serial_b_in));
+static const struct device *const b_out_dev = DEVICE_DT_GET(DT_NODELABEL(midi_serial_b_out));
+
+/** Bytes received by the application on an input port */
+struct rx_port {
+	uint8_t data[2 * STREAM_SIZE];
+	size_t len;
+	/** Messages that were not single serial bytes */
+	uint32_t bad;
+	struct k_sem sem;
+};
+
+static struct rx_port rx_a;
+static struct rx_port rx_b;
+
+static int receive_cb(const struct device *dev, midi_msg_t *msg, void *user_data)
+{
+	struct rx_port *port = user_data;
+
+	/** Called from the receive thread of the port, checked by the test */
+	if ((msg->format != MIDI_FORMAT_1_0_SERIAL) || (msg->len != 1)) {
+		port->bad++;
+	} else if (port->len < sizeof(port->data)) {
+		port->data[port->len++] = msg->data[0];
+	}
+	midi_msg_unref(msg);
+	k_sem_give(&port->sem);
+
+	return 0;
+}
+
+/** @return true once the port has received @p len bytes. */
+static bool rx_wait(struct rx_port *port, size_t len)
+{
+	while (port->len < len) {
+		if (k_sem_take(&port->sem, RX_WAIT)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void rx_reset(struct rx_port *port)
+{
+	port->len = 0;
+	port->bad = 0;
+	k_sem_reset(&port->sem);
+}
+
+/** @return true once @p len bytes were sent on a UART. */
+static bool tx_wait(const struct device *uart, uint8_t *buf, size_t len)
+{
+	size_t got = 0;
+
+	for (int i = 0; (got < len) && (i < 500); i++) {
+		got += uart_emul_get_tx_data(uart, buf + got, len - got);
+		if (got < len) {
+			k_sleep(K_MSEC(1));
+		}
+	}
+
+	return got == len;
+}
+
+static void put_rx(const struct device *uart, const uint8_t *data, size_t len)
+{
+	zassert_equal(uart_emul_put_rx_data(uart, data, len), len);
+}
+
+/** Note ons, or controllers, each with its own statusbyte */
+static void stream_fill(uint8_t *stream, uint8_t status)
+{
+	for (int i = 0; i < STREAM_MSGS; i++) {
+		stream[3 * i] = status;
+		stream[3 * i + 1] = i;
+		stream[3 * i + 2] = 0x7F - i;
+	}
+}
+
+static void *midi_serial_setup(void)
+{
+	k_sem_init(&rx_a.sem, 0, K_SEM_MAX_LIMIT);
+	k_sem_init(&rx_b.sem, 0, K_SEM_MAX_LIMIT);
+
+	zassert_true(device_is_ready(a_in_dev));
+	zassert_true(device_is_ready(b_in_dev));
+	zassert_true(device_is_ready(b_out_dev));
+	zassert_ok(midi_callback_set(a_in_dev, receive_cb, &rx_a));
+	zassert_ok(midi_callback_set(b_in_dev, receive_cb, &rx_b));
+
+	return NULL;
+}
+
+static void midi_serial_before(void *fixture)
+{
+	/** Let the ports finish with the previous test */
+	k_sleep(K_MSEC(50));
+
+	uart_emul_flush_tx_data(uart_a);
+	uart_emul_flush_tx_data(uart_b);
+	rx_reset(&rx_a);
+	rx_reset(&rx_b);
+}
+
+ZTEST(midi_serial, test_ports_receive_apart)
+{
+	static uint8_t stream_a[STREAM_SIZE];
+	static uint8_t stream_b[STREAM_SIZE];
+
+	stream_fill(stream_a, 0x90);
+	stream_fill(stream_b, 0xB3);
+
+	/** Both ports switch RX buffers while the other one is receiving */
+	for (size_t pos = 0; pos < STREAM_SIZE; pos += CHUNK_SIZE) {
+		size_t len = MIN(CHUNK_SIZE, STREAM_SIZE - pos);
+
+		zassert_equal(uart_emul_put_rx_data(uart_a, &stream_a[pos], len), len);
+		zassert_equal(uart_emul_put_rx_data(uart_b, &stream_b[pos], len), len);
+		k_sleep(K_MSEC(1));
+	}
+
+	zassert_true(rx_wait(&rx_a, STREAM_SIZE), "port A received %u bytes", rx_a.len);
+	zassert_true(rx_wait(&rx_b, STREAM_SIZE), "port B received %u bytes", rx_b.len);
+	zassert_mem_equal(rx_a.data, stream_a, STREAM_SIZE);
+	zassert_mem_equal(rx_b.data, stream_b, STREAM_SIZE);
+	zassert_equal(rx_a.len, STREAM_SIZE);
+	zassert_equal(rx_b.len, STREAM_SIZE);
+	zassert_equal(rx_a.bad + rx_b.bad, 0);
+}
+
+ZTEST(midi_serial, test_thru_copies_filtered)
+{
+	static const uint8_t clock[] = {0xF8};
+	static uint8_t stream[STREAM_SIZE];
+	static uint8_t sent[STREAM_SIZE];
+	uint8_t extra;
+
+	stream_fill(stream, 0x90);
+
+	/** A clock between every message, the application gets them too */
+	for (int i = 0; i < STREAM_MSGS; i++) {
+		put_rx(uart_a, &stream[3 * i], 3);
+		put_rx(uart_a, clock, sizeof(clock));
+		k_sleep(K_MSEC(1));
+	}
+
+	zassert_true(rx_wait(&rx_a, STREAM_SIZE + STREAM_MSGS), "port A received %u bytes",
+		     rx_a.len);
+	for (int i = 0; i < STREAM_MSGS; i++) {
+		zassert_mem_equal(&rx_a.data[4 * i], &stream[3 * i], 3);
+		zassert_equal(rx_a.data[4 * i + 3], 0xF8);
+	}
+	zassert_equal(rx_a.bad, 0);
+
+	zassert_true(tx_wait(uart_b, sent, STREAM_SIZE), "thru port stalled");
+	zassert_mem_equal(sent, stream, STREAM_SIZE);
+	k_sleep(THRU_OPEN_WAIT);
+	zassert_equal(uart_emul_get_tx_data(uart_b, &extra, 1), 0, "filtered byte sent");
+	zassert_equal(rx_b.len, 0);
+}
+
+ZTEST(midi_serial, test_thru_message_not_split)
+{
+	static const uint8_t control[] = {0xB0, 0x07, 0x64};
+	static const uint8_t thru_start[] = {0x90, 0x3C};
+	static const uint8_t thru_end[] = {0x64};
+	static const uint8_t thru_running[] = {0x3E, 0x64};
+	static const uint8_t expected[] = {0x90, 0x3C, 0x64, 0xB0, 0x07, 0x64, 0x90, 0x3E, 0x64};
+	uint8_t sent[sizeof(expected)];
+	midi_msg_t *msg;
+
+	put_rx(uart_a, thru_start, sizeof(thru_start));
+	zassert_true(tx_wait(uart_b, sent, sizeof(thru_start)));
+
+	/** Queued while the note on waits for its velocity */
+	msg = midi_msg_alloc(NULL, sizeof(control));
+	zassert_not_null(msg);
+	memcpy(msg->data, control, sizeof(control));
+	msg->len = sizeof(control);
+	msg->format = MIDI_FORMAT_1_0_PARSED;
+	zassert_ok(midi_send(b_out_dev, msg));
+
+	k_sleep(THRU_OPEN_WAIT);
+	zassert_equal(uart_emul_get_tx_data(uart_b, &sent[2], 1), 0,
+		      "queued message split the thru message");
+
+	put_rx(uart_a, thru_end, sizeof(thru_end));
+	zassert_true(tx_wait(uart_b, &sent[2], sizeof(thru_end) + sizeof(control)));
+
+	/** The control change replaced the running status of the thru stream */
+	put_rx(uart_a, thru_running, sizeof(thru_running));
+	zassert_true(tx_wait(uart_b, &sent[6], 3));
+	zassert_mem_equal(sent, expected, sizeof(expected));
+}
+
+ZTEST_SUITE(midi_serial, NULL, midi_serial_setup, midi_serial_before, NULL, NULL);
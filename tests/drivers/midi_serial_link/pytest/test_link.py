@@ -0,0 +1,76 @@
+# Copyright (c) 2020 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Run two instances of the fast link test over a pseudo-terminal pair."""
+
+import re
+import shutil
+import subprocess
+import time
+from pathlib import Path
+
+import pytest
+
+TIMEOUT_S = 30
+
+
+def open_pty_pair():
+    """Start socat with two linked pseudo-terminals, return it and their paths."""
+    socat = subprocess.Popen(
+        ['socat', '-d', '-d', 'pty,raw,echo=0', 'pty,raw,echo=0'],
+        stderr=subprocess.PIPE, text=True)
+    ptys = []
+    while len(ptys) < 2:
+        line = socat.stderr.readline()
+        if not line:
+            socat.kill()
+            pytest.fail('socat did not open a pseudo-terminal pair')
+        match = re.search(r'PTY is (\S+)', line)
+        if match:
+            ptys.append(match.group(1))
+    return socat, ptys
+
+
+def start(exe, pty, role):
+    return subprocess.Popen(
+        [str(exe), f'-uart_port1={pty}', f'-stop_at={TIMEOUT_S}', '-testargs', role],
+        stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+
+
+def wait_line(proc, pattern):
+    """Return the first line of the output of proc matching pattern, or None."""
+    deadline = time.monotonic() + TIMEOUT_S
+    for line in proc.stdout:
+        print(line, end='')
+        if 'FAST LINK FAIL' in line:
+            pytest.fail(line.strip())
+        if re.search(pattern, line):
+            return line
+        if time.monotonic() > deadline:
+            break
+    return None
+
+
+def test_fast_link(request):
+    if not shutil.which('socat'):
+        pytest.skip('socat is needed for the pseudo-terminal pair')
+
+    exe = Path(request.config.getoption('--build-dir')) / 'zephyr' / 'zephyr.exe'
+    socat, ptys = open_pty_pair()
+    procs = []
+    try:
+        receiver = start(exe, ptys[0], 'receiver')
+        procs.append(receiver)
+        assert wait_line(receiver, 'receiver ready'), 'receiver did not start'
+
+        sender = start(exe, ptys[1], 'sender')
+        procs.append(sender)
+
+        assert wait_line(receiver, 'FAST LINK PASS'), 'receiver did not finish'
+        assert wait_line(sender, 'messages sent'), 'sender did not finish'
+    finally:
+        for proc in procs:
+            proc.kill()
+            proc.wait()
+        socat.kill()
+        socat.wait()
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Fast link between two native_sim instances
+ *
+ * The same application is run twice, its role given with
+ * -testargs sender or -testargs receiver. The sender sends MIDI 1.0 and
+ * UMP messages in bursts, the receiver checks that each arrives once, in
+ * order and unchanged. pytest/test_link.py connects the two.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/sys/printk.h>
+#include <string.h>
+
+#include <cmdline.h>
+
+#include <midi/midi.h>
+
+#define LINK_MSGS 600
+#define LINK_BURST 40
+
+/** Longest gap between two received messages */
+#define RX_WAIT K_SECONDS(2)
+
+static const struct device *const in_dev = DEVICE_DT_GET(DT_NODELABEL(midi_link_in));
+static const struct device *const out_dev = DEVICE_DT_GET(DT_NODELABEL(midi_link_out));
+
+static K_FIFO_DEFINE(rx_fifo);
+
+/** Every third message is a MIDI 2.0 note on UMP, the others MIDI 1.0 */
+static uint8_t link_msg_fill(int i, uint8_t *data, enum midi_format *format)
+{
+	if ((i % 3) == 2) {
+		*format = MIDI_FORMAT_2_0_UMP;
+		data[0] = 0x40;
+		data[1] = 0x90 | (i & 0x0F);
+		data[2] = i & 0x7F;
+		data[3] = 0x00;
+		data[4] = i >> 8;
+		data[5] = i & 0xFF;
+		data[6] = 0x00;
+		data[7] = 0x00;
+		return 8;
+	}
+
+	*format = MIDI_FORMAT_1_0_PARSED;
+	data[0] = 0x90 | (i & 0x0F);
+	data[1] = i & 0x7F;
+	data[2] = 0x01 + (i % 0x7F);
+	return 3;
+}
+
+static int receive_cb(const struct device *dev, midi_msg_t *msg, void *user_data)
+{
+	k_fifo_put(&rx_fifo, msg);
+	return 0;
+}
+
+static int run_sender(void)
+{
+	enum midi_format format;
+	uint8_t data[8];
+	midi_msg_t *msg;
+	uint8_t len;
+	int err;
+
+	/** Give the receiver time to open its end of the link */
+	k_sleep(K_MSEC(500));
+
+	for (int i = 0; i < LINK_MSGS; i++) {
+		len = link_msg_fill(i, data, &format);
+		msg = midi_msg_init_alloc(NULL, len, format, NULL);
+		if (!msg) {
+			printk("FAST LINK FAIL: no buffer for message %d\n", i);
+			return -ENOMEM;
+		}
+		memcpy(msg->data, data, len);
+		msg->len = len;
+		msg->timestamp = i;
+
+		err = midi_send(out_dev, msg);
+		if (err) {
+			printk("FAST LINK FAIL: message %d not sent (%d)\n", i, err);
+			midi_msg_unref(msg);
+			return err;
+		}
+
+		/** Bursts are merged into frames while the previous one is sent */
+		if ((i % LINK_BURST) == (LINK_BURST - 1)) {
+			k_sleep(K_MSEC(5));
+		}
+	}
+
+	printk("fast link: %d messages sent\n", LINK_MSGS);
+	return 0;
+}
+
+static int run_receiver(void)
+{
+	enum midi_format format;
+	uint8_t data[8];
+	midi_msg_t *msg;
+	bool ok;
+	uint8_t len;
+
+	midi_callback_set(in_dev, receive_cb, NULL);
+	printk("fast link: receiver ready\n");
+
+	for (int i = 0; i < LINK_MSGS; i++) {
+		msg = k_fifo_get(&rx_fifo, RX_WAIT);
+		if (!msg) {
+			printk("FAST LINK FAIL: %d of %d messages received\n", i, LINK_MSGS);
+			return -ETIMEDOUT;
+		}
+
+		len = link_msg_fill(i, data, &format);
+		ok = (msg->format == format) && (msg->len == len) &&
+		     (memcmp(msg->data, data, len) == 0) && (msg->timestamp == i);
+		midi_msg_unref(msg);
+		if (!ok) {
+			printk("FAST LINK FAIL: message %d changed or out of order\n", i);
+			return -EIO;
+		}
+	}
+
+	msg = k_fifo_get(&rx_fifo, K_MSEC(100));
+	if (msg) {
+		midi_msg_unref(msg);
+		printk("FAST LINK FAIL: more than %d messages received\n", LINK_MSGS);
+		return -EIO;
+	}
+
+	printk("fast link: %d messages received\n", LINK_MSGS);
+	printk("FAST LINK PASS\n");
+	return 0;
+}
+
+int main(void)
+{
+	char **argv;
+	int argc;
+
+	if (!device_is_ready(in_dev) || !device_is_ready(out_dev)) {
+		printk("FAST LINK FAIL: link ports not ready\n");
+		return 0;
+	}
+
+	native_get_test_cmd_line_args(&argc, &argv);
+	if ((argc == 1) && (strcmp(argv[0], "sender") == 0)) {
+		run_sender();
+	} else if ((argc == 1) && (strcmp(argv[0], "receiver") == 0)) {
+		run_receiver();
+	} else {
+		printk("FAST LINK FAIL: run with -testargs sender or -testargs receiver\n");
+	}
+
+	return 0;
+}
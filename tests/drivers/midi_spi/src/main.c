@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Tests of the ready line handshake of the MIDI SPI controller side
+ *
+ * The peripheral side is an SPI emulator. The test arms its frames and
+ * drives the ready line like midi_spi_peripheral_run() does.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/drivers/spi_emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/ztest.h>
+#include <string.h>
+
+#include <midi/midi.h>
+
+#define PEER_NODE DT_NODELABEL(midi_spi)
+#define FRAME_SIZE DT_PROP(PEER_NODE, frame_size)
+
+#define FRAME_HEADER_SIZE 3
+#define ENTRY_HEADER_SIZE 4
+#define FLAG_PENDING BIT(0)
+
+/** Longer than an exchange takes, shorter than the ready line timeout */
+#define EXCHANGE_WAIT K_MSEC(50)
+
+static const struct device *const in_dev =
+	DEVICE_DT_GET(DT_CHILD(PEER_NODE, midi_spi_in_device));
+static const struct device *const out_dev =
+	DEVICE_DT_GET(DT_CHILD(PEER_NODE, midi_spi_out_device));
+static const struct gpio_dt_spec ready = GPIO_DT_SPEC_GET(PEER_NODE, ready_gpios);
+
+struct peer_data {
+	/** Frame armed by the peripheral */
+	uint8_t tx_frame[FRAME_SIZE];
+	/** Frame last clocked in from the controller */
+	uint8_t rx_frame[FRAME_SIZE];
+	atomic_t exchanges;
+	struct k_sem exchanged;
+};
+
+static struct peer_data peer;
+
+static K_FIFO_DEFINE(rx_fifo);
+
+/** The end of an exchange, like the peripheral side does it */
+static int peer_io(const struct emul *target, const struct spi_config *config,
+		   const struct spi_buf_set *tx_bufs, const struct spi_buf_set *rx_bufs)
+{
+	struct peer_data *data = target->data;
+
+	zassert_equal(tx_bufs->count, 1);
+	zassert_equal(tx_bufs->buffers[0].len, FRAME_SIZE);
+	zassert_equal(rx_bufs->count, 1);
+	zassert_equal(rx_bufs->buffers[0].len, FRAME_SIZE);
+
+	memcpy(data->rx_frame, tx_bufs->buffers[0].buf, FRAME_SIZE);
+	memcpy(rx_bufs->buffers[0].buf, data->tx_frame, FRAME_SIZE);
+	memset(data->tx_frame, 0, FRAME_SIZE);
+
+	gpio_emul_input_set(ready.port, ready.pin, 0);
+	atomic_inc(&data->exchanges);
+	k_sem_give(&data->exchanged);
+
+	return 0;
+}
+
+static int peer_init(const struct emul *target, const struct device *parent)
+{
+	struct peer_data *data = target->data;
+
+	k_sem_init(&data->exchanged, 0, K_SEM_MAX_LIMIT);
+
+	return 0;
+}
+
+static struct spi_emul_api peer_api = {
+	.io = peer_io,
+};
+
+/** The MIDI SPI driver has no device for the node itself, only for its ports */
+DEVICE_DT_DEFINE(PEER_NODE, NULL, NULL, NULL, NULL, POST_KERNEL,
+		 CONFIG_KERNEL_INIT_PRIORITY_DEVICE, NULL);
+
+EMUL_DT_DEFINE(PEER_NODE, peer_init, &peer, NULL, &peer_api, NULL);
+
+static int receive_cb(const struct device *dev, midi_msg_t *msg, void *user_data)
+{
+	k_fifo_put(&rx_fifo, msg);
+	return 0;
+}
+
+static void peer_frame_set(uint8_t flags, const uint8_t *msg_data, uint8_t len)
+{
+	uint8_t *frame = peer.tx_frame;
+
+	memset(frame, 0, FRAME_SIZE);
+	frame[0] = flags;
+	sys_put_le16(len ? ENTRY_HEADER_SIZE + len : 0, &frame[1]);
+	if (len) {
+		frame[FRAME_HEADER_SIZE] = MIDI_FORMAT_1_0_PARSED;
+		frame[FRAME_HEADER_SIZE + 1] = len;
+		sys_put_le16(0x123, &frame[FRAME_HEADER_SIZE + 2]);
+		memcpy(&frame[FRAME_HEADER_SIZE + ENTRY_HEADER_SIZE], msg_data, len);
+	}
+}
+
+static void peer_arm(void)
+{
+	gpio_emul_input_set(ready.port, ready.pin, 1);
+}
+
+/** A request pulse, as request_exchange() makes it */
+static void peer_request(void)
+{
+	k_busy_wait(20);
+	gpio_emul_input_set(ready.port, ready.pin, 0);
+	k_busy_wait(1);
+	gpio_emul_input_set(ready.port, ready.pin, 1);
+}
+
+static void *midi_spi_setup(void)
+{
+	zassert_true(device_is_ready(in_dev));
+	zassert_true(device_is_ready(out_dev));
+	zassert_ok(midi_callback_set(in_dev, receive_cb, NULL));
+
+	return NULL;
+}
+
+static void midi_spi_before(void *fixture)
+{
+	midi_msg_t *msg;
+
+	/** Start unarmed, an exchange left armed by a test is requested empty */
+	peer_frame_set(0, NULL, 0);
+	if (gpio_pin_get_dt(&ready) > 0) {
+		peer_request();
+		k_sem_take(&peer.exchanged, EXCHANGE_WAIT);
+	}
+	k_sleep(EXCHANGE_WAIT);
+
+	while ((msg = k_fifo_get(&rx_fifo, K_NO_WAIT))) {
+		midi_msg_unref(msg);
+	}
+	k_sem_reset(&peer.exchanged);
+	atomic_set(&peer.exchanges, 0);
+}
+
+ZTEST(midi_spi, test_arming_alone_is_no_request)
+{
+	peer_arm();
+
+	zassert_equal(k_sem_take(&peer.exchanged, EXCHANGE_WAIT), -EAGAIN,
+		      "arming an empty frame started an exchange");
+}
+
+ZTEST(midi_spi, test_request_right_after_arming)
+{
+	static const uint8_t note_on[] = {0x90, 0x40, 0x7F};
+	midi_msg_t *msg;
+
+	/** The pulse comes before the controller thread handles the arming edge */
+	peer_frame_set(0, note_on, sizeof(note_on));
+	peer_arm();
+	peer_request();
+
+	zassert_ok(k_sem_take(&peer.exchanged, EXCHANGE_WAIT), "request was lost");
+
+	msg = k_fifo_get(&rx_fifo, EXCHANGE_WAIT);
+	zassert_not_null(msg);
+	zassert_equal(msg->format, MIDI_FORMAT_1_0_PARSED);
+	zassert_equal(msg->timestamp, 0x123);
+	zassert_mem_equal(msg->data, note_on, sizeof(note_on));
+	zassert_equal(msg->len, sizeof(note_on));
+	midi_msg_unref(msg);
+
+	/** One exchange only, the next frame is not armed */
+	zassert_equal(k_sem_take(&peer.exchanged, EXCHANGE_WAIT), -EAGAIN);
+}
+
+ZTEST(midi_spi, test_request_while_armed)
+{
+	static const uint8_t program[] = {0xC1, 0x05};
+	midi_msg_t *msg;
+
+	peer_arm();
+	k_sleep(K_MSEC(10));
+	zassert_equal(atomic_get(&peer.exchanges), 0);
+
+	peer_frame_set(0, program, sizeof(program));
+	peer_request();
+
+	zassert_ok(k_sem_take(&peer.exchanged, EXCHANGE_WAIT));
+	msg = k_fifo_get(&rx_fifo, EXCHANGE_WAIT);
+	zassert_not_null(msg);
+	zassert_mem_equal(msg->data, program, sizeof(program));
+	midi_msg_unref(msg);
+}
+
+ZTEST(midi_spi, test_send_waits_for_arming)
+{
+	static const uint8_t note_off[] = {0x80, 0x3C, 0x00};
+	uint8_t *frame = peer.rx_frame;
+	midi_msg_t *msg;
+
+	msg = midi_msg_alloc(NULL, sizeof(note_off));
+	zassert_not_null(msg);
+	memcpy(msg->data, note_off, sizeof(note_off));
+	msg->len = sizeof(note_off);
+	msg->format = MIDI_FORMAT_1_0_PARSED;
+	msg->timestamp = 0x456;
+	zassert_ok(midi_send(out_dev, msg));
+
+	zassert_equal(k_sem_take(&peer.exchanged, EXCHANGE_WAIT), -EAGAIN,
+		      "exchange started before the peripheral armed it");
+
+	peer_arm();
+	zassert_ok(k_sem_take(&peer.exchanged, EXCHANGE_WAIT));
+
+	zassert_equal(frame[0], 0);
+	zassert_equal(sys_get_le16(&frame[1]), ENTRY_HEADER_SIZE + sizeof(note_off));
+	zassert_equal(frame[FRAME_HEADER_SIZE], MIDI_FORMAT_1_0_PARSED);
+	zassert_equal(frame[FRAME_HEADER_SIZE + 1], sizeof(note_off));
+	zassert_equal(sys_get_le16(&frame[FRAME_HEADER_SIZE + 2]), 0x456);
+	zassert_mem_equal(&frame[FRAME_HEADER_SIZE + ENTRY_HEADER_SIZE], note_off,
+			  sizeof(note_off));
+}
+
+ZTEST(midi_spi, test_pending_flag_polls_again)
+{
+	static const uint8_t clock[] = {0xF8};
+
+	peer_frame_set(FLAG_PENDING, clock, sizeof(clock));
+	peer_arm();
+	peer_request();
+	zassert_ok(k_sem_take(&peer.exchanged, EXCHANGE_WAIT));
+
+	/** Rearmed without a pulse, the flag of the last frame asks for it */
+	peer_frame_set(0, clock, sizeof(clock));
+	peer_arm();
+	zassert_ok(k_sem_take(&peer.exchanged, EXCHANGE_WAIT), "pending messages not polled");
+}
+
+ZTEST_SUITE(midi_spi, NULL, midi_spi_setup, midi_spi_before, NULL, NULL);
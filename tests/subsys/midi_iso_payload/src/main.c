@@ -0,0 +1,692 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file
+ * @brief Round trips of ISO MIDI payloads
+ *
+ * Payloads are built like the broadcaster builds them and parsed like
+ * the receiver parses them. Malformed payloads are written by hand.
+ */
+#include <zephyr/kernel.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/ztest.h>
+#include <string.h>
+
+#include <midi/midi.h>
+#include <midi/midi_iso_payload.h>
+#include <midi/midi_iso_snapshot.h>
+
+#include "midi_iso_internal.h"
+
+/** A fraction of the interval is 100 us */
+#define INTERVAL_US 12700
+#define PAYLOAD_SIZE 128
+
+#define REF_TIME 1000000
+#define RECV_TIME 5000000
+
+/** MUID bytes of two receivers, the first one is given an ACK channel */
+#define MUID_A 0x11
+#define MUID_B 0x22
+#define ACK_CHANNEL_A 3
+
+#define FEC_DEPTH 2
+
+/** Room for one or two entries in a snapshot piece */
+#define SNAPSHOT_MAX_BYTES 10
+
+/** Messages of a payload as the receiver gets them */
+struct rx_msg {
+	uint8_t data[16];
+	uint8_t len;
+	enum midi_format format;
+	uint8_t num;
+	uint8_t ack_channel;
+	int64_t time_us;
+};
+
+struct rx_log {
+	struct rx_msg msgs[16];
+	size_t count;
+	uint32_t malformed;
+	/** Ages of the copies parsed */
+	uint8_t fec_ages[4];
+	size_t fec_count;
+	/** Numbers and flags of the snapshot pieces parsed */
+	uint8_t pieces[8];
+	uint8_t piece_flags[8];
+	size_t piece_count;
+};
+
+/** A malformed chunk, followed by a clock in a chunk of its own */
+struct malformed_chunk {
+	const char *name;
+	uint8_t data[8];
+	uint8_t len;
+};
+
+NET_BUF_POOL_DEFINE(payload_pool, 2, PAYLOAD_SIZE, 0, NULL);
+
+static uint8_t sdu[2][PAYLOAD_SIZE];
+static uint8_t sdu_next;
+static uint8_t muid_a = MUID_A;
+static uint8_t muid_b = MUID_B;
+static struct midi_iso_payload_builder builder;
+static struct midi_iso_payload_fec fec[MIDI_ISO_PAYLOAD_FEC_SLOTS];
+static struct midi_iso_payload_parser parser;
+static struct midi_iso_snapshot snapshot;
+static struct rx_log rx;
+
+static void rx_msg_cb(midi_msg_t *msg, int64_t time_us, void *user_data)
+{
+	struct rx_msg *rx_msg = &rx.msgs[rx.count];
+
+	if ((rx.count < ARRAY_SIZE(rx.msgs)) && (msg->len <= sizeof(rx_msg->data))) {
+		memcpy(rx_msg->data, msg->data, msg->len);
+		rx_msg->len = msg->len;
+		rx_msg->format = msg->format;
+		rx_msg->num = msg->num;
+		rx_msg->ack_channel = msg->ack_channel;
+		rx_msg->time_us = time_us;
+		rx.count++;
+	}
+	midi_msg_unref_alt(msg);
+}
+
+static void rx_malformed_cb(void *user_data)
+{
+	rx.malformed++;
+}
+
+static bool rx_fec_cb(uint8_t age, void *user_data)
+{
+	uint8_t only_age = POINTER_TO_UINT(user_data);
+
+	if (rx.fec_count < ARRAY_SIZE(rx.fec_ages)) {
+		rx.fec_ages[rx.fec_count++] = age;
+	}
+
+	return !only_age || (age == only_age);
+}
+
+static bool rx_snapshot_cb(uint8_t piece, uint8_t flags, void *user_data)
+{
+	if (rx.piece_count < ARRAY_SIZE(rx.pieces)) {
+		rx.pieces[rx.piece_count] = piece;
+		rx.piece_flags[rx.piece_count] = flags;
+		rx.piece_count++;
+	}
+
+	return true;
+}
+
+static bool midi_1_0_entry(const struct midi_iso_snapshot_entry *entry, void *user_data)
+{
+	return !entry->ump;
+}
+
+/** Drops the message numbered by user_data */
+static bool rx_ump_filter(const struct midi_iso_payload_ump *ump, void *user_data)
+{
+	return ump->num != POINTER_TO_UINT(user_data);
+}
+
+static uint8_t ack_channel_cb(uint8_t muid)
+{
+	return (muid == MUID_A) ? ACK_CHANNEL_A : 0xFF;
+}
+
+/** @brief Start building a payload in the first buffer. */
+static void builder_start(int64_t ref_time)
+{
+	uint8_t *finished;
+
+	memset(&builder, 0, sizeof(builder));
+	builder.size = PAYLOAD_SIZE;
+	builder.interval_us = INTERVAL_US;
+	midi_iso_payload_swap(&builder, sdu[0], ref_time, &finished);
+	sdu_next = 1;
+}
+
+/** @return Length of the payload finished, a new one starts at @p ref_time. */
+static uint16_t builder_finish(int64_t ref_time, uint8_t **payload)
+{
+	uint16_t len = midi_iso_payload_swap(&builder, sdu[sdu_next], ref_time, payload);
+
+	sdu_next ^= 1;
+	return len;
+}
+
+static void add_msg(const uint8_t *data, uint8_t len, enum midi_format format,
+		    int64_t time_us)
+{
+	midi_msg_t *msg = midi_msg_init_alloc(NULL, len, format, NULL);
+
+	zassert_not_null(msg);
+	memcpy(msg->data, data, len);
+	msg->time_us = time_us;
+	zassert_ok(midi_iso_payload_add_msg(&builder, msg));
+	midi_msg_unref(msg);
+}
+
+static void add_ump(const uint8_t *data, uint8_t len, uint8_t *muid, uint8_t num,
+		    int64_t time_us)
+{
+	midi_msg_t *msg = midi_msg_init_alloc(NULL, len, MIDI_FORMAT_2_0_UMP, muid);
+
+	zassert_not_null(msg);
+	memcpy(msg->data, data, len);
+	msg->time_us = time_us;
+	msg->num = num;
+	zassert_ok(midi_iso_payload_add_msg(&builder, msg));
+	midi_msg_unref(msg);
+}
+
+static void parse(const uint8_t *payload, size_t len, int64_t recv_time)
+{
+	struct net_buf *buf = net_buf_alloc(&payload_pool, K_NO_WAIT);
+
+	zassert_not_null(buf);
+	net_buf_add_mem(buf, payload, len);
+	midi_iso_payload_parse(&parser, buf, buf->data, net_buf_tail(buf), recv_time);
+	net_buf_unref(buf);
+}
+
+static void rx_check(size_t i, const uint8_t *data, uint8_t len, int64_t time_us)
+{
+	zassert_true(i < rx.count, "message %u of %u", i, rx.count);
+	zassert_equal(rx.msgs[i].len, len, "message %u", i);
+	zassert_mem_equal(rx.msgs[i].data, data, len, "message %u", i);
+	zassert_equal(rx.msgs[i].time_us, time_us, "message %u", i);
+}
+
+static void malformed_check(const struct malformed_chunk *chunks, size_t count)
+{
+	static const uint8_t clock_chunk[] = {PAYLOAD_CHUNK_MIDI_1_0, 2, 0, 0x80, 0xF8};
+	static const uint8_t clock[] = {0xF8};
+	uint8_t payload[1 + 8 + sizeof(clock_chunk)];
+	size_t len;
+
+	for (size_t i = 0; i < count; i++) {
+		payload[0] = PAYLOAD_VERSION;
+		memcpy(&payload[1], chunks[i].data, chunks[i].len);
+		memcpy(&payload[1 + chunks[i].len], clock_chunk, sizeof(clock_chunk));
+		len = 1 + chunks[i].len + sizeof(clock_chunk);
+
+		memset(&rx, 0, sizeof(rx));
+		parse(payload, len, RECV_TIME);
+		zassert_equal(rx.malformed, 1, "%s", chunks[i].name);
+		zassert_equal(rx.count, 1, "%s", chunks[i].name);
+		rx_check(0, clock, sizeof(clock), RECV_TIME);
+	}
+}
+
+static void payload_before(void *fixture)
+{
+	memset(&rx, 0, sizeof(rx));
+	memset(&parser, 0, sizeof(parser));
+	parser.interval_us = INTERVAL_US;
+	parser.msg_cb = rx_msg_cb;
+	parser.malformed_cb = rx_malformed_cb;
+}
+
+ZTEST(midi_iso_payload, test_midi_1_0_running_status)
+{
+	static const struct {
+		uint8_t data[3];
+		uint8_t len;
+		uint16_t offset_us;
+	} msgs[] = {
+		{{0x90, 0x3C, 0x40}, 3, 1000},
+		{{0x90, 0x3E, 0x40}, 3, 2000},
+		{{0x80, 0x3C, 0x00}, 3, 3000},
+		/** Real-time messages keep the running status */
+		{{0xF8}, 1, 3000},
+		{{0x80, 0x3E, 0x00}, 3, 4000},
+		/** Other system messages clear it */
+		{{0xF2, 0x01, 0x02}, 3, 5000},
+		{{0x80, 0x40, 0x00}, 3, 6000},
+	};
+	static const uint8_t expected[] = {
+		PAYLOAD_VERSION,
+		PAYLOAD_CHUNK_MIDI_1_0, 24, 0x00,
+		0x8A, 0x90, 0x3C, 0x40,
+		0x94, 0x3E, 0x40,
+		0x9E, 0x80, 0x3C, 0x00,
+		0x9E, 0xF8,
+		0xA8, 0x3E, 0x00,
+		0xB2, 0xF2, 0x01, 0x02,
+		0xBC, 0x80, 0x40, 0x00,
+	};
+	uint8_t *payload;
+	uint16_t len;
+
+	builder_start(REF_TIME);
+	for (size_t i = 0; i < ARRAY_SIZE(msgs); i++) {
+		add_msg(msgs[i].data, msgs[i].len, MIDI_FORMAT_1_0_PARSED,
+			REF_TIME + msgs[i].offset_us);
+	}
+	len = builder_finish(REF_TIME + INTERVAL_US, &payload);
+
+	zassert_equal(len, sizeof(expected));
+	zassert_mem_equal(payload, expected, sizeof(expected));
+
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.count, ARRAY_SIZE(msgs));
+	zassert_equal(rx.malformed, 0);
+	for (size_t i = 0; i < ARRAY_SIZE(msgs); i++) {
+		rx_check(i, msgs[i].data, msgs[i].len, RECV_TIME + msgs[i].offset_us);
+		zassert_equal(rx.msgs[i].format, MIDI_FORMAT_1_0_PARSED_DELTA_US);
+	}
+}
+
+ZTEST(midi_iso_payload, test_midi_1_0_sysex)
+{
+	static const uint8_t payload[] = {
+		PAYLOAD_VERSION,
+		PAYLOAD_CHUNK_MIDI_1_0, 12, 0x00,
+		0x80, 0xF0, 0x7D, 0x01, 0xF7,
+		/** A SysEx clears the running status */
+		0x8A, 0x90, 0x3C, 0x40,
+		0x94, 0x3E, 0x40,
+	};
+	static const uint8_t sysex[] = {0xF0, 0x7D, 0x01, 0xF7};
+	static const uint8_t note_1[] = {0x90, 0x3C, 0x40};
+	static const uint8_t note_2[] = {0x90, 0x3E, 0x40};
+
+	parse(payload, sizeof(payload), RECV_TIME);
+	zassert_equal(rx.count, 3);
+	zassert_equal(rx.malformed, 0);
+	rx_check(0, sysex, sizeof(sysex), RECV_TIME);
+	rx_check(1, note_1, sizeof(note_1), RECV_TIME + 1000);
+	rx_check(2, note_2, sizeof(note_2), RECV_TIME + 2000);
+}
+
+ZTEST(midi_iso_payload, test_midi_1_0_malformed)
+{
+	static const struct malformed_chunk chunks[] = {
+		{"data byte above 0x7F", {PAYLOAD_CHUNK_MIDI_1_0, 4, 0, 0x80, 0x90, 0x3C, 0x90}, 7},
+		{"running status at chunk start",
+		 {PAYLOAD_CHUNK_MIDI_1_0, 3, 0, 0x80, 0x3C, 0x40}, 6},
+		{"truncated message", {PAYLOAD_CHUNK_MIDI_1_0, 3, 0, 0x80, 0x90, 0x3C}, 6},
+		{"timestamp without message", {PAYLOAD_CHUNK_MIDI_1_0, 1, 0, 0x80}, 4},
+		{"SysEx without end", {PAYLOAD_CHUNK_MIDI_1_0, 4, 0, 0x80, 0xF0, 0x7D, 0x01}, 7},
+	};
+
+	malformed_check(chunks, ARRAY_SIZE(chunks));
+}
+
+ZTEST(midi_iso_payload, test_unknown_chunk_skipped)
+{
+	static const uint8_t payload[] = {
+		PAYLOAD_VERSION,
+		0x0F, 2, 0x00, 0x80, 0xF8,
+		PAYLOAD_CHUNK_MIDI_1_0, 2, 0x00, 0x80, 0xFA,
+	};
+	static const uint8_t start[] = {0xFA};
+
+	parse(payload, sizeof(payload), RECV_TIME);
+	zassert_equal(rx.malformed, 0);
+	zassert_equal(rx.count, 1);
+	rx_check(0, start, sizeof(start), RECV_TIME);
+}
+
+ZTEST(midi_iso_payload, test_version_mismatch)
+{
+	static const uint8_t payload[] = {
+		PAYLOAD_VERSION + 1,
+		PAYLOAD_CHUNK_MIDI_1_0, 2, 0x00, 0x80, 0xF8,
+	};
+
+	parse(payload, sizeof(payload), RECV_TIME);
+	zassert_equal(rx.malformed, 1);
+	zassert_equal(rx.count, 0);
+}
+
+/** Four messages to one receiver, one to another */
+static const struct {
+	uint8_t data[8];
+	uint8_t len;
+	uint8_t *muid;
+	uint8_t num;
+	uint16_t offset_us;
+} ump_msgs[] = {
+	{{0x40, 0x90, 0x3C, 0x00, 0x80, 0x00, 0x00, 0x00}, 8, &muid_a, 0xFD, 1000},
+	{{0x40, 0x90, 0x3E, 0x00, 0x80, 0x00, 0x00, 0x00}, 8, &muid_a, 0xFE, 1500},
+	/** Numbers skip PAYLOAD_MSG_NUM_NONE */
+	{{0x40, 0x80, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00}, 8, &muid_a, 0x00, 1500},
+	/** Too far from the message before for a relative fraction */
+	{{0x40, 0x80, 0x3E, 0x00, 0x00, 0x00, 0x00, 0x00}, 8, &muid_a, 0x01, 9000},
+	{{0x20, 0x90, 0x40, 0x7F}, 4, &muid_b, 0x07, 9000},
+};
+
+static uint16_t ump_payload(uint8_t **payload)
+{
+	builder_start(REF_TIME);
+	builder.ack_channel = ack_channel_cb;
+	for (size_t i = 0; i < ARRAY_SIZE(ump_msgs); i++) {
+		add_ump(ump_msgs[i].data, ump_msgs[i].len, ump_msgs[i].muid, ump_msgs[i].num,
+			REF_TIME + ump_msgs[i].offset_us);
+	}
+
+	return builder_finish(REF_TIME + INTERVAL_US, payload);
+}
+
+ZTEST(midi_iso_payload, test_ump_running_status)
+{
+	static const uint8_t expected[] = {
+		PAYLOAD_VERSION,
+		PAYLOAD_CHUNK_UMP | (ACK_CHANNEL_A << 4), 34, MUID_A,
+		PAYLOAD_UMP_SEQ | 10, 0xFD, 0x40, 0x90, 0x3C, 0x00, 0x80, 0x00, 0x00, 0x00,
+		PAYLOAD_UMP_RUNNING | 5, 0x3E, 0x00, 0x80, 0x00, 0x00, 0x00,
+		0, 0x40, 0x80, 0x3C, 0x00, 0x00, 0x00, 0x00, 0x00,
+		PAYLOAD_UMP_RUNNING | PAYLOAD_UMP_FRACTION_ABS, 90, 0x3E, 0x00, 0x00, 0x00, 0x00,
+		0x00,
+		PAYLOAD_CHUNK_UMP | (PAYLOAD_UMP_NO_ACK << 4), 6, MUID_B,
+		PAYLOAD_UMP_SEQ | 0, 0x07, 0x20, 0x90, 0x40, 0x7F,
+	};
+	uint8_t *payload;
+	uint16_t len;
+
+	len = ump_payload(&payload);
+	zassert_equal(len, sizeof(expected));
+	zassert_mem_equal(payload, expected, sizeof(expected));
+
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.count, ARRAY_SIZE(ump_msgs));
+	zassert_equal(rx.malformed, 0);
+	for (size_t i = 0; i < ARRAY_SIZE(ump_msgs); i++) {
+		rx_check(i, ump_msgs[i].data, ump_msgs[i].len, RECV_TIME + ump_msgs[i].offset_us);
+		zassert_equal(rx.msgs[i].format, MIDI_FORMAT_2_0_UMP);
+		zassert_equal(rx.msgs[i].num, ump_msgs[i].num);
+		/** Only the first message of a chunk carries its ACK channel */
+		zassert_equal(rx.msgs[i].ack_channel, (i == 0) ? ACK_CHANNEL_A : 0xFF);
+	}
+}
+
+ZTEST(midi_iso_payload, test_ump_filtered)
+{
+	uint8_t *payload;
+	uint16_t len;
+
+	/** The messages after a dropped one are still decoded against it */
+	parser.ump_filter = rx_ump_filter;
+	parser.user_data = UINT_TO_POINTER(ump_msgs[1].num);
+
+	len = ump_payload(&payload);
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.count, ARRAY_SIZE(ump_msgs) - 1);
+	zassert_equal(rx.malformed, 0);
+	rx_check(0, ump_msgs[0].data, ump_msgs[0].len, RECV_TIME + ump_msgs[0].offset_us);
+	for (size_t i = 2; i < ARRAY_SIZE(ump_msgs); i++) {
+		rx_check(i - 1, ump_msgs[i].data, ump_msgs[i].len,
+			 RECV_TIME + ump_msgs[i].offset_us);
+		zassert_equal(rx.msgs[i - 1].num, ump_msgs[i].num);
+	}
+}
+
+ZTEST(midi_iso_payload, test_ump_malformed)
+{
+	static const struct malformed_chunk chunks[] = {
+		{"first message without number",
+		 {PAYLOAD_CHUNK_UMP, 5, MUID_A, 0, 0x20, 0x90, 0x3C, 0x40}, 8},
+		{"first message in running status",
+		 {PAYLOAD_CHUNK_UMP, 4, MUID_A, PAYLOAD_UMP_SEQ | PAYLOAD_UMP_RUNNING, 0,
+		  0x3C, 0x40}, 7},
+		{"truncated message",
+		 {PAYLOAD_CHUNK_UMP, 4, MUID_A, PAYLOAD_UMP_SEQ, 0, 0x20, 0x90}, 7},
+		{"number missing", {PAYLOAD_CHUNK_UMP, 1, MUID_A, PAYLOAD_UMP_SEQ}, 4},
+		{"fraction missing", {PAYLOAD_CHUNK_UMP, 1, MUID_A, PAYLOAD_UMP_FRACTION_ABS}, 4},
+	};
+
+	malformed_check(chunks, ARRAY_SIZE(chunks));
+}
+
+/**
+ * @brief Build three payloads of a note on each, the last one with copies
+ * of the two before.
+ *
+ * @param max_bytes Bytes of copies in the last payload.
+ */
+static uint16_t fec_payloads(uint16_t max_bytes, uint8_t **payload)
+{
+	static const uint8_t notes[3][3] = {
+		{0x90, 0x3C, 0x40},
+		{0x90, 0x3E, 0x40},
+		{0x90, 0x40, 0x40},
+	};
+	uint16_t len = 0;
+
+	builder_start(REF_TIME);
+	memset(fec, 0, sizeof(fec));
+	builder.fec = fec;
+	builder.fec_depth = FEC_DEPTH;
+	builder.fec_max_bytes = UINT8_MAX;
+
+	for (int i = 0; i < 3; i++) {
+		if (i == 2) {
+			builder.fec_max_bytes = max_bytes;
+		}
+		midi_iso_payload_add_fec(&builder);
+		add_msg(notes[i], sizeof(notes[i]), MIDI_FORMAT_1_0_PARSED,
+			REF_TIME + i * INTERVAL_US + (i + 1) * 1000);
+		len = builder_finish(REF_TIME + (i + 1) * INTERVAL_US, payload);
+	}
+
+	return len;
+}
+
+ZTEST(midi_iso_payload, test_fec_copies)
+{
+	static const uint8_t expected[] = {
+		PAYLOAD_VERSION,
+		PAYLOAD_CHUNK_FEC, 7, 1,
+		PAYLOAD_CHUNK_MIDI_1_0, 4, 0x00, 0x94, 0x90, 0x3E, 0x40,
+		PAYLOAD_CHUNK_FEC, 7, 2,
+		PAYLOAD_CHUNK_MIDI_1_0, 4, 0x00, 0x8A, 0x90, 0x3C, 0x40,
+		PAYLOAD_CHUNK_MIDI_1_0, 4, 0x00, 0x9E, 0x90, 0x40, 0x40,
+	};
+	static const uint8_t note_1[] = {0x90, 0x3C, 0x40};
+	static const uint8_t note_2[] = {0x90, 0x3E, 0x40};
+	static const uint8_t note_3[] = {0x90, 0x40, 0x40};
+	uint8_t *payload;
+	uint16_t len;
+
+	len = fec_payloads(UINT8_MAX, &payload);
+	zassert_equal(len, sizeof(expected));
+	zassert_mem_equal(payload, expected, sizeof(expected));
+
+	/** Copies are skipped without a callback */
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.count, 1);
+	rx_check(0, note_3, sizeof(note_3), RECV_TIME + 3000);
+
+	/** Copies are timed at the payloads they are of */
+	memset(&rx, 0, sizeof(rx));
+	parser.fec_cb = rx_fec_cb;
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.fec_count, 2);
+	zassert_equal(rx.fec_ages[0], 1);
+	zassert_equal(rx.fec_ages[1], 2);
+	zassert_equal(rx.count, 3);
+	rx_check(0, note_2, sizeof(note_2), RECV_TIME - INTERVAL_US + 2000);
+	rx_check(1, note_1, sizeof(note_1), RECV_TIME - 2 * INTERVAL_US + 1000);
+	rx_check(2, note_3, sizeof(note_3), RECV_TIME + 3000);
+
+	/** Only copies of lost payloads are parsed */
+	memset(&rx, 0, sizeof(rx));
+	parser.user_data = UINT_TO_POINTER(2);
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.count, 2);
+	rx_check(0, note_1, sizeof(note_1), RECV_TIME - 2 * INTERVAL_US + 1000);
+	rx_check(1, note_3, sizeof(note_3), RECV_TIME + 3000);
+	zassert_equal(rx.malformed, 0);
+}
+
+ZTEST(midi_iso_payload, test_fec_copies_limited)
+{
+	static const uint8_t expected[] = {
+		PAYLOAD_VERSION,
+		PAYLOAD_CHUNK_FEC, 7, 1,
+		PAYLOAD_CHUNK_MIDI_1_0, 4, 0x00, 0x94, 0x90, 0x3E, 0x40,
+		PAYLOAD_CHUNK_MIDI_1_0, 4, 0x00, 0x9E, 0x90, 0x40, 0x40,
+	};
+	uint8_t *payload;
+	uint16_t len;
+
+	/** Room for one copy, the older one is left out */
+	len = fec_payloads(PAYLOAD_CHUNK_HEADER_SIZE + 7, &payload);
+	zassert_equal(len, sizeof(expected));
+	zassert_mem_equal(payload, expected, sizeof(expected));
+}
+
+/** @brief Fill the snapshot with the state of a few messages. */
+static void snapshot_fill(void)
+{
+	static const struct {
+		uint8_t data[4];
+		uint8_t len;
+		enum midi_format format;
+	} msgs[] = {
+		{{0xB0, 0x07, 0x64}, 3, MIDI_FORMAT_1_0_PARSED},
+		{{0xC0, 0x05}, 2, MIDI_FORMAT_1_0_PARSED},
+		{{0xE0, 0x00, 0x50}, 3, MIDI_FORMAT_1_0_PARSED},
+		{{0x90, 0x3C, 0x40}, 3, MIDI_FORMAT_1_0_PARSED},
+		{{0x90, 0x3E, 0x40}, 3, MIDI_FORMAT_1_0_PARSED},
+		{{0x20, 0xB1, 0x0A, 0x20}, 4, MIDI_FORMAT_2_0_UMP},
+		{{0x20, 0x91, 0x3C, 0x7F}, 4, MIDI_FORMAT_2_0_UMP},
+	};
+	midi_msg_t *msg;
+
+	midi_iso_snapshot_init(&snapshot);
+	for (size_t i = 0; i < ARRAY_SIZE(msgs); i++) {
+		msg = midi_msg_init_alloc(NULL, msgs[i].len, msgs[i].format, &muid_a);
+		zassert_not_null(msg);
+		memcpy(msg->data, msgs[i].data, msgs[i].len);
+		midi_iso_snapshot_update(&snapshot, msg);
+		midi_msg_unref(msg);
+	}
+}
+
+/**
+ * @brief Check the parsed messages against a walk over the snapshot.
+ *
+ * @return Number of entries walked.
+ */
+static size_t snapshot_check(midi_iso_payload_entry_filter_t filter)
+{
+	struct midi_iso_snapshot_cursor cursor = {0};
+	const struct midi_iso_snapshot_entry *entry;
+	uint8_t op;
+	uint8_t len;
+	size_t i = 0;
+
+	while ((entry = midi_iso_snapshot_peek(&snapshot, &cursor))) {
+		midi_iso_snapshot_next(&cursor);
+		if (filter && !filter(entry, NULL)) {
+			continue;
+		}
+
+		op = entry->data[entry->ump ? 1 : 0] >> 4;
+		len = entry->ump ? 4 :
+		      ((op == MIDI_OP_PROGRAM_CHANGE) || (op == MIDI_OP_CHANNEL_PRESSURE)) ? 2 : 3;
+		rx_check(i, entry->data, len, RECV_TIME);
+		zassert_equal(rx.msgs[i].format,
+			      entry->ump ? MIDI_FORMAT_2_0_UMP : MIDI_FORMAT_1_0_PARSED_DELTA_US);
+		if (entry->ump) {
+			zassert_equal(rx.msgs[i].num, PAYLOAD_MSG_NUM_NONE);
+		}
+		i++;
+	}
+	zassert_equal(rx.count, i);
+
+	return i;
+}
+
+/** @return Number of pieces the snapshot is sent in, one per payload. */
+static int snapshot_send(midi_iso_payload_entry_filter_t filter)
+{
+	struct midi_iso_snapshot_cursor cursor = {0};
+	uint8_t *payload;
+	uint16_t len;
+	int piece = 0;
+	int err;
+
+	do {
+		builder_start(REF_TIME + piece * INTERVAL_US);
+		err = midi_iso_payload_add_snapshot(&builder, &snapshot, &cursor, piece,
+						    SNAPSHOT_MAX_BYTES, filter, NULL);
+		zassert_true(err >= 0, "piece %d not added (%d)", piece, err);
+		len = builder_finish(REF_TIME + (piece + 1) * INTERVAL_US, &payload);
+		zassert_true(len <= (1 + PAYLOAD_CHUNK_HEADER_SIZE + SNAPSHOT_MAX_BYTES));
+		parse(payload, len, RECV_TIME);
+		piece++;
+	} while ((err == 0) && (piece < ARRAY_SIZE(rx.pieces)));
+
+	zassert_equal(err, 1, "snapshot not finished in %d pieces", piece);
+
+	return piece;
+}
+
+ZTEST(midi_iso_payload, test_snapshot_pieces)
+{
+	int pieces;
+
+	snapshot_fill();
+	parser.snapshot_cb = rx_snapshot_cb;
+
+	pieces = snapshot_send(NULL);
+	zassert_true(pieces > 1);
+	zassert_equal(rx.piece_count, pieces);
+	for (int i = 0; i < pieces; i++) {
+		zassert_equal(rx.pieces[i], i);
+		zassert_equal(rx.piece_flags[i], (i == pieces - 1) ? PAYLOAD_SNAPSHOT_LAST : 0);
+	}
+	zassert_equal(snapshot_check(NULL), 7);
+	zassert_equal(rx.malformed, 0);
+}
+
+ZTEST(midi_iso_payload, test_snapshot_filtered)
+{
+	snapshot_fill();
+	parser.snapshot_cb = rx_snapshot_cb;
+
+	snapshot_send(midi_1_0_entry);
+	zassert_equal(snapshot_check(midi_1_0_entry), 5);
+	zassert_equal(rx.malformed, 0);
+}
+
+ZTEST(midi_iso_payload, test_snapshot_no_room)
+{
+	struct midi_iso_snapshot_cursor cursor = {0};
+	uint8_t *payload;
+	uint16_t len;
+
+	snapshot_fill();
+
+	/** The first entry does not fit, the walk does not move */
+	builder_start(REF_TIME);
+	builder.size = 1 + PAYLOAD_CHUNK_HEADER_SIZE + 2;
+	zassert_equal(midi_iso_payload_add_snapshot(&builder, &snapshot, &cursor, 0, UINT8_MAX,
+						    NULL, NULL),
+		      -ENOMEM);
+	zassert_equal(cursor.pass, 0);
+	zassert_equal(cursor.index, 0);
+	zassert_equal(builder_finish(REF_TIME + INTERVAL_US, &payload), 0);
+
+	/** Pieces are skipped without a callback */
+	builder.size = PAYLOAD_SIZE;
+	zassert_equal(midi_iso_payload_add_snapshot(&builder, &snapshot, &cursor, 0, UINT8_MAX,
+						    NULL, NULL),
+		      1);
+	len = builder_finish(REF_TIME + 2 * INTERVAL_US, &payload);
+	parse(payload, len, RECV_TIME);
+	zassert_equal(rx.count, 0);
+	zassert_equal(rx.malformed, 0);
+}
+
+ZTEST_SUITE(midi_iso_payload, NULL, NULL, payload_before, NULL, NULL);